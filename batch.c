@@ -0,0 +1,426 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * batch - Convert many files, one JSON file per input.
+ *
+ * The calling thread owns the I/O engine: it keeps up to `depth` files in
+ * flight, hands every completed read to the scheduler (see scheduler.h) and
+ * turns every converted document into a write. Converter threads only ever
+ * see memory, but for the cache, which they look up and fill themselves as
+ * hashing and deflating are work of their own.
+ */
+
+#include "batch.h"
+#include "cache.h"
+#include "cstring.h"
+#include "ioengine.h"
+#include "output.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BATCH_DEPTH_MAX 64
+
+struct batch;
+
+struct batch_job {
+        struct sched_job conv;
+        struct io_request rd;
+        struct io_request wr;
+        char *inpath;
+        char *outpath;
+        size_t size;            /* from stat(), reserved with sched_admit() */
+        dev_t dev;              /* from stat(), 0 if it failed */
+        ino_t ino;
+        struct timespec io_start;       /* rd or wr submitted, for --stats */
+        int failed;
+        int duplicate;          /* same output as an earlier file */
+        struct batch *b;
+        struct batch_job *next;
+};
+
+struct batch_queue {
+        struct batch_job *head;
+        struct batch_job *tail;
+        size_t len;
+};
+
+struct batch {
+        const struct batch_opts *opts;
+        struct io_engine io;
+        struct sched sched;
+
+        pthread_mutex_t lock;
+        struct batch_queue done;        /* converted, waiting for a write */
+
+        struct batch_job *jobs;
+        size_t njobs;
+        size_t alloc;
+};
+
+/* Private functions */
+static void batch_queue_push(struct batch_queue *q, struct batch_job *job)
+{
+        job->next = NULL;
+        if (q->tail)
+                q->tail->next = job;
+        else
+                q->head = job;
+        q->tail = job;
+        q->len++;
+}
+
+static struct batch_job *batch_queue_pop(struct batch_queue *q)
+{
+        struct batch_job *job = q->head;
+
+        if (job) {
+                q->head = job->next;
+                if (!q->head)
+                        q->tail = NULL;
+                job->next = NULL;
+                q->len--;
+        }
+
+        return job;
+}
+
+static int has_xml_suffix(const char *name)
+{
+        size_t len = strlen(name);
+
+        return len > 4 && !strcmp(name + len - 4, ".xml");
+}
+
+static void add_job(struct batch *b, const char *path)
+{
+        struct batch_job *job;
+        const char *base;
+        struct stat sb;
+        cstring out;
+        size_t len;
+
+        ALLOC_GROW(b->jobs, b->njobs + 1, b->alloc);
+        job = &b->jobs[b->njobs++];
+        memset(job, 0, sizeof(struct batch_job));
+        job->inpath = xstrdup(path);
+        if (stat(path, &sb) == 0) {
+                job->size = sb.st_size;
+                job->dev = sb.st_dev;
+                job->ino = sb.st_ino;
+        }
+
+        base = strrchr(path, '/');
+        base = base ? base + 1 : path;
+        len = strlen(base);
+        if (has_xml_suffix(base))
+                len -= 4;
+
+        cstring_init(&out, 0);
+        cstring_addstr(&out, b->opts->outdir);
+        cstring_addch(&out, '/');
+        cstring_add(&out, base, len);
+        cstring_addstr(&out, ".json");
+        job->outpath = cstring_detach(&out, NULL);
+}
+
+static void add_dir(struct batch *b, const char *dir)
+{
+        struct dirent **names;
+        int i, n;
+
+        n = scandir(dir, &names, NULL, alphasort);
+        if (n < 0) {
+                fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+                return;
+        }
+
+        for (i = 0; i < n; i++) {
+                if (has_xml_suffix(names[i]->d_name)) {
+                        cstring path;
+
+                        cstring_init(&path, 0);
+                        cstring_addstr(&path, dir);
+                        cstring_addch(&path, '/');
+                        cstring_addstr(&path, names[i]->d_name);
+                        add_job(b, path.buf);
+                        cstring_release(&path);
+                }
+                free(names[i]);
+        }
+        free(names);
+}
+
+/* By output path, then in the order the files were given */
+static int job_cmp(const void *a, const void *b)
+{
+        const struct batch_job *x = *(const struct batch_job * const *) a;
+        const struct batch_job *y = *(const struct batch_job * const *) b;
+        int ret = strcmp(x->outpath, y->outpath);
+
+        if (ret)
+                return ret;
+        return x < y ? -1 : x > y;
+}
+
+/* Whether two jobs read the same file, by name if it could not be found */
+static int same_file(const struct batch_job *x, const struct batch_job *y)
+{
+        if (x->ino || y->ino)
+                return x->dev == y->dev && x->ino == y->ino;
+        return !strcmp(x->inpath, y->inpath);
+}
+
+/* Files with the same name in different directories would overwrite each
+ * other's output. Only the first of them is converted, the others are
+ * reported and dropped. A file given more than once, by name or in a
+ * directory, is only converted once and not reported. Returns how many
+ * were reported. */
+static size_t drop_duplicates(struct batch *b)
+{
+        struct batch_job **sorted;
+        size_t i, k, first, n = 0, reported = 0;
+
+        if (b->njobs < 2)
+                return 0;
+
+        ALLOC_ARRAY(sorted, b->njobs);
+        for (i = 0; i < b->njobs; i++)
+                sorted[i] = &b->jobs[i];
+        qsort(sorted, b->njobs, sizeof(*sorted), job_cmp);
+
+        for (i = 1, first = 0; i < b->njobs; i++) {
+                if (strcmp(sorted[i]->outpath, sorted[first]->outpath)) {
+                        first = i;
+                        continue;
+                }
+                sorted[i]->duplicate = 1;
+
+                /* Every other file is reported once */
+                for (k = first; k < i; k++)
+                        if (same_file(sorted[k], sorted[i]))
+                                break;
+                if (k < i)
+                        continue;
+                fprintf(stderr, "%s: %s is also written by %s\n",
+                        sorted[i]->inpath, sorted[i]->outpath,
+                        sorted[first]->inpath);
+                reported++;
+        }
+        xfree(sorted);
+
+        for (i = 0; i < b->njobs; i++) {
+                if (b->jobs[i].duplicate) {
+                        xfree(b->jobs[i].inpath);
+                        xfree(b->jobs[i].outpath);
+                        continue;
+                }
+                b->jobs[n++] = b->jobs[i];
+        }
+        b->njobs = n;
+
+        return reported;
+}
+
+static void convert_job(struct sched_job *conv)
+{
+        struct batch_job *job = conv->data;
+        struct batch *b = job->b;
+        struct cache_key key;
+        struct output out;
+
+        if (b->opts->cache != NULL) {
+                cache_key(b->opts->cache, job->rd.buf, job->rd.len, &key);
+                if (cache_get(b->opts->cache, &key, &job->wr.buf,
+                              &job->wr.len)) {
+                        STATS_ADD(cache_hits, 1);
+                        STATS_ADD(bytes_in, job->rd.len);
+                        STATS_ADD(bytes_out, job->wr.len);
+                        goto done;
+                }
+                STATS_ADD(cache_misses, 1);
+        }
+
+        output_init_mem(&out);
+        if (b->opts->convert(job->rd.buf, job->rd.len, job->inpath, &out,
+                             b->opts->convert_data) < 0) {
+                job->failed = 1;
+                output_release(&out);
+        } else {
+                job->wr.buf = output_detach(&out, &job->wr.len);
+                if (b->opts->cache != NULL)
+                        cache_put(b->opts->cache, &key, job->wr.buf,
+                                  job->wr.len);
+        }
+
+done:
+        stats_mutex_lock(&b->lock);
+        batch_queue_push(&b->done, job);
+        io_engine_wake(&b->io);
+        pthread_mutex_unlock(&b->lock);
+}
+
+/* The engine reads and writes on threads of its own or in the kernel, so
+ * the time a request is in flight counts towards its phase, as wall time */
+static void submit(struct batch *b, struct io_request *req)
+{
+        struct batch_job *job = req->data;
+
+        if (stats_enabled)
+                clock_gettime(CLOCK_MONOTONIC, &job->io_start);
+        io_engine_submit(&b->io, req);
+}
+
+static void report(const char *path, int err)
+{
+        if (err)
+                fprintf(stderr, "%s: %s\n", path, strerror(err));
+        else
+                fprintf(stderr, "%s: conversion failed\n", path);
+}
+
+/* Public functions */
+int batch_run(const struct batch_opts *opts, char **paths, int npaths)
+{
+        struct batch b;
+        struct sched_opts sopts;
+        unsigned int i, depth;
+        size_t next = 0, inflight = 0, remaining;
+        int failed = 0;
+
+        memset(&b, 0, sizeof(struct batch));
+        b.opts = opts;
+
+        if (mkdir(opts->outdir, 0755) < 0 && errno != EEXIST) {
+                fprintf(stderr, "%s: %s\n", opts->outdir, strerror(errno));
+                return npaths;
+        }
+        pthread_mutex_init(&b.lock, NULL);
+
+        for (i = 0; i < (unsigned int) npaths; i++) {
+                struct stat sb;
+
+                if (stat(paths[i], &sb) == 0 && S_ISDIR(sb.st_mode))
+                        add_dir(&b, paths[i]);
+                else
+                        add_job(&b, paths[i]);
+        }
+        failed = (int) drop_duplicates(&b);
+
+        /* Enough files in flight to keep every converter busy while the
+         * next ones are being read and the previous ones written */
+        depth = opts->jobs * 2 + 2;
+        if (depth > BATCH_DEPTH_MAX)
+                depth = BATCH_DEPTH_MAX;
+
+        if (io_engine_init(&b.io, opts->engine, depth) < 0) {
+                fprintf(stderr, "I/O engine '%s' is not available\n",
+                        opts->engine ? opts->engine : "any");
+                failed += (int) b.njobs;
+                goto out;
+        }
+
+        memset(&sopts, 0, sizeof(struct sched_opts));
+        sopts.jobs = opts->jobs;
+        sopts.small_max = opts->small_max;
+        sopts.max_inflight = opts->max_inflight;
+        sopts.thread_done = opts->thread_done;
+        sopts.data = opts->convert_data;
+        sched_init(&b.sched, &sopts);
+
+        remaining = b.njobs;
+        while (remaining) {
+                struct io_request *req;
+                struct batch_job *job;
+
+                while (inflight < depth && next < b.njobs &&
+                       sched_admit(&b.sched, b.jobs[next].size, 0) == 0) {
+                        job = &b.jobs[next++];
+                        job->b = &b;
+                        job->rd.op = IO_OP_READ;
+                        job->rd.path = job->inpath;
+                        job->rd.data = job;
+                        submit(&b, &job->rd);
+                        inflight++;
+                }
+
+                req = io_engine_wait(&b.io);
+                if (req == NULL) {
+                        /* Woken up by the converters */
+                        struct batch_queue done;
+
+                        stats_mutex_lock(&b.lock);
+                        done = b.done;
+                        b.done.head = b.done.tail = NULL;
+                        b.done.len = 0;
+                        pthread_mutex_unlock(&b.lock);
+
+                        while ((job = batch_queue_pop(&done))) {
+                                io_engine_release(&b.io, &job->rd);
+                                if (job->failed) {
+                                        report(job->inpath, 0);
+                                        sched_release(&b.sched, job->size);
+                                        failed++;
+                                        remaining--;
+                                        inflight--;
+                                        continue;
+                                }
+                                job->wr.op = IO_OP_WRITE;
+                                job->wr.path = job->outpath;
+                                job->wr.data = job;
+                                submit(&b, &job->wr);
+                        }
+                        continue;
+                }
+
+                job = req->data;
+                STATS_ADD(wall_ns[req->op == IO_OP_READ ?
+                                  STATS_INPUT : STATS_WRITE],
+                          stats_elapsed_ns(&job->io_start));
+                if (req->op == IO_OP_READ && !req->error) {
+                        job->conv.size = req->len;
+                        job->conv.run = convert_job;
+                        job->conv.data = job;
+                        sched_submit(&b.sched, &job->conv);
+                        continue;
+                }
+
+                if (req->op == IO_OP_READ) {
+                        io_engine_release(&b.io, req);
+                        report(job->inpath, req->error);
+                        failed++;
+                } else {
+                        if (req->error) {
+                                report(job->outpath, req->error);
+                                failed++;
+                        }
+                        xfree(job->wr.buf);
+                }
+                sched_release(&b.sched, job->size);
+                remaining--;
+                inflight--;
+        }
+
+        sched_free(&b.sched);
+        io_engine_free(&b.io);
+
+        if (opts->cache != NULL)
+                STATS_ADD(cache_evicted, cache_evict(opts->cache));
+
+out:
+        for (next = 0; next < b.njobs; next++) {
+                xfree(b.jobs[next].inpath);
+                xfree(b.jobs[next].outpath);
+        }
+        xfree(b.jobs);
+
+        pthread_mutex_destroy(&b.lock);
+
+        return failed;
+}
@@ -0,0 +1,56 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * batch - Convert many files, one JSON file per input.
+ */
+
+#ifndef XML2JSON_BATCH_H
+#define XML2JSON_BATCH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cache;
+struct output;
+
+/* Convert the XML document in `buf` into `out`. Returns 0 on success, -1
+ * if the document could not be converted. Called from several threads at
+ * once.
+ */
+typedef int (*batch_convert_fn)(const char *buf, size_t len,
+                                const char *name, struct output *out,
+                                const void *data);
+
+struct batch_opts {
+        const char *outdir;       /* where the .json files go */
+        const char *engine;       /* I/O engine name, NULL for the best */
+        unsigned int jobs;        /* converter threads */
+        size_t small_max;         /* scheduler lanes, see scheduler.h */
+        size_t max_inflight;
+        batch_convert_fn convert;
+        const void *convert_data;
+        void (*thread_done)(const void *convert_data);
+        struct cache *cache;      /* reuse earlier output, NULL for none */
+};
+
+/* batch_run():
+ * Convert every file in `paths` to `<outdir>/<name>.json`. Directories are
+ * expanded to the *.xml files they contain. Reading and writing is done by
+ * an I/O engine (see ioengine.h) so converter threads never block on I/O.
+ * Small files are converted ahead of large ones, and files are only read
+ * while their bytes fit under `max_inflight`. With a cache, files whose
+ * bytes were converted before with the same options are not converted
+ * again. Files whose name is taken by an earlier one in another directory
+ * are not converted and count as failed. Returns the number of files that
+ * failed.
+ */
+int batch_run(const struct batch_opts *opts, char **paths, int npaths);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_BATCH_H */
@@ -0,0 +1,172 @@
+#!/bin/sh
+#
+# xml2json benchmark harness
+#
+# Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+#
+# Runs every mode of xml2json over a corpus, `-w` warmup runs and `-r`
+# measured runs each, and reports MB/s, ns/node, allocations/node and peak
+# RSS with 95% confidence intervals. Every row is also appended to the
+# results file as one JSON object per line, two such files can be compared
+# with `bench.sh -c old.ndjson new.ndjson`.
+#
+# Usage: bench.sh [-r reps] [-w warmup] [-m modes] [-o results] xml2json file...
+#        bench.sh -c old.ndjson new.ndjson
+
+REPS=5
+WARMUP=1
+RESULTS=
+MODES="default sequential populate prefault stream batch-uring batch-threads"
+
+usage() {
+        sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+        exit 1
+}
+
+# Student's t for a 95% two sided interval, df = $1
+tvalue() {
+        awk -v df="$1" 'BEGIN {
+                split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 " \
+                      "2.262 2.228 2.201 2.179 2.160 2.145 2.131 2.120 " \
+                      "2.110 2.101 2.093 2.086", t, " ");
+                print (df < 1) ? 0 : (df <= 20) ? t[df] : (df <= 30) ? 2.04 : 1.96;
+        }'
+}
+
+compare() {
+        awk -F'"' '
+        function field(name,    i) {
+                for (i = 1; i < NF; i++)
+                        if ($i == name)
+                                return substr($(i + 1), 2) + 0;
+                return 0;
+        }
+        function key(    i, m, f) {
+                for (i = 1; i < NF; i++) {
+                        if ($i == "mode") m = $(i + 2);
+                        if ($i == "file") f = $(i + 2);
+                }
+                return m " " f;
+        }
+        FNR == NR { old[key()] = field("mbps"); oldci[key()] = field("mbps_ci"); next }
+        {
+                k = key();
+                if (!(k in old))
+                        next;
+                new = field("mbps");
+                d = old[k] ? (new - old[k]) * 100 / old[k] : 0;
+                flag = (new - field("mbps_ci") > old[k] + oldci[k]) ? "faster" : \
+                       (new + field("mbps_ci") < old[k] - oldci[k]) ? "SLOWER" : "";
+                printf "%-14s %-32s %10.2f %10.2f %+7.1f%% %s\n", \
+                        substr(k, 1, index(k, " ") - 1), substr(k, index(k, " ") + 1), \
+                        old[k], new, d, flag;
+        }' "$1" "$2"
+}
+
+# Print the value of a numeric field of the --stats=json line in $1
+stat() {
+        tail -n 1 "$1" | sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p"
+}
+
+while getopts "r:w:m:o:c" opt; do
+        case $opt in
+        r) REPS=$OPTARG ;;
+        w) WARMUP=$OPTARG ;;
+        m) MODES=$OPTARG ;;
+        o) RESULTS=$OPTARG ;;
+        c) COMPARE=1 ;;
+        *) usage ;;
+        esac
+done
+shift $((OPTIND - 1))
+
+if [ -n "$COMPARE" ]; then
+        [ $# -eq 2 ] || usage
+        compare "$1" "$2"
+        exit 0
+fi
+
+[ $# -ge 2 ] || usage
+BIN=$1
+shift
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/xml2json-bench.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+REV=$(git describe --always --dirty 2>/dev/null || echo unknown)
+T=$(tvalue $((REPS - 1)))
+
+run() {
+        mode=$1
+        file=$2
+        case $mode in
+        default)        "$BIN" --stats=json "$file" ;;
+        batch-*)        "$BIN" --stats=json -o "$TMP/out" --io="${mode#batch-}" \
+                                "$file" ;;
+        *)              "$BIN" --stats=json --input="$mode" "$file" ;;
+        esac > /dev/null 2> "$TMP/stats"
+}
+
+printf "%-14s %-32s %16s %14s %12s %14s\n" mode file "MB/s" "ns/node" \
+        "allocs/node" "peak RSS KB"
+
+for mode in $MODES; do
+        for file in "$@"; do
+                i=0
+                while [ $i -lt "$WARMUP" ]; do
+                        run "$mode" "$file"
+                        i=$((i + 1))
+                done
+
+                : > "$TMP/samples"
+                i=0
+                while [ $i -lt "$REPS" ]; do
+                        if ! run "$mode" "$file"; then
+                                echo "$mode $file: xml2json failed" >&2
+                                break
+                        fi
+                        echo "$(stat "$TMP/stats" wall_ms) \
+                              $(stat "$TMP/stats" bytes_in) \
+                              $(stat "$TMP/stats" nodes) \
+                              $(stat "$TMP/stats" mallocs) \
+                              $(stat "$TMP/stats" peak_rss_kb)" >> "$TMP/samples"
+                        i=$((i + 1))
+                done
+
+                awk -v mode="$mode" -v file="$file" -v t="$T" -v rev="$REV" \
+                    -v results="$RESULTS" '
+                function mean(x, n,    i, s) {
+                        for (i = 1; i <= n; i++) s += x[i];
+                        return n ? s / n : 0;
+                }
+                function ci(x, n, m,    i, s) {
+                        if (n < 2) return 0;
+                        for (i = 1; i <= n; i++) s += (x[i] - m) ^ 2;
+                        return t * sqrt(s / (n - 1)) / sqrt(n);
+                }
+                $1 > 0 {
+                        n++;
+                        mbps[n] = $2 / 1e3 / $1;
+                        nsnode[n] = $3 ? $1 * 1e6 / $3 : 0;
+                        allocs[n] = $3 ? $4 / $3 : 0;
+                        rss[n] = $5;
+                }
+                END {
+                        if (!n) exit;
+                        m1 = mean(mbps, n); c1 = ci(mbps, n, m1);
+                        m2 = mean(nsnode, n); c2 = ci(nsnode, n, m2);
+                        m3 = mean(allocs, n);
+                        m4 = mean(rss, n); c4 = ci(rss, n, m4);
+                        printf "%-14s %-32s %8.2f ±%6.2f %7.0f ±%5.0f %12.2f %8.0f ±%4.0f\n", \
+                                mode, file, m1, c1, m2, c2, m3, m4, c4;
+                        if (results != "")
+                                printf "{\"rev\":\"%s\",\"mode\":\"%s\",\"file\":\"%s\"," \
+                                       "\"runs\":%d,\"mbps\":%.3f,\"mbps_ci\":%.3f," \
+                                       "\"ns_per_node\":%.1f,\"ns_per_node_ci\":%.1f," \
+                                       "\"allocs_per_node\":%.3f,\"peak_rss_kb\":%.0f," \
+                                       "\"peak_rss_kb_ci\":%.0f}\n", \
+                                       rev, mode, file, n, m1, c1, m2, c2, m3, m4, c4 \
+                                       >> results;
+                }' "$TMP/samples"
+        done
+done
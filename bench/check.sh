@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# xml2json output regression check
+#
+# Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+#
+# Every <case>.xml in the directory is converted once for each line of
+# <case>.args, which holds the options, from within the directory. What
+# all the runs print to stdout must be <case>.out and what they print to
+# stderr <case>.err, or nothing if there is no such file, in which case
+# they must all succeed; otherwise at least one of them must fail. Error
+# lines are compared up to their byte offset, the rest is libxml2's to
+# word. Exits non zero if any case does not match.
+#
+# Usage: check.sh xml2json dir
+
+usage() {
+        sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+        exit 1
+}
+
+[ $# -eq 2 ] || usage
+
+case $1 in
+/*) BIN=$1 ;;
+*) BIN=$(pwd)/$1 ;;
+esac
+DIR=$2
+
+# Error lines without libxml2's message
+where() {
+        sed 's/\( at byte [0-9]*\): .*/\1/' "$1"
+}
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/xml2json-check.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+cd "$DIR" || exit 1
+
+fail=0
+for xml in *.xml; do
+        c=${xml%.xml}
+        : > "$TMP/out"
+        : > "$TMP/err"
+        failed=0
+        while read -r args; do
+                "$BIN" $args "$xml" >> "$TMP/out" 2>> "$TMP/err" || failed=1
+        done < "$c.args"
+
+        status=ok
+        [ -f "$c.err" ] && where "$c.err" > "$TMP/expected-err"
+        if ! cmp -s "$TMP/out" "$c.out"; then
+                status="FAILED, stdout differs"
+                diff -u "$c.out" "$TMP/out" >&2
+        elif [ -f "$c.err" ] &&
+             ! where "$TMP/err" | cmp -s - "$TMP/expected-err"; then
+                status="FAILED, stderr differs"
+                diff -u "$c.err" "$TMP/err" >&2
+        elif [ ! -f "$c.err" ] && [ -s "$TMP/err" ]; then
+                status="FAILED, unexpected stderr"
+                cat "$TMP/err" >&2
+        elif [ -f "$c.err" ] && [ $failed -eq 0 ]; then
+                status="FAILED, should have failed"
+        elif [ ! -f "$c.err" ] && [ $failed -ne 0 ]; then
+                status="FAILED, exited non zero"
+        fi
+        [ "$status" = ok ] || fail=1
+        printf "%-40s %s\n" "$c" "$status"
+done
+
+exit $fail
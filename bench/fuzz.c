@@ -0,0 +1,527 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * fuzz - Search for inputs that make the converter superlinear.
+ *
+ * The cost of an input is the number of allocations (or, with -t, the
+ * nanoseconds) the converter spends on it per input byte. Three front ends
+ * share that objective:
+ *
+ *  - libFuzzer, built with -DXML2JSON_LIBFUZZER: inputs costing more than
+ *    $XML2JSON_FUZZ_LIMIT abort, so they are kept and minimized as crashes.
+ *  - AFL and friends: `fuzz -R @@` runs one input and aborts likewise.
+ *  - A built-in search, the default: XML aware mutations (nest, duplicate,
+ *    widen, rename, graft) of the seeds, keeping the costliest inputs. Each
+ *    input runs in a child so crashes and timeouts are findings as well.
+ *    The costliest inputs are minimized by deleting elements and
+ *    attributes while the cost per byte holds, and written out.
+ *
+ * `fuzz -M file` only minimizes `file`.
+ */
+
+#include "convert.h"
+#include "output.h"
+#include "util.h"
+
+#include <libxml/tree.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Allows for the fixed cost of a conversion on tiny inputs */
+#define FUZZ_LEN_BIAS           64
+#define FUZZ_DEFAULT_LIMIT      50.0
+#define FUZZ_POOL_SIZE          64
+#define FUZZ_MAX_NODES          1024
+#define FUZZ_NAMES              256     /* distinct names new elements get */
+
+#define XML_FUZZ_OPTIONS (XML_PARSE_COMPACT | XML_PARSE_NONET | \
+                          XML_PARSE_NOERROR | XML_PARSE_NOWARNING)
+
+enum fuzz_status {
+        FUZZ_OK,
+        FUZZ_INVALID,           /* not well formed */
+        FUZZ_CRASH,
+        FUZZ_TIMEOUT,
+};
+
+struct fuzz_cost {
+        enum fuzz_status status;
+        uint64_t allocs;
+        uint64_t ns;
+        double score;           /* allocs or ns per byte */
+};
+
+struct fuzz_input {
+        char *buf;
+        size_t len;
+        struct fuzz_cost cost;
+};
+
+static int fuzz_time;                   /* -t: ns instead of allocations */
+static unsigned int fuzz_timeout_ms = 2000;
+static uint64_t fuzz_rng = 1;
+
+/* Private functions */
+static void convert(const char *buf, size_t len, struct fuzz_cost *c)
+{
+        struct convert_opts opts = { XML_FUZZ_OPTIONS };
+        struct timespec start, end;
+        struct output out;
+        int ret;
+
+        memset(&alloc_stats, 0, sizeof(struct alloc_stats));
+        alloc_stats_enabled = 1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        output_init_mem(&out);
+        ret = convert_buffer(buf, len, "fuzz", &out, &opts);
+        output_release(&out);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        c->status = ret < 0 ? FUZZ_INVALID : FUZZ_OK;
+        c->allocs = alloc_stats.mallocs + alloc_stats.reallocs;
+        c->ns = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000ULL +
+                end.tv_nsec - start.tv_nsec;
+        c->score = (double) (fuzz_time ? c->ns : c->allocs) /
+                (len + FUZZ_LEN_BIAS);
+}
+
+static double fuzz_limit(void)
+{
+        const char *s = getenv("XML2JSON_FUZZ_LIMIT");
+
+        return s ? atof(s) : FUZZ_DEFAULT_LIMIT;
+}
+
+static void check_limit(const char *buf, size_t len)
+{
+        static double limit = -1;
+        struct fuzz_cost c;
+
+        if (limit < 0)
+                limit = fuzz_limit();
+
+        convert(buf, len, &c);
+        if (c.score > limit) {
+                fprintf(stderr, "superlinear input: %.1f %s per byte "
+                        "(limit %.1f)\n", c.score,
+                        fuzz_time ? "ns" : "allocations", limit);
+                abort();
+        }
+}
+
+#ifdef XML2JSON_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+        check_limit((const char *) data, size);
+        return 0;
+}
+
+#else
+
+static uint64_t rnd(void)
+{
+        uint64_t z = (fuzz_rng += 0x9e3779b97f4a7c15ULL);
+
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+}
+
+static size_t rnd_below(size_t n)
+{
+        return n ? rnd() % n : 0;
+}
+
+/* Convert `buf` in a child, so that crashes and timeouts can be told */
+static void evaluate(const char *buf, size_t len, struct fuzz_cost *c)
+{
+        struct pollfd pfd;
+        int fds[2], status;
+        pid_t pid;
+
+        memset(c, 0, sizeof(struct fuzz_cost));
+
+        if (pipe(fds) < 0 || (pid = fork()) < 0) {
+                perror("fuzz: ");
+                exit(EXIT_FAILURE);
+        }
+
+        if (pid == 0) {
+                close(fds[0]);
+                convert(buf, len, c);
+                if (write(fds[1], c, sizeof(struct fuzz_cost)) < 0)
+                        _exit(EXIT_FAILURE);
+                _exit(EXIT_SUCCESS);
+        }
+
+        close(fds[1]);
+        pfd.fd = fds[0];
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, fuzz_timeout_ms) == 0) {
+                kill(pid, SIGKILL);
+                c->status = FUZZ_TIMEOUT;
+                c->score = HUGE_VAL;
+        } else if (read(fds[0], c, sizeof(struct fuzz_cost)) !=
+                   sizeof(struct fuzz_cost)) {
+                c->status = FUZZ_CRASH;
+        }
+        close(fds[0]);
+        waitpid(pid, &status, 0);
+}
+
+static xmlDocPtr parse(const char *buf, size_t len)
+{
+        return xmlReadMemory(buf, len, "fuzz", NULL, XML_FUZZ_OPTIONS |
+                             XML_PARSE_NOBLANKS);
+}
+
+static void serialize(xmlDocPtr doc, struct fuzz_input *in)
+{
+        xmlChar *mem;
+        int len;
+
+        xmlDocDumpMemory(doc, &mem, &len);
+        in->buf = xmalloc(len > 0 ? len : 1);
+        memcpy(in->buf, mem, len > 0 ? len : 0);
+        in->len = len > 0 ? len : 0;
+        xmlFree(mem);
+}
+
+static void collect(xmlNodePtr node, xmlNodePtr *nodes, size_t *n, size_t max)
+{
+        for (; node; node = node->next) {
+                if (node->type != XML_ELEMENT_NODE)
+                        continue;
+                if (*n < max)
+                        nodes[(*n)++] = node;
+                collect(node->children, nodes, n, max);
+        }
+}
+
+/* One XML aware mutation of `in`, returns -1 if it did not apply */
+static int mutate(const struct fuzz_input *in, struct fuzz_input *out,
+                  size_t maxlen)
+{
+        xmlNodePtr nodes[FUZZ_MAX_NODES], n, m, c;
+        xmlDocPtr doc;
+        char name[32];
+        size_t nr = 0;
+
+        if ((doc = parse(in->buf, in->len)) == NULL)
+                return -1;
+        collect(xmlDocGetRootElement(doc), nodes, &nr, FUZZ_MAX_NODES);
+        if (!nr) {
+                xmlFreeDoc(doc);
+                return -1;
+        }
+
+        n = nodes[rnd_below(nr)];
+        m = nodes[rnd_below(nr)];
+        snprintf(name, sizeof(name), "n%zu", rnd_below(FUZZ_NAMES));
+
+        switch (rnd_below(7)) {
+        case 0:         /* nest: wrap a non root element in a new parent */
+                if (n == xmlDocGetRootElement(doc))
+                        break;
+                c = xmlNewNode(NULL, rnd_below(2) ? n->name : (const xmlChar *) name);
+                xmlReplaceNode(n, c);
+                xmlAddChild(c, n);
+                break;
+        case 1:         /* duplicate: one more same-name sibling */
+                if (n == xmlDocGetRootElement(doc))
+                        break;
+                xmlAddNextSibling(n, xmlCopyNode(n, 1));
+                break;
+        case 2:         /* widen: one more distinctly named child */
+                xmlNewChild(n, NULL, (const xmlChar *) name, (const xmlChar *) "1");
+                break;
+        case 3:         /* rename to the name of another element */
+                xmlNodeSetName(n, m->name);
+                break;
+        case 4:
+                xmlSetProp(n, (const xmlChar *) name, (const xmlChar *) "v");
+                break;
+        case 5:
+                xmlAddChild(n, xmlNewText((const xmlChar *) "text"));
+                break;
+        case 6:         /* graft a copy of another subtree */
+                xmlAddChild(n, xmlCopyNode(m, 1));
+                break;
+        }
+
+        serialize(doc, out);
+        xmlFreeDoc(doc);
+
+        if (out->len > maxlen) {
+                xfree(out->buf);
+                return -1;
+        }
+        return 0;
+}
+
+static int still_slow(const struct fuzz_cost *orig, const struct fuzz_cost *c)
+{
+        if (orig->status != FUZZ_OK)
+                return c->status == orig->status;
+        return c->status == FUZZ_OK && c->score >= orig->score;
+}
+
+/* Delete elements, then attributes, as long as the input stays as costly
+ * per byte (or keeps crashing or timing out)
+ */
+static void minimize(struct fuzz_input *in)
+{
+        xmlNodePtr nodes[FUZZ_MAX_NODES];
+        struct fuzz_input cand;
+        struct fuzz_cost c;
+        xmlDocPtr doc;
+        size_t i, nr;
+        int progress = 1;
+
+        while (progress) {
+                progress = 0;
+                for (i = 0; ; i++) {
+                        if ((doc = parse(in->buf, in->len)) == NULL)
+                                return;
+                        nr = 0;
+                        collect(xmlDocGetRootElement(doc), nodes, &nr,
+                                FUZZ_MAX_NODES);
+                        if (i >= 2 * nr) {
+                                xmlFreeDoc(doc);
+                                break;
+                        }
+
+                        if (i < nr) {
+                                if (nodes[nr - 1 - i] ==
+                                    xmlDocGetRootElement(doc)) {
+                                        xmlFreeDoc(doc);
+                                        continue;
+                                }
+                                xmlUnlinkNode(nodes[nr - 1 - i]);
+                                xmlFreeNode(nodes[nr - 1 - i]);
+                        } else if (nodes[i - nr]->properties) {
+                                xmlRemoveProp(nodes[i - nr]->properties);
+                        } else {
+                                xmlFreeDoc(doc);
+                                continue;
+                        }
+
+                        serialize(doc, &cand);
+                        xmlFreeDoc(doc);
+                        evaluate(cand.buf, cand.len, &c);
+                        if (still_slow(&in->cost, &c)) {
+                                xfree(in->buf);
+                                in->buf = cand.buf;
+                                in->len = cand.len;
+                                if (c.status == FUZZ_OK)
+                                        in->cost = c;
+                                progress = 1;
+                                i--;
+                        } else {
+                                xfree(cand.buf);
+                        }
+                }
+        }
+}
+
+static void read_file(const char *path, struct fuzz_input *in)
+{
+        struct stat st;
+        int fd;
+
+        if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        in->len = st.st_size;
+        in->buf = xmalloc(in->len + 1);
+        if (read(fd, in->buf, in->len) != (ssize_t) in->len) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        close(fd);
+}
+
+static void write_file(const char *dir, const char *kind, unsigned int n,
+                       const struct fuzz_input *in)
+{
+        char path[PATH_MAX];
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/%s-%u.xml", dir, kind, n);
+        if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+            write(fd, in->buf, in->len) != (ssize_t) in->len) {
+                perror(path);
+                exit(EXIT_FAILURE);
+        }
+        close(fd);
+
+        if (in->cost.status == FUZZ_OK)
+                printf("%s: %zu bytes, %llu allocations, %.1f per byte\n",
+                       path, in->len, (unsigned long long) in->cost.allocs,
+                       in->cost.score);
+        else
+                printf("%s: %zu bytes, %s\n", path, in->len,
+                       in->cost.status == FUZZ_CRASH ? "crash" : "timeout");
+}
+
+static void print_cost(const char *what, const struct fuzz_input *in)
+{
+        static const char *status[] = { "ok", "invalid", "crash", "timeout" };
+
+        printf("%s: %zu bytes, %s, %llu allocations, %.3f ms, %.1f %s/byte\n",
+               what, in->len, status[in->cost.status],
+               (unsigned long long) in->cost.allocs, in->cost.ns / 1e6,
+               in->cost.score, fuzz_time ? "ns" : "allocations");
+}
+
+static void fuzz_usage(void)
+{
+        fprintf(stderr, "USAGE: fuzz [-n iters] [-s seed] [-l maxlen] [-k keep] "
+                "[-T ms] [-t] [-o dir] seed.xml...\n");
+        fprintf(stderr, "       fuzz -M file.xml    minimize file.xml\n");
+        fprintf(stderr, "       fuzz -R file.xml    run once, abort if over "
+                "$XML2JSON_FUZZ_LIMIT (%.0f)\n", FUZZ_DEFAULT_LIMIT);
+        fprintf(stderr, " -t : cost is time per byte instead of allocations\n");
+        exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+        static struct fuzz_input pool[FUZZ_POOL_SIZE];
+        struct fuzz_input in;
+        const char *outdir = ".", *minfile = NULL, *runfile = NULL;
+        unsigned long iters = 10000, it;
+        size_t maxlen = 4096, npool = 0, keep = 3, i, worst;
+        unsigned int crashes = 0, timeouts = 0;
+        double best = 0;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "n:s:l:k:T:to:M:R:h")) != -1) {
+                switch (opt) {
+                case 'n': iters = strtoul(optarg, NULL, 10); break;
+                case 's': fuzz_rng = strtoull(optarg, NULL, 0); break;
+                case 'l': maxlen = strtoul(optarg, NULL, 10); break;
+                case 'k': keep = strtoul(optarg, NULL, 10); break;
+                case 'T': fuzz_timeout_ms = strtoul(optarg, NULL, 10); break;
+                case 't': fuzz_time = 1; break;
+                case 'o': outdir = optarg; break;
+                case 'M': minfile = optarg; break;
+                case 'R': runfile = optarg; break;
+                default: fuzz_usage();
+                }
+        }
+
+        xmlInitParser();
+
+        if (runfile != NULL) {
+                read_file(runfile, &in);
+                check_limit(in.buf, in.len);
+                return 0;
+        }
+
+        if (minfile != NULL) {
+                read_file(minfile, &in);
+                evaluate(in.buf, in.len, &in.cost);
+                print_cost("before", &in);
+                minimize(&in);
+                print_cost("after", &in);
+                fwrite(in.buf, 1, in.len, stdout);
+                return 0;
+        }
+
+        for (i = optind; i < (size_t) argc && npool < FUZZ_POOL_SIZE; i++) {
+                read_file(argv[i], &pool[npool]);
+                evaluate(pool[npool].buf, pool[npool].len, &pool[npool].cost);
+                if (pool[npool].cost.status == FUZZ_OK)
+                        npool++;
+                else
+                        xfree(pool[npool].buf);
+        }
+        if (!npool) {
+                pool[0].buf = xstrdup("<r><a>1</a><b x=\"y\">2</b></r>");
+                pool[0].len = strlen(pool[0].buf);
+                evaluate(pool[0].buf, pool[0].len, &pool[0].cost);
+                npool = 1;
+        }
+
+        for (it = 0; it < iters; it++) {
+                /* Tournament of two, the costlier one is the parent */
+                const struct fuzz_input *a = &pool[rnd_below(npool)];
+                const struct fuzz_input *b = &pool[rnd_below(npool)];
+
+                if (mutate(a->cost.score > b->cost.score ? a : b, &in,
+                           maxlen) < 0)
+                        continue;
+                evaluate(in.buf, in.len, &in.cost);
+
+                if (in.cost.status == FUZZ_CRASH ||
+                    in.cost.status == FUZZ_TIMEOUT) {
+                        int crash = in.cost.status == FUZZ_CRASH;
+
+                        minimize(&in);
+                        write_file(outdir, crash ? "crash" : "timeout",
+                                   crash ? crashes++ : timeouts++, &in);
+                        xfree(in.buf);
+                        continue;
+                }
+                if (in.cost.status != FUZZ_OK) {
+                        xfree(in.buf);
+                        continue;
+                }
+
+                if (in.cost.score > best) {
+                        best = in.cost.score;
+                        printf("%lu: ", it);
+                        print_cost("new worst", &in);
+                        fflush(stdout);
+                }
+
+                if (npool < FUZZ_POOL_SIZE) {
+                        pool[npool++] = in;
+                        continue;
+                }
+                for (worst = 0, i = 1; i < npool; i++)
+                        if (pool[i].cost.score < pool[worst].cost.score)
+                                worst = i;
+                if (in.cost.score > pool[worst].cost.score) {
+                        xfree(pool[worst].buf);
+                        pool[worst] = in;
+                } else {
+                        xfree(in.buf);
+                }
+        }
+
+        /* Minimize and write out the `keep` costliest inputs */
+        for (i = 0; i < keep && i < npool; i++) {
+                size_t j, top = i;
+
+                for (j = i + 1; j < npool; j++)
+                        if (pool[j].cost.score > pool[top].cost.score)
+                                top = j;
+                in = pool[i];
+                pool[i] = pool[top];
+                pool[top] = in;
+
+                minimize(&pool[i]);
+                write_file(outdir, "slow", i, &pool[i]);
+        }
+
+        return 0;
+}
+
+#endif  /* XML2JSON_LIBFUZZER */
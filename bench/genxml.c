@@ -0,0 +1,369 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * genxml - Seeded synthetic XML corpus generator.
+ *
+ * Writes a <corpus> of <record> elements until the requested size is
+ * reached. Every element below a record has `fanout` distinct child names,
+ * each of which repeats with probability `repeat` (so arrays show up in the
+ * JSON), down to `depth` levels where the leaves carry text. The same seed
+ * and parameters always give the same bytes, and -x writes an XSD that the
+ * output validates against.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define GENXML_MAX_DEPTH        64
+#define GENXML_MAX_REPEAT       64
+#define GENXML_BUF_SIZE         (1 << 20)
+
+struct genxml {
+        uint64_t seed;
+        int depth;              /* levels below <record> */
+        int fanout;             /* distinct child names per element */
+        double repeat;          /* chance of one more same-name sibling */
+        double attrs;           /* mean attributes per element */
+        int maxattrs;
+        int textlen;            /* mean leaf text length */
+        uint64_t size;          /* stop after this many bytes */
+
+        uint64_t rng;
+        uint64_t written;
+        int fd;
+        size_t len;
+        char buf[GENXML_BUF_SIZE];
+};
+
+static const char *words[] = {
+        "country", "city", "province", "river", "lake", "sea", "island",
+        "mountain", "desert", "border", "language", "religion", "ethnic",
+        "population", "area", "capital", "government", "member", "name",
+        "located", "longitude", "latitude", "depth", "height", "length",
+        "organization", "abbrev", "established", "indep_date", "gdp",
+};
+
+#define NWORDS  (sizeof(words) / sizeof(words[0]))
+
+/* Private functions */
+static void usage_and_die(void)
+{
+        fprintf(stderr, "USAGE: genxml [options] [-o out.xml] [-x out.xsd]\n");
+        fprintf(stderr, " -s seed      : PRNG seed (1)\n");
+        fprintf(stderr, " -d depth     : element levels below a record (3)\n");
+        fprintf(stderr, " -f fanout    : distinct child names per element (4)\n");
+        fprintf(stderr, " -r ratio     : repeated-sibling ratio, 0 to <1 (0.3)\n");
+        fprintf(stderr, " -a density   : mean attributes per element (1)\n");
+        fprintf(stderr, " -t length    : mean leaf text length (16)\n");
+        fprintf(stderr, " -S size      : output size, K/M/G suffixes (1M)\n");
+        exit(EXIT_FAILURE);
+}
+
+/* splitmix64, small and good enough to shape a corpus */
+static uint64_t rnd(struct genxml *g)
+{
+        uint64_t z = (g->rng += 0x9e3779b97f4a7c15ULL);
+
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+}
+
+static double rnd_unit(struct genxml *g)
+{
+        return (rnd(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static unsigned long rnd_below(struct genxml *g, unsigned long n)
+{
+        return n ? rnd(g) % n : 0;
+}
+
+static void flush(struct genxml *g)
+{
+        size_t off = 0;
+
+        while (off < g->len) {
+                ssize_t n = write(g->fd, g->buf + off, g->len - off);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("genxml: ");
+                        exit(EXIT_FAILURE);
+                }
+                off += n;
+        }
+        g->len = 0;
+}
+
+static void emit(struct genxml *g, const char *s, size_t len)
+{
+        if (g->len + len > GENXML_BUF_SIZE)
+                flush(g);
+        memcpy(g->buf + g->len, s, len);
+        g->len += len;
+        g->written += len;
+}
+
+static void emits(struct genxml *g, const char *s)
+{
+        emit(g, s, strlen(s));
+}
+
+static void emit_indent(struct genxml *g, int level)
+{
+        emit(g, "\n", 1);
+        while (level-- > 0)
+                emit(g, "  ", 2);
+}
+
+/* Element names are fixed per (level, slot), so the XSD can describe them */
+static void elem_name(char *buf, size_t len, int level, int slot)
+{
+        snprintf(buf, len, "%s%d", words[(level * 7 + slot) % NWORDS], level);
+        if (slot >= (int) NWORDS)
+                snprintf(buf + strlen(buf), len - strlen(buf), "_%d", slot);
+}
+
+static void emit_text(struct genxml *g)
+{
+        char buf[32];
+        long len, n;
+
+        /* A third of the leaves are numbers */
+        if (rnd_below(g, 3) == 0) {
+                if (rnd_below(g, 2))
+                        n = snprintf(buf, sizeof(buf), "%lu",
+                                     rnd_below(g, 100000000));
+                else
+                        n = snprintf(buf, sizeof(buf), "%lu.%02lu",
+                                     rnd_below(g, 100000),
+                                     rnd_below(g, 100));
+                emit(g, buf, n);
+                return;
+        }
+
+        len = 1 + rnd_below(g, 2 * g->textlen);
+        while (len > 0) {
+                const char *w = words[rnd_below(g, NWORDS)];
+
+                n = strlen(w);
+                if (n > len)
+                        n = len;
+                emit(g, w, n);
+                len -= n + 1;
+                if (len <= 0)
+                        break;
+                if (rnd_below(g, 16) == 0) {
+                        emits(g, " &amp;");
+                        len -= 5;
+                }
+                emit(g, " ", 1);
+        }
+}
+
+static void emit_attrs(struct genxml *g)
+{
+        char buf[64];
+        int i, n;
+
+        for (i = 0; i < g->maxattrs; i++) {
+                if (rnd_unit(g) * g->maxattrs >= g->attrs)
+                        continue;
+                if (i & 1)
+                        n = snprintf(buf, sizeof(buf), " a%d=\"%lu\"", i,
+                                     rnd_below(g, 1000000));
+                else
+                        n = snprintf(buf, sizeof(buf), " a%d=\"%s-%lu\"", i,
+                                     words[rnd_below(g, NWORDS)],
+                                     rnd_below(g, 1000));
+                emit(g, buf, n);
+        }
+}
+
+static void emit_element(struct genxml *g, const char *name, int level)
+{
+        char child[64];
+        int slot, n;
+
+        emit(g, "<", 1);
+        emits(g, name);
+        emit_attrs(g);
+        emit(g, ">", 1);
+
+        if (level == g->depth) {
+                emit_text(g);
+        } else {
+                for (slot = 0; slot < g->fanout; slot++) {
+                        elem_name(child, sizeof(child), level + 1, slot);
+                        for (n = 0; n < GENXML_MAX_REPEAT; n++) {
+                                if (n && rnd_unit(g) >= g->repeat)
+                                        break;
+                                emit_indent(g, level + 2);
+                                emit_element(g, child, level + 1);
+                        }
+                }
+                emit_indent(g, level + 1);
+        }
+
+        emit(g, "</", 2);
+        emits(g, name);
+        emit(g, ">", 1);
+}
+
+static void generate(struct genxml *g)
+{
+        emits(g, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<corpus>");
+        while (g->written < g->size) {
+                emit_indent(g, 1);
+                emit_element(g, "record", 0);
+        }
+        emits(g, "\n</corpus>\n");
+}
+
+static void xsd_element(FILE *f, const struct genxml *g, const char *name,
+                        int level, int ind, const char *occurs)
+{
+        int leaf = level == g->depth;
+        char child[64];
+        int i, slot;
+
+        fprintf(f, "%*s<xs:element name=\"%s\"%s>\n", ind, "", name, occurs);
+        fprintf(f, "%*s<xs:complexType>\n", ind + 2, "");
+        if (leaf) {
+                fprintf(f, "%*s<xs:simpleContent>\n", ind + 4, "");
+                fprintf(f, "%*s<xs:extension base=\"xs:string\">\n", ind + 6,
+                        "");
+        } else {
+                fprintf(f, "%*s<xs:sequence>\n", ind + 4, "");
+                for (slot = 0; slot < g->fanout; slot++) {
+                        elem_name(child, sizeof(child), level + 1, slot);
+                        xsd_element(f, g, child, level + 1, ind + 6,
+                                    g->repeat > 0 ?
+                                    " maxOccurs=\"unbounded\"" : "");
+                }
+                fprintf(f, "%*s</xs:sequence>\n", ind + 4, "");
+        }
+        for (i = 0; i < g->maxattrs; i++)
+                fprintf(f, "%*s<xs:attribute name=\"a%d\" type=\"xs:string\"/>\n",
+                        ind + (leaf ? 8 : 4), "", i);
+        if (leaf) {
+                fprintf(f, "%*s</xs:extension>\n", ind + 6, "");
+                fprintf(f, "%*s</xs:simpleContent>\n", ind + 4, "");
+        }
+        fprintf(f, "%*s</xs:complexType>\n", ind + 2, "");
+        fprintf(f, "%*s</xs:element>\n", ind, "");
+}
+
+static void write_xsd(const struct genxml *g, const char *path)
+{
+        FILE *f = fopen(path, "w");
+
+        if (f == NULL) {
+                perror("genxml: ");
+                exit(EXIT_FAILURE);
+        }
+
+        fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        fprintf(f, "<xs:schema xmlns:xs=\"http://www.w3.org/2001/XMLSchema\">\n");
+        fprintf(f, "  <xs:element name=\"corpus\">\n");
+        fprintf(f, "    <xs:complexType>\n");
+        fprintf(f, "      <xs:sequence>\n");
+        xsd_element(f, g, "record", 0, 8, " minOccurs=\"0\" maxOccurs=\"unbounded\"");
+        fprintf(f, "      </xs:sequence>\n");
+        fprintf(f, "    </xs:complexType>\n");
+        fprintf(f, "  </xs:element>\n");
+        fprintf(f, "</xs:schema>\n");
+
+        if (fclose(f) != 0) {
+                perror("genxml: ");
+                exit(EXIT_FAILURE);
+        }
+}
+
+static uint64_t parse_size(const char *s)
+{
+        char *end;
+        uint64_t v;
+
+        errno = 0;
+        v = strtoull(s, &end, 10);
+        if (errno || end == s)
+                usage_and_die();
+
+        switch (*end) {
+        case 'g': case 'G': v <<= 10; /* fall through */
+        case 'm': case 'M': v <<= 10; /* fall through */
+        case 'k': case 'K': v <<= 10; end++; break;
+        case '\0': break;
+        default: usage_and_die();
+        }
+        if (*end != '\0')
+                usage_and_die();
+
+        return v;
+}
+
+int main(int argc, char **argv)
+{
+        static struct genxml g;
+        const char *outfile = NULL, *xsdfile = NULL;
+        int opt;
+
+        g.seed = 1;
+        g.depth = 3;
+        g.fanout = 4;
+        g.repeat = 0.3;
+        g.attrs = 1;
+        g.textlen = 16;
+        g.size = 1 << 20;
+
+        while ((opt = getopt(argc, argv, "s:d:f:r:a:t:S:o:x:h")) != -1) {
+                switch (opt) {
+                case 's': g.seed = strtoull(optarg, NULL, 0); break;
+                case 'd': g.depth = atoi(optarg); break;
+                case 'f': g.fanout = atoi(optarg); break;
+                case 'r': g.repeat = atof(optarg); break;
+                case 'a': g.attrs = atof(optarg); break;
+                case 't': g.textlen = atoi(optarg); break;
+                case 'S': g.size = parse_size(optarg); break;
+                case 'o': outfile = optarg; break;
+                case 'x': xsdfile = optarg; break;
+                default: usage_and_die();
+                }
+        }
+
+        if (optind != argc || g.depth < 0 || g.depth > GENXML_MAX_DEPTH ||
+            g.fanout < 1 || g.repeat < 0 || g.repeat >= 1 || g.attrs < 0 ||
+            g.textlen < 1)
+                usage_and_die();
+
+        /* Each attribute slot is present with probability attrs / maxattrs */
+        g.maxattrs = (int) (2 * g.attrs + 0.999);
+        g.rng = g.seed;
+
+        if (xsdfile != NULL)
+                write_xsd(&g, xsdfile);
+
+        g.fd = STDOUT_FILENO;
+        if (outfile != NULL &&
+            (g.fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+                perror("genxml: ");
+                exit(EXIT_FAILURE);
+        }
+
+        generate(&g);
+        flush(&g);
+
+        if (close(g.fd) != 0) {
+                perror("genxml: ");
+                exit(EXIT_FAILURE);
+        }
+
+        return 0;
+}
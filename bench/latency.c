@@ -0,0 +1,360 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * latency - Request latency of the conversion daemon against fork/exec.
+ *
+ * Converts the same document `-n` times in four ways and reports the
+ * p50, p90, p99 and max latency of each:
+ *
+ *   exec        fork and exec `xml2json file`, output to /dev/null
+ *   connect     a new connection to the daemon for every request
+ *   persistent  every request on one connection
+ *   memfd       every request on one connection, the document and the
+ *               result passed as sealed memfds (Linux only); the document
+ *               memfd is made once, the result is mapped and unmapped
+ *
+ * The daemon is started on a private socket with `-j` workers and stopped
+ * at the end.
+ */
+
+#include "../serve.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct sample {
+        double *us;
+        int n;
+};
+
+static const char *bin, *file, *sockpath;
+static char *doc, *resp;
+static size_t doclen, resplen;
+
+/* Private functions */
+static void die(const char *what)
+{
+        perror(what);
+        exit(EXIT_FAILURE);
+}
+
+static double now_us(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void io_full(int fd, void *buf, size_t len, int wr)
+{
+        char *p = buf;
+
+        while (len) {
+                ssize_t n = wr ? write(fd, p, len) : read(fd, p, len);
+
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0) {
+                        fprintf(stderr, "latency: daemon connection %s\n",
+                                n ? strerror(errno) : "closed");
+                        exit(EXIT_FAILURE);
+                }
+                p += n;
+                len -= n;
+        }
+}
+
+static int dial(void)
+{
+        struct sockaddr_un addr;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0)
+                die("socket: ");
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sockpath);
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+static void request(int fd)
+{
+        uint32_t hdr[2] = { htonl(SERVE_OP_CONVERT), htonl(doclen) };
+        size_t len;
+
+        io_full(fd, hdr, sizeof(hdr), 1);
+        io_full(fd, doc, doclen, 1);
+        io_full(fd, hdr, sizeof(hdr), 0);
+        if (ntohl(hdr[0]) != SERVE_OK) {
+                fprintf(stderr, "latency: %s: conversion failed\n", file);
+                exit(EXIT_FAILURE);
+        }
+        len = ntohl(hdr[1]);
+        if (len > resplen) {
+                resp = realloc(resp, len);
+                resplen = len;
+                if (resp == NULL)
+                        die("realloc: ");
+        }
+        io_full(fd, resp, len, 0);
+}
+
+static void run_exec(void)
+{
+        int status;
+        pid_t pid = fork();
+
+        if (pid < 0)
+                die("fork: ");
+        if (pid == 0) {
+                int null = open("/dev/null", O_WRONLY);
+
+                dup2(null, STDOUT_FILENO);
+                execl(bin, bin, file, (char *) NULL);
+                _exit(127);
+        }
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "latency: %s %s failed\n", bin, file);
+                exit(EXIT_FAILURE);
+        }
+}
+
+static int persistent_fd = -1;
+static int doc_memfd = -1;
+
+static void run_connect(void)
+{
+        int fd = dial();
+
+        if (fd < 0)
+                die("connect: ");
+        request(fd);
+        close(fd);
+}
+
+static void run_persistent(void)
+{
+        if (persistent_fd < 0 && (persistent_fd = dial()) < 0)
+                die("connect: ");
+        request(persistent_fd);
+}
+
+#ifdef MFD_ALLOW_SEALING
+static void run_memfd(void)
+{
+        union {
+                struct cmsghdr hdr;
+                char buf[CMSG_SPACE(sizeof(int))];
+        } cmsg;
+        uint32_t hdr[2] = { htonl(SERVE_OP_CONVERT_FD), htonl(doclen) };
+        struct iovec iov = { hdr, sizeof(hdr) };
+        struct msghdr msg;
+        struct cmsghdr *c;
+        void *p;
+        int fd = -1;
+
+        if (persistent_fd < 0 && (persistent_fd = dial()) < 0)
+                die("connect: ");
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg.buf;
+        msg.msg_controllen = sizeof(cmsg.buf);
+        c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &doc_memfd, sizeof(int));
+        if (sendmsg(persistent_fd, &msg, 0) != sizeof(hdr))
+                die("sendmsg: ");
+
+        msg.msg_controllen = sizeof(cmsg.buf);
+        if (recvmsg(persistent_fd, &msg, MSG_WAITALL) != sizeof(hdr))
+                die("recvmsg: ");
+        c = CMSG_FIRSTHDR(&msg);
+        if (c != NULL && c->cmsg_type == SCM_RIGHTS)
+                memcpy(&fd, CMSG_DATA(c), sizeof(int));
+        if (ntohl(hdr[0]) != SERVE_OK || fd < 0) {
+                fprintf(stderr, "latency: %s: memfd conversion failed\n",
+                        file);
+                exit(EXIT_FAILURE);
+        }
+
+        if (ntohl(hdr[1])) {
+                p = mmap(NULL, ntohl(hdr[1]), PROT_READ, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                        die("mmap: ");
+                munmap(p, ntohl(hdr[1]));
+        }
+        close(fd);
+}
+
+static void make_doc_memfd(void)
+{
+        doc_memfd = memfd_create("latency", MFD_ALLOW_SEALING);
+        if (doc_memfd < 0)
+                die("memfd_create: ");
+        io_full(doc_memfd, doc, doclen, 1);
+        if (fcntl(doc_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                  F_SEAL_WRITE) < 0)
+                die("fcntl: ");
+}
+#endif
+
+static int cmp_double(const void *a, const void *b)
+{
+        double x = *(const double *) a, y = *(const double *) b;
+
+        return (x > y) - (x < y);
+}
+
+static double pct(const struct sample *s, double p)
+{
+        int i = (int) (p / 100 * s->n + 0.5) - 1;
+
+        if (i < 0)
+                i = 0;
+        if (i >= s->n)
+                i = s->n - 1;
+        return s->us[i];
+}
+
+static void measure(const char *name, void (*fn)(void), int n, int warmup)
+{
+        struct sample s;
+        double start;
+        int i;
+
+        s.us = calloc(n, sizeof(double));
+        s.n = n;
+        if (s.us == NULL)
+                die("calloc: ");
+
+        for (i = 0; i < warmup; i++)
+                fn();
+        for (i = 0; i < n; i++) {
+                start = now_us();
+                fn();
+                s.us[i] = now_us() - start;
+        }
+
+        qsort(s.us, n, sizeof(double), cmp_double);
+        printf("%-12s %8d %10.1f %10.1f %10.1f %10.1f\n", name, n,
+               pct(&s, 50), pct(&s, 90), pct(&s, 99), s.us[n - 1]);
+        free(s.us);
+}
+
+static void load(void)
+{
+        struct stat st;
+        int fd = open(file, O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &st) < 0)
+                die(file);
+        doclen = st.st_size;
+        doc = malloc(doclen ? doclen : 1);
+        if (doc == NULL)
+                die("malloc: ");
+        io_full(fd, doc, doclen, 0);
+        close(fd);
+}
+
+static pid_t start_daemon(const char *jobs)
+{
+        char arg[160];
+        pid_t pid;
+        int i, fd;
+
+        snprintf(arg, sizeof(arg), "--serve=%s", sockpath);
+        pid = fork();
+        if (pid < 0)
+                die("fork: ");
+        if (pid == 0) {
+                execl(bin, bin, arg, "-j", jobs, (char *) NULL);
+                _exit(127);
+        }
+
+        for (i = 0; i < 500; i++) {
+                if ((fd = dial()) >= 0) {
+                        close(fd);
+                        return pid;
+                }
+                usleep(10000);
+        }
+        fprintf(stderr, "latency: daemon did not come up on %s\n", sockpath);
+        kill(pid, SIGTERM);
+        exit(EXIT_FAILURE);
+}
+
+static void usage_and_die(void)
+{
+        fprintf(stderr, "USAGE: latency [-n requests] [-w warmup] [-j jobs] "
+                "xml2json file\n");
+        exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+        const char *jobs = "1";
+        char path[128];
+        int n = 200, warmup = 10, opt;
+        pid_t daemon;
+
+        while ((opt = getopt(argc, argv, "n:w:j:h")) != -1) {
+                switch (opt) {
+                case 'n': n = atoi(optarg); break;
+                case 'w': warmup = atoi(optarg); break;
+                case 'j': jobs = optarg; break;
+                default: usage_and_die();
+                }
+        }
+        if (argc - optind != 2 || n < 1 || warmup < 0)
+                usage_and_die();
+        bin = argv[optind];
+        file = argv[optind + 1];
+
+        snprintf(path, sizeof(path), "%s/xml2json-latency.%ld.sock",
+                 getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (long) getpid());
+        sockpath = path;
+
+        load();
+        daemon = start_daemon(jobs);
+
+        printf("%s, %zu bytes, microseconds\n", file, doclen);
+        printf("%-12s %8s %10s %10s %10s %10s\n", "mode", "requests", "p50",
+               "p90", "p99", "max");
+        measure("exec", run_exec, n, warmup);
+        measure("connect", run_connect, n, warmup);
+        measure("persistent", run_persistent, n, warmup);
+#ifdef MFD_ALLOW_SEALING
+        make_doc_memfd();
+        measure("memfd", run_memfd, n, warmup);
+#endif
+
+        if (persistent_fd >= 0)
+                close(persistent_fd);
+        kill(daemon, SIGTERM);
+        waitpid(daemon, NULL, 0);
+
+        return 0;
+}
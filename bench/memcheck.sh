@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# xml2json memory regression check
+#
+# Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+#
+# Converts every file listed in the budget file with --stats=json and checks
+# allocations, allocated bytes, peak live heap and peak RSS, all per input
+# MB, against the budgets. Exits non zero if any of them is over budget.
+# Files under MIN_SIZE bytes are skipped: what they use is libxml2's and
+# our own fixed overhead, which divided by their size swings with any
+# allocator change.
+# With -u the budget file is rewritten from the current numbers plus `-H`
+# percent headroom.
+#
+# Usage: memcheck.sh [-u] [-H headroom] xml2json budgets
+
+UPDATE=
+HEADROOM=10
+MIN_SIZE=16384
+METRICS="allocs_per_mb alloc_bytes_per_mb peak_live_bytes_per_mb rss_kb_per_mb"
+
+usage() {
+        sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+        exit 1
+}
+
+while getopts "uH:" opt; do
+        case $opt in
+        u) UPDATE=1 ;;
+        H) HEADROOM=$OPTARG ;;
+        *) usage ;;
+        esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 2 ] || usage
+
+BIN=$1
+BUDGETS=$2
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/xml2json-mem.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+# Whether $1 is too small to be measured per MB
+small() {
+        [ "$(wc -c < "$1")" -lt "$MIN_SIZE" ]
+}
+
+# Print "metric value" lines for one conversion of $1
+measure() {
+        if ! "$BIN" --stats=json "$1" > /dev/null 2> "$TMP/stats"; then
+                echo "$1: xml2json failed" >&2
+                return 1
+        fi
+        tail -n 1 "$TMP/stats" | awk -F'[:,{}]' '
+        {
+                for (i = 1; i < NF; i++) {
+                        gsub(/"/, "", $i);
+                        v[$i] = $(i + 1);
+                }
+                mb = v["bytes_in"] / 1048576;
+                if (mb <= 0)
+                        exit 1;
+                printf "allocs_per_mb %.0f\n", v["mallocs"] / mb;
+                printf "alloc_bytes_per_mb %.0f\n", v["alloc_bytes"] / mb;
+                printf "peak_live_bytes_per_mb %.0f\n", v["peak_live_bytes"] / mb;
+                printf "rss_kb_per_mb %.0f\n", v["peak_rss_kb"] / mb;
+        }'
+}
+
+files=$(awk '!/^#/ && NF { print $1 }' "$BUDGETS" | uniq)
+
+if [ -n "$UPDATE" ]; then
+        {
+                sed -n '/^#/p' "$BUDGETS"
+                for f in $files; do
+                        small "$f" && continue
+                        measure "$f" | while read -r metric value; do
+                                printf "%-32s %-24s %s\n" "$f" "$metric" \
+                                        $((value + value * HEADROOM / 100))
+                        done
+                done
+        } > "$TMP/budgets" && cp "$TMP/budgets" "$BUDGETS"
+        exit
+fi
+
+fail=0
+printf "%-32s %-24s %14s %14s\n" file metric actual budget
+for f in $files; do
+        if small "$f"; then
+                printf "%-32s %s\n" "$f" "skipped, under $MIN_SIZE bytes"
+                continue
+        fi
+        measure "$f" > "$TMP/actual" || { fail=1; continue; }
+        for metric in $METRICS; do
+                budget=$(awk -v f="$f" -v m="$metric" \
+                        '$1 == f && $2 == m { print $3 }' "$BUDGETS")
+                actual=$(awk -v m="$metric" '$1 == m { print $2 }' "$TMP/actual")
+                [ -n "$budget" ] || continue
+                status=
+                if [ "$actual" -gt "$budget" ]; then
+                        status="OVER BUDGET"
+                        fail=1
+                fi
+                printf "%-32s %-24s %14s %14s %s\n" "$f" "$metric" "$actual" \
+                        "$budget" "$status"
+        done
+done
+
+exit $fail
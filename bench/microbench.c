@@ -0,0 +1,425 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * microbench - Timing loops for the hot components.
+ *
+ * Keys and values are taken from a real document (mondial by default), in
+ * document order, so hash distributions, string lengths and repeats are the
+ * ones the converter sees. Each benchmark runs once to warm up and then `-r`
+ * times; the min and median cost per operation are reported, in TSC cycles
+ * on x86 and nanoseconds elsewhere. XML2JSON_SIMD picks the kernels, see
+ * simd.h.
+ */
+
+#include "cstring.h"
+#include "htable.h"
+#include "json.h"
+#include "output.h"
+#include "simd.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+/* Keys are put into one table per group, like the siblings of an element */
+#define GROUP_SIZE      16
+#define MAX_REPS        101
+
+struct strings {
+        char **s;
+        size_t *len;
+        size_t nr, alloc;
+};
+
+struct entry {
+        struct htable_entry entry;
+        const char *key;
+        size_t keylen;
+};
+
+struct bench {
+        const char *name;
+        size_t (*fn)(void);     /* returns the number of operations */
+};
+
+static struct strings keys, values;
+static struct entry *entries;
+static struct htable *tables;
+static size_t ntables;
+static JsonObject *strarray, *numarray;
+static size_t nnums;
+static volatile unsigned int sink;
+
+/* Private functions */
+static inline uint64_t tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void strings_add(struct strings *s, const char *p, size_t len)
+{
+        ALLOC_GROW(s->s, s->nr + 1, s->alloc);
+        s->len = xrealloc(s->len, s->alloc * sizeof(size_t));
+        s->s[s->nr] = xcalloc(1, len + 1);
+        memcpy(s->s[s->nr], p, len);
+        s->len[s->nr++] = len;
+}
+
+/* Attributes of the tag at `p`, as the converter sees them: "@name" keys */
+static const char *load_attrs(const char *p, const char *end)
+{
+        char name[256];
+        const char *q;
+        char quote;
+
+        for (;;) {
+                while (p < end && isspace((unsigned char) *p))
+                        p++;
+                if (p >= end || !isalpha((unsigned char) *p))
+                        return p;
+
+                for (q = p; q < end && *q != '=' && *q != '>' &&
+                             !isspace((unsigned char) *q); q++)
+                        ;
+                if (q >= end || *q != '=' || q + 1 >= end ||
+                    (q[1] != '"' && q[1] != '\''))
+                        return q;
+
+                name[0] = '@';
+                snprintf(name + 1, sizeof(name) - 1, "%.*s", (int) (q - p), p);
+                strings_add(&keys, name, strlen(name));
+
+                quote = q[1];
+                for (p = q += 2; q < end && *q != quote; q++)
+                        ;
+                strings_add(&values, p, q - p);
+                p = q + 1;
+        }
+}
+
+/* Element and attribute names become keys, attribute values and non blank
+ * text between tags become values
+ */
+static void load(const char *path)
+{
+        struct stat st;
+        const char *p, *end, *q;
+        int fd;
+
+        if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+                perror("microbench: ");
+                exit(EXIT_FAILURE);
+        }
+
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+                perror("microbench: ");
+                exit(EXIT_FAILURE);
+        }
+        end = p + st.st_size;
+
+        while (p < end) {
+                if (*p == '<') {
+                        p++;
+                        if (p < end && isalpha((unsigned char) *p)) {
+                                for (q = p; q < end && !isspace((unsigned char) *q) &&
+                                             *q != '>' && *q != '/'; q++)
+                                        ;
+                                strings_add(&keys, p, q - p);
+                                p = load_attrs(q, end);
+                        }
+                        while (p < end && *p != '>')
+                                p++;
+                        continue;
+                }
+
+                for (q = p; q < end && *q != '<'; q++)
+                        ;
+                while (p < q && isspace((unsigned char) *p))
+                        p++;
+                if (p < q) {
+                        const char *e = q;
+
+                        while (isspace((unsigned char) e[-1]))
+                                e--;
+                        strings_add(&values, p, e - p);
+                }
+                p = q;
+        }
+
+        close(fd);
+
+        if (!keys.nr || !values.nr) {
+                fprintf(stderr, "microbench: %s has no elements\n", path);
+                exit(EXIT_FAILURE);
+        }
+}
+
+static int entry_cmpfn(const void *data _unused_, const void *entry1,
+                       const void *entry2, const void *kdata _unused_)
+{
+        const struct entry *e1 = entry1;
+        const struct entry *e2 = entry2;
+
+        return memcmp_raw(e1->key, e1->keylen, e2->key, e2->keylen);
+}
+
+static void fill_tables(void)
+{
+        size_t i;
+
+        for (i = 0; i < keys.nr; i++) {
+                if (i % GROUP_SIZE == 0)
+                        htable_init(&tables[i / GROUP_SIZE], entry_cmpfn,
+                                    NULL, 0);
+                htable_entry_init(&entries[i], entries[i].entry.hash);
+                htable_put(&tables[i / GROUP_SIZE], &entries[i]);
+        }
+}
+
+static void free_tables(void)
+{
+        size_t i;
+
+        for (i = 0; i < ntables; i++)
+                htable_free(&tables[i], 0);
+}
+
+static size_t bench_bufhash(void)
+{
+        unsigned int h = 0;
+        size_t i;
+
+        for (i = 0; i < keys.nr; i++)
+                h ^= bufhash(keys.s[i], keys.len[i]);
+        sink = h;
+
+        return keys.nr;
+}
+
+static size_t bench_htable_put(void)
+{
+        free_tables();
+        fill_tables();
+
+        return keys.nr;
+}
+
+static size_t bench_htable_get_next(void)
+{
+        const void *e;
+        size_t i, n = 0;
+
+        for (i = 0; i < keys.nr; i++)
+                for (e = &entries[i]; e; e = htable_get_next(
+                             &tables[i / GROUP_SIZE], e))
+                        n++;
+        sink = n;
+
+        return keys.nr;
+}
+
+static size_t bench_htable_ordered(void)
+{
+        struct htable_iter iter;
+        size_t i, n = 0;
+
+        for (i = 0; i < ntables; i++) {
+                htable_iter_init_ordered(&tables[i], &iter);
+                while (htable_iter_next_ordered(&iter))
+                        n++;
+        }
+        sink = n;
+
+        return n;
+}
+
+static size_t bench_cstring_addch(void)
+{
+        cstring str;
+        size_t i, j, n = 0;
+
+        for (i = 0; i < values.nr; i++) {
+                cstring_init(&str, 0);
+                for (j = 0; j < values.len[i]; j++)
+                        cstring_addch(&str, values.s[i][j]);
+                n += j;
+                cstring_release(&str);
+        }
+
+        return n;
+}
+
+static size_t bench_cstring_add(void)
+{
+        cstring str;
+        size_t i;
+
+        for (i = 0; i < values.nr; i++) {
+                cstring_init(&str, 0);
+                cstring_add(&str, values.s[i], values.len[i]);
+                cstring_release(&str);
+        }
+
+        return values.nr;
+}
+
+static size_t bench_strip_space(void)
+{
+        static char buf[4096];
+        size_t i, n = 0, len;
+
+        for (i = 0; i < values.nr; i++) {
+                len = values.len[i] < sizeof(buf) ? values.len[i] : sizeof(buf);
+                n += simd_strip_space(buf, values.s[i], len);
+        }
+        sink = n;
+
+        return values.nr;
+}
+
+static void encode(JsonObject *array)
+{
+        struct output out;
+
+        output_init_mem(&out);
+        json_write(array, &out);
+        sink = out.len;
+        output_release(&out);
+}
+
+static size_t bench_encode_strings(void)
+{
+        encode(strarray);
+        return values.nr;
+}
+
+static size_t bench_encode_numbers(void)
+{
+        encode(numarray);
+        return nnums;
+}
+
+static const struct bench benches[] = {
+        { "bufhash",            bench_bufhash },
+        { "htable_put",         bench_htable_put },
+        { "htable_get_next",    bench_htable_get_next },
+        { "htable_ordered",     bench_htable_ordered },
+        { "cstring_addch",      bench_cstring_addch },
+        { "cstring_add",        bench_cstring_add },
+        { "strip_space",        bench_strip_space },
+        { "encode_string",      bench_encode_strings },
+        { "encode_number",      bench_encode_numbers },
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+        double x = *(const double *) a, y = *(const double *) b;
+
+        return (x > y) - (x < y);
+}
+
+static void run(const struct bench *b, int reps)
+{
+        double per_op[MAX_REPS];
+        uint64_t start;
+        size_t ops = 0;
+        int i;
+
+        b->fn();
+        for (i = 0; i < reps; i++) {
+                start = tick();
+                ops = b->fn();
+                per_op[i] = ops ? (double) (tick() - start) / ops : 0;
+        }
+
+        qsort(per_op, reps, sizeof(double), cmp_double);
+        printf("%-18s %10zu %12.2f %12.2f\n", b->name, ops, per_op[0],
+               per_op[reps / 2]);
+}
+
+static void setup(void)
+{
+        size_t i;
+
+        entries = xcalloc(keys.nr, sizeof(struct entry));
+        for (i = 0; i < keys.nr; i++) {
+                entries[i].key = keys.s[i];
+                entries[i].keylen = keys.len[i];
+                entries[i].entry.hash = bufhash(keys.s[i], keys.len[i]);
+        }
+        ntables = (keys.nr + GROUP_SIZE - 1) / GROUP_SIZE;
+        tables = xcalloc(ntables, sizeof(struct htable));
+        fill_tables();
+
+        strarray = json_array_obj();
+        numarray = json_array_obj();
+        for (i = 0; i < values.nr; i++) {
+                char *end;
+                double d = strtod(values.s[i], &end);
+
+                json_append_to_array(strarray, json_string_obj(values.s[i]));
+                if (*end == '\0') {
+                        json_append_to_array(numarray, json_num_obj(d));
+                        nnums++;
+                }
+        }
+}
+
+static void usage_and_die(void)
+{
+        fprintf(stderr, "USAGE: microbench [-r reps] [-b name] [xmlfile]\n");
+        exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+        const char *path = "data/mondial-3.0.xml", *only = NULL;
+        int reps = 11, opt;
+        size_t i;
+
+        while ((opt = getopt(argc, argv, "r:b:h")) != -1) {
+                switch (opt) {
+                case 'r': reps = atoi(optarg); break;
+                case 'b': only = optarg; break;
+                default: usage_and_die();
+                }
+        }
+        if (reps < 1 || reps > MAX_REPS || argc - optind > 1)
+                usage_and_die();
+        if (optind < argc)
+                path = argv[optind];
+
+        load(path);
+        setup();
+
+        printf("%s: %zu keys, %zu values (%zu numeric), " TICK_UNIT
+               " per op, %s kernels\n", path, keys.nr, values.nr, nnums,
+               simd_level_name(simd_level));
+        printf("%-18s %10s %12s %12s\n", "benchmark", "ops", "min",
+               "median");
+
+        for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+                if (only == NULL || strcmp(only, benches[i].name) == 0)
+                        run(&benches[i], reps);
+
+        return 0;
+}
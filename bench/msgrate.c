@@ -0,0 +1,215 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * msgrate - Messages per second per core on small documents.
+ *
+ * Converts the same small message over and over on one thread, the way a
+ * batch or daemon worker does, and reports the rate per second of thread
+ * CPU time along with the allocations every message costs. By default the
+ * messages are synthetic records of about 100 bytes up to 4 KB, shaped
+ * like data/one.xml and data/two.xml; files given on the command line are
+ * used instead.
+ */
+
+#include "convert.h"
+#include "cstring.h"
+#include "input.h"
+#include "output.h"
+#include "util.h"
+
+#include <libxml/parser.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const size_t msgrate_sizes[] = { 100, 256, 512, 1024, 2048, 4096 };
+
+/* Fields of the synthetic messages, repeated names become arrays */
+static const char *msgrate_fields[] = {
+        "<name><first>Wonder</first><last>Woman</last></name>",
+        "<place>Melbourne</place>",
+        "<tag>alpha</tag>",
+        "<amount>12.50</amount>",
+        "<tag>beta</tag>",
+        "<note>delivered on time</note>",
+};
+
+static int msgrate_counting;
+static uint64_t msgrate_xml_allocs;
+
+/* Private functions */
+static void die(const char *what)
+{
+        perror(what);
+        exit(EXIT_FAILURE);
+}
+
+static void *count_malloc(size_t size)
+{
+        if (msgrate_counting)
+                msgrate_xml_allocs++;
+        return malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t size)
+{
+        if (msgrate_counting)
+                msgrate_xml_allocs++;
+        return realloc(ptr, size);
+}
+
+static char *count_strdup(const char *s)
+{
+        if (msgrate_counting)
+                msgrate_xml_allocs++;
+        return strdup(s);
+}
+
+static double thread_cpu_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* A record of about `size` bytes, at least an id and one field */
+static char *make_message(size_t size, size_t *len)
+{
+        const size_t nfields = sizeof(msgrate_fields) / sizeof(char *);
+        const char *close = "</msg>\n";
+        size_t i;
+        cstring msg;
+
+        cstring_init(&msg, size + 64);
+        cstring_addstr(&msg, "<msg><id>4711</id>");
+        for (i = 0; i == 0 || msg.len + strlen(msgrate_fields[i % nfields]) +
+                     strlen(close) <= size; i++)
+                cstring_addstr(&msg, msgrate_fields[i % nfields]);
+        cstring_addstr(&msg, close);
+
+        return cstring_detach(&msg, len);
+}
+
+static char *load(const char *path, size_t *len)
+{
+        struct input in;
+        char *buf;
+
+        if (input_open(&in, path, 0, 0) < 0)
+                die(path);
+        buf = xmalloc(in.size + 1);
+        memcpy(buf, in.base, in.size);
+        *len = in.size;
+        input_close(&in);
+
+        return buf;
+}
+
+static void convert_one(const char *buf, size_t len,
+                        const struct convert_opts *opts)
+{
+        struct output out;
+
+        output_init_mem(&out);
+        if (convert_buffer(buf, len, "message", &out, opts) < 0) {
+                fprintf(stderr, "msgrate: message does not convert\n");
+                exit(EXIT_FAILURE);
+        }
+        output_release(&out);
+}
+
+static void measure(const char *name, const char *buf, size_t len,
+                    unsigned int warmup, double ms,
+                    const struct convert_opts *opts)
+{
+        uint64_t n = 0, allocs;
+        double start, ns;
+        unsigned int i;
+
+        for (i = 0; i < warmup; i++)
+                convert_one(buf, len, opts);
+
+        /* Allocations of one message, counted apart from the timed run */
+        memset(&alloc_stats, 0, sizeof(struct alloc_stats));
+        msgrate_xml_allocs = 0;
+        alloc_stats_enabled = 1;
+        msgrate_counting = 1;
+        convert_one(buf, len, opts);
+        msgrate_counting = 0;
+        alloc_stats_enabled = 0;
+        allocs = alloc_stats.mallocs + alloc_stats.reallocs;
+
+        start = thread_cpu_ns();
+        do {
+                for (i = 0; i < 64; i++)
+                        convert_one(buf, len, opts);
+                n += 64;
+                ns = thread_cpu_ns() - start;
+        } while (ns < ms * 1e6);
+
+        printf("%-24s %8zu %12.0f %10.0f %8.2f %8llu %8llu\n", name, len,
+               n / (ns / 1e9), ns / n, len * n / (ns / 1e3),
+               (unsigned long long) allocs,
+               (unsigned long long) msgrate_xml_allocs);
+}
+
+static void msgrate_usage(void)
+{
+        fprintf(stderr, "USAGE: msgrate [-t ms] [-w warmup] [file...]\n");
+        exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+        struct convert_opts opts;
+        unsigned int warmup = 1000;
+        double ms = 500;
+        size_t i, len;
+        char name[32];
+        char *buf;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "t:w:h")) != -1) {
+                switch (opt) {
+                case 't': ms = atof(optarg); break;
+                case 'w': warmup = strtoul(optarg, NULL, 10); break;
+                default: msgrate_usage();
+                }
+        }
+        if (ms <= 0)
+                msgrate_usage();
+
+        memset(&opts, 0, sizeof(struct convert_opts));
+        opts.xml_options = XML_PARSE_COMPACT;
+#ifdef LINUX
+        opts.xml_options |= XML_PARSE_BIG_LINES;
+#endif
+
+        xmlMemSetup(free, count_malloc, count_realloc, count_strdup);
+        xmlInitParser();
+
+        printf("%-24s %8s %12s %10s %8s %8s %8s\n", "message", "bytes",
+               "msgs/s/core", "ns/msg", "MB/s", "allocs", "libxml");
+        if (optind < argc) {
+                for (; optind < argc; optind++) {
+                        buf = load(argv[optind], &len);
+                        measure(argv[optind], buf, len, warmup, ms, &opts);
+                        xfree(buf);
+                }
+        } else {
+                for (i = 0; i < sizeof(msgrate_sizes) / sizeof(size_t); i++) {
+                        buf = make_message(msgrate_sizes[i], &len);
+                        snprintf(name, sizeof(name), "synthetic-%zu",
+                                 msgrate_sizes[i]);
+                        measure(name, buf, len, warmup, ms, &opts);
+                        xfree(buf);
+                }
+        }
+
+        xmlCleanupParser();
+
+        return 0;
+}
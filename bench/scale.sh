@@ -0,0 +1,186 @@
+#!/bin/sh
+#
+# xml2json parallel scalability harness
+#
+# Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+#
+# Runs batch mode over each corpus with 1, 2, ... up to the number of CPUs
+# converter threads and reports throughput, speedup and efficiency against
+# one thread, together with the lock contention, worker idle time and work
+# queue depth that --stats measures. Each corpus is a directory of XML
+# files; without any, a generated corpus (bench/genxml, one file per seed)
+# and a replicated copy of data/*.xml are used.
+#
+# A point where adding threads makes things slower is flagged in the table.
+# With `-b old.ndjson` every point is also compared to an earlier run and
+# the script fails if the efficiency dropped by more than `-t` (0.10).
+#
+# Usage: scale.sh [-j "1 2 4"] [-r reps] [-o results] [-b old.ndjson]
+#                 [-t drop] xml2json [dir...]
+
+REPS=3
+JOBS=
+RESULTS=
+BASELINE=
+DROP=0.10
+GENXML=${GENXML:-bench/genxml}
+
+usage() {
+        sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+        exit 1
+}
+
+# Print the value of a numeric field of the --stats=json line in $1
+stat() {
+        tail -n 1 "$1" | sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p"
+}
+
+ncpus() {
+        getconf _NPROCESSORS_ONLN 2>/dev/null || nproc 2>/dev/null || echo 1
+}
+
+while getopts "j:r:o:b:t:" opt; do
+        case $opt in
+        j) JOBS=$OPTARG ;;
+        r) REPS=$OPTARG ;;
+        o) RESULTS=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        t) DROP=$OPTARG ;;
+        *) usage ;;
+        esac
+done
+shift $((OPTIND - 1))
+
+[ $# -ge 1 ] || usage
+BIN=$1
+shift
+
+if [ -z "$JOBS" ]; then
+        n=$(ncpus)
+        j=1
+        while [ $j -le "$n" ]; do
+                JOBS="$JOBS $j"
+                j=$((j + 1))
+        done
+fi
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/xml2json-scale.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+REV=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+if [ $# -eq 0 ]; then
+        if [ ! -x "$GENXML" ]; then
+                echo "scale.sh: $GENXML not built, try make bench-tools" >&2
+                exit 1
+        fi
+        mkdir "$TMP/generated" "$TMP/data"
+        seed=1
+        while [ $seed -le 32 ]; do
+                "$GENXML" -s $seed -d 2 -S 256K -o "$TMP/generated/gen-$seed.xml" ||
+                        exit 1
+                seed=$((seed + 1))
+        done
+        for f in data/*.xml; do
+                i=1
+                while [ $i -le 8 ]; do
+                        cp "$f" "$TMP/data/$i-${f##*/}"
+                        i=$((i + 1))
+                done
+        done
+        set -- "$TMP/generated" "$TMP/data"
+fi
+
+# One run, prints "wall_ms bytes_in contended acquires lock_wait idle queue"
+run() {
+        rm -rf "$TMP/out"
+        "$BIN" --stats=json -j "$2" -o "$TMP/out" "$1" > /dev/null \
+                2> "$TMP/stats" || return 1
+        echo "$(stat "$TMP/stats" wall_ms) $(stat "$TMP/stats" bytes_in)" \
+             "$(stat "$TMP/stats" lock_contended)" \
+             "$(stat "$TMP/stats" lock_acquires)" \
+             "$(stat "$TMP/stats" lock_wait_ms) $(stat "$TMP/stats" idle_ms)" \
+             "$(stat "$TMP/stats" queue_mean)"
+}
+
+printf "%-12s %4s %10s %8s %7s %10s %10s %10s %7s\n" corpus jobs "MB/s" \
+        speedup eff "contended" "lock ms" "idle ms" queue
+
+: > "$TMP/points"
+for dir in "$@"; do
+        name=${dir%/}
+        name=${name##*/}
+        for j in $JOBS; do
+                run "$dir" "$j" > /dev/null     # warmup, and page cache
+                : > "$TMP/samples"
+                i=0
+                while [ $i -lt "$REPS" ]; do
+                        if ! run "$dir" "$j" >> "$TMP/samples"; then
+                                echo "$name -j $j: xml2json failed" >&2
+                                exit 1
+                        fi
+                        i=$((i + 1))
+                done
+                # the median run by wall time
+                sort -n "$TMP/samples" | sed -n "$(((REPS + 1) / 2))p" |
+                        sed "s/^/$name $j /" >> "$TMP/points"
+        done
+done
+
+awk -v rev="$REV" -v results="$RESULTS" '
+{
+        name = $1; j = $2;
+        mbps = $3 > 0 ? $4 / 1e3 / $3 : 0;
+        # the smallest thread count is the reference, normally -j 1
+        if (!(name in base)) {
+                base[name] = mbps;
+                first[name] = j;
+                prev[name] = 0;
+        }
+        speedup = base[name] ? mbps / base[name] : 0;
+        eff = speedup * first[name] / j;
+        contended = $6 ? $5 * 100 / $6 : 0;
+        flag = (speedup < prev[name]) ? "  degrades" : "";
+        prev[name] = speedup;
+
+        printf "%-12s %4d %10.2f %7.2fx %7.2f %9.1f%% %10.1f %10.1f %7.2f%s\n", \
+                name, j, mbps, speedup, eff, contended, $7, $8, $9, flag;
+        if (results != "")
+                printf "{\"rev\":\"%s\",\"corpus\":\"%s\",\"jobs\":%d," \
+                       "\"mbps\":%.3f,\"speedup\":%.3f,\"efficiency\":%.3f," \
+                       "\"lock_contended_pct\":%.2f,\"lock_wait_ms\":%.3f," \
+                       "\"idle_ms\":%.3f,\"queue_mean\":%.3f}\n", \
+                       rev, name, j, mbps, speedup, eff, contended, $7, $8, \
+                       $9 >> results;
+}' "$TMP/points" | tee "$TMP/table"
+
+[ -n "$BASELINE" ] || exit 0
+
+# Compare the efficiency of every point with the baseline run
+awk -F'"' -v drop="$DROP" '
+function field(name,    i) {
+        for (i = 1; i < NF; i++)
+                if ($i == name)
+                        return substr($(i + 1), 2) + 0;
+        return 0;
+}
+function corpus(    i) {
+        for (i = 1; i < NF; i++)
+                if ($i == "corpus")
+                        return $(i + 2);
+}
+FNR == NR { old[corpus() " " field("jobs")] = field("efficiency"); next }
+{
+        split($0, f, " ");
+        k = f[1] " " f[2];
+        if (!(k in old))
+                next;
+        if (!header++)
+                printf "\n%-12s %4s %10s %10s\n", "corpus", "jobs", "old eff", "new eff";
+        new = f[5] + 0;
+        bad = new < old[k] - drop;
+        printf "%-12s %4d %10.2f %10.2f%s\n", f[1], f[2], old[k], new, \
+                bad ? "  REGRESSION" : "";
+        failed += bad;
+}
+END { exit failed ? 1 : 0 }' "$BASELINE" "$TMP/table"
@@ -0,0 +1,112 @@
+#!/bin/sh
+#
+# xml2json projection benchmark
+#
+# Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+#
+# Converts one generated document (bench/genxml) in full and then with
+# --select for a growing share of it: one of the element names below each
+# record, then two, and so on, and finally a single leaf name. Prints the
+# share of the full output every run keeps next to its share of the time,
+# the elements built and the peak heap, which should all follow the
+# selected data rather than the input size.
+#
+# Usage: select.sh [-S size] [-r reps] [-o results] xml2json
+
+SIZE=32M
+REPS=3
+RESULTS=
+GENXML=${GENXML:-bench/genxml}
+
+usage() {
+        sed -n '2,/^$/s/^# \{0,1\}//p' "$0" >&2
+        exit 1
+}
+
+# Print the value of a numeric field of the --stats=json line in $1
+stat() {
+        tail -n 1 "$1" | sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p"
+}
+
+while getopts "S:r:o:" opt; do
+        case $opt in
+        S) SIZE=$OPTARG ;;
+        r) REPS=$OPTARG ;;
+        o) RESULTS=$OPTARG ;;
+        *) usage ;;
+        esac
+done
+shift $((OPTIND - 1))
+
+[ $# -eq 1 ] || usage
+BIN=$1
+
+if [ ! -x "$GENXML" ]; then
+        echo "select.sh: $GENXML not built, try make bench-tools" >&2
+        exit 1
+fi
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/xml2json-select.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+
+REV=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+"$GENXML" -s 1 -d 2 -f 4 -S "$SIZE" -o "$TMP/in.xml" || exit 1
+
+# The element names right below a record, and one of the leaves
+NAMES=$(sed -n 's/^    <\([A-Za-z]*1\)[ >].*/\1/p' "$TMP/in.xml" |
+        sort | uniq -c | sort -rn | awk '{ print $2 }')
+LEAF=$(sed -n 's/^      <\([A-Za-z]*2\)[ >].*/\1/p' "$TMP/in.xml" | head -n 1)
+
+# One run, prints "wall_ms bytes_out nodes peak_live_bytes"
+run() {
+        "$BIN" --stats=json "$@" "$TMP/in.xml" > /dev/null \
+                2> "$TMP/stats" || return 1
+        echo "$(stat "$TMP/stats" wall_ms) $(stat "$TMP/stats" bytes_out)" \
+             "$(stat "$TMP/stats" nodes) $(stat "$TMP/stats" peak_live_bytes)"
+}
+
+# The median of REPS runs by wall time, prefixed with the selection name
+measure() {
+        name=$1
+        shift
+        run "$@" > /dev/null || { echo "$name: xml2json failed" >&2; exit 1; }
+        : > "$TMP/samples"
+        i=0
+        while [ $i -lt "$REPS" ]; do
+                run "$@" >> "$TMP/samples" || exit 1
+                i=$((i + 1))
+        done
+        sort -n "$TMP/samples" | sed -n "$(((REPS + 1) / 2))p" |
+                sed "s/^/$name /" >> "$TMP/points"
+}
+
+: > "$TMP/points"
+measure full
+args=
+n=0
+for name in $NAMES; do
+        args="$args --select=/corpus/record/$name"
+        n=$((n + 1))
+        # shellcheck disable=SC2086
+        measure "$n-of-$(echo $NAMES | wc -w)" $args
+done
+[ -n "$LEAF" ] && measure "leaf-$LEAF" "--select=/corpus/record/*/$LEAF"
+
+printf "%-14s %10s %9s %10s %9s %10s %12s\n" selection "wall ms" "time %" \
+        "bytes out" "output %" nodes "peak live"
+awk -v rev="$REV" -v results="$RESULTS" '
+{
+        if (NR == 1) {
+                wall = $2;
+                out = $3;
+        }
+        printf "%-14s %10.1f %8.1f%% %10d %8.1f%% %10d %12d\n", $1, $2, \
+                wall ? $2 * 100 / wall : 0, $3, out ? $3 * 100 / out : 0, \
+                $4, $5;
+        if (results != "")
+                printf "{\"rev\":\"%s\",\"selection\":\"%s\"," \
+                       "\"wall_ms\":%.3f,\"bytes_out\":%d,\"nodes\":%d," \
+                       "\"peak_live_bytes\":%d}\n", rev, $1, $2, $3, $4, \
+                       $5 >> results;
+}' "$TMP/points"
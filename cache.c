@@ -0,0 +1,382 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * cache - On-disk cache of converted documents for batch mode.
+ *
+ * Every entry is a file named after its key, written aside and renamed into
+ * place, so several runs may share a cache directory.
+ */
+
+#include "cache.h"
+#include "input.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define CACHE_MAGIC "X2JC"
+#define CACHE_NAME_LEN 32               /* hex digits of a key */
+
+struct cache_header {
+        char magic[4];
+        uint32_t version;
+        uint64_t len;                   /* of the output */
+        uint64_t stored;                /* bytes following, deflated or not */
+        uint32_t deflated;
+        uint32_t pad;
+};
+
+struct cache_file {
+        char name[CACHE_NAME_LEN + 1];
+        time_t mtime;
+        long mtime_nsec;
+        uint64_t size;
+};
+
+/* Private functions */
+static uint64_t rotl64(uint64_t x, int r)
+{
+        return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+
+        return k;
+}
+
+/* MurmurHash3, x64 128 bit variant */
+static void hash128(const void *buf, size_t len, uint64_t seed,
+                    uint64_t out[2])
+{
+        const uint64_t c1 = 0x87c37b91114253d5ULL;
+        const uint64_t c2 = 0x4cf5ad432745937fULL;
+        const unsigned char *p = buf, *tail;
+        uint64_t h1 = seed, h2 = seed, k1, k2;
+        size_t i, blocks = len / 16;
+
+        for (i = 0; i < blocks; i++) {
+                memcpy(&k1, p + i * 16, 8);
+                memcpy(&k2, p + i * 16 + 8, 8);
+
+                k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+                h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+                k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+        }
+
+        tail = p + blocks * 16;
+        k1 = k2 = 0;
+        switch (len & 15) {
+        case 15: k2 ^= (uint64_t) tail[14] << 48; /* fall through */
+        case 14: k2 ^= (uint64_t) tail[13] << 40; /* fall through */
+        case 13: k2 ^= (uint64_t) tail[12] << 32; /* fall through */
+        case 12: k2 ^= (uint64_t) tail[11] << 24; /* fall through */
+        case 11: k2 ^= (uint64_t) tail[10] << 16; /* fall through */
+        case 10: k2 ^= (uint64_t) tail[9] << 8;   /* fall through */
+        case 9:
+                k2 ^= (uint64_t) tail[8];
+                k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                /* fall through */
+        case 8: k1 ^= (uint64_t) tail[7] << 56;   /* fall through */
+        case 7: k1 ^= (uint64_t) tail[6] << 48;   /* fall through */
+        case 6: k1 ^= (uint64_t) tail[5] << 40;   /* fall through */
+        case 5: k1 ^= (uint64_t) tail[4] << 32;   /* fall through */
+        case 4: k1 ^= (uint64_t) tail[3] << 24;   /* fall through */
+        case 3: k1 ^= (uint64_t) tail[2] << 16;   /* fall through */
+        case 2: k1 ^= (uint64_t) tail[1] << 8;    /* fall through */
+        case 1:
+                k1 ^= (uint64_t) tail[0];
+                k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+                break;
+        default:
+                break;
+        }
+
+        h1 ^= len;
+        h2 ^= len;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix64(h1);
+        h2 = fmix64(h2);
+        h1 += h2;
+        h2 += h1;
+
+        out[0] = h1;
+        out[1] = h2;
+}
+
+static char *entry_path(const struct cache *c, const struct cache_key *key,
+                        const char *suffix)
+{
+        size_t len = strlen(c->dir) + 1 + CACHE_NAME_LEN + strlen(suffix) + 1;
+        char *path = xmalloc(len);
+
+        snprintf(path, len, "%s/%016llx%016llx%s", c->dir,
+                 (unsigned long long) key->h[0],
+                 (unsigned long long) key->h[1], suffix);
+
+        return path;
+}
+
+static int read_all(int fd, void *buf, size_t len, off_t off)
+{
+        char *p = buf;
+
+        while (len) {
+                ssize_t n = pread(fd, p, len, off);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return -1;
+                p += n;
+                off += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+        const char *p = buf;
+
+        while (len) {
+                ssize_t n = write(fd, p, len);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return -1;
+                p += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+static int is_entry_name(const char *name)
+{
+        size_t i;
+
+        for (i = 0; i < CACHE_NAME_LEN; i++)
+                if (!((name[i] >= '0' && name[i] <= '9') ||
+                      (name[i] >= 'a' && name[i] <= 'f')))
+                        return 0;
+
+        return name[i] == '\0';
+}
+
+/* Oldest first */
+static int file_cmp(const void *a, const void *b)
+{
+        const struct cache_file *x = a, *y = b;
+
+        if (x->mtime != y->mtime)
+                return x->mtime < y->mtime ? -1 : 1;
+        if (x->mtime_nsec != y->mtime_nsec)
+                return x->mtime_nsec < y->mtime_nsec ? -1 : 1;
+        return strcmp(x->name, y->name);
+}
+
+/* Public functions */
+int cache_open(struct cache *c, const char *dir, uint64_t max_size,
+               const void *opts, size_t len)
+{
+        struct input exe;
+        uint64_t h[4] = { 0, 0, 0, 0 };
+
+        memset(c, 0, sizeof(struct cache));
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+                return -1;
+
+        /* The binary stands in for a version number */
+        if (input_open(&exe, "/proc/self/exe", 0, 0) == 0) {
+                hash128(exe.base, exe.size, 0, h + 2);
+                input_close(&exe);
+        }
+        hash128(opts, len, CACHE_VERSION, h);
+        hash128(h, sizeof(h), 0, c->opts);
+
+        c->dir = xstrdup(dir);
+        c->max_size = max_size;
+
+        return 0;
+}
+
+void cache_key(const struct cache *c, const void *buf, size_t len,
+               struct cache_key *key)
+{
+        uint64_t h[4];
+
+        h[0] = c->opts[0];
+        h[1] = c->opts[1];
+        hash128(buf, len, 0, h + 2);
+        hash128(h, sizeof(h), 0, key->h);
+}
+
+int cache_get(const struct cache *c, const struct cache_key *key, char **buf,
+              size_t *len)
+{
+        struct cache_header hdr;
+        struct stat sb;
+        char *path, *stored = NULL, *out = NULL;
+        int fd, hit = 0;
+
+        path = entry_path(c, key, "");
+        fd = open(path, O_RDONLY);
+        xfree(path);
+        if (fd < 0)
+                return 0;
+
+        if (fstat(fd, &sb) < 0 || read_all(fd, &hdr, sizeof(hdr), 0) < 0 ||
+            memcmp(hdr.magic, CACHE_MAGIC, 4) ||
+            hdr.version != CACHE_VERSION ||
+            (uint64_t) sb.st_size != sizeof(hdr) + hdr.stored ||
+            hdr.len > SIZE_MAX - 1 ||
+            hdr.len / 1032 > hdr.stored)        /* deflate's best ratio */
+                goto done;
+
+        out = xmalloc(hdr.len + 1);
+        if (!hdr.deflated) {
+                if (hdr.stored != hdr.len ||
+                    read_all(fd, out, hdr.len, sizeof(hdr)) < 0)
+                        goto done;
+        } else {
+#ifdef HAVE_ZLIB
+                uLongf n = hdr.len;
+
+                stored = xmalloc(hdr.stored);
+                if (read_all(fd, stored, hdr.stored, sizeof(hdr)) < 0 ||
+                    uncompress((Bytef *) out, &n, (const Bytef *) stored,
+                               hdr.stored) != Z_OK || n != hdr.len)
+                        goto done;
+#else
+                goto done;
+#endif
+        }
+        out[hdr.len] = '\0';
+
+        /* Recently used, as far as eviction goes */
+        futimens(fd, NULL);
+
+        *buf = out;
+        *len = hdr.len;
+        out = NULL;
+        hit = 1;
+
+done:
+        close(fd);
+        xfree(stored);
+        xfree(out);
+
+        return hit;
+}
+
+void cache_put(const struct cache *c, const struct cache_key *key,
+               const char *buf, size_t len)
+{
+        static unsigned long seq;
+        struct cache_header hdr;
+        char *path, *tmp, suffix[64];
+        const char *data = buf;
+        char *deflated = NULL;
+        int fd, ok;
+
+        memset(&hdr, 0, sizeof(struct cache_header));
+        memcpy(hdr.magic, CACHE_MAGIC, 4);
+        hdr.version = CACHE_VERSION;
+        hdr.len = len;
+        hdr.stored = len;
+
+#ifdef HAVE_ZLIB
+        {
+                uLongf n = compressBound(len);
+
+                deflated = xmalloc(n);
+                if (compress2((Bytef *) deflated, &n, (const Bytef *) buf,
+                              len, Z_BEST_SPEED) == Z_OK && n < len) {
+                        data = deflated;
+                        hdr.stored = n;
+                        hdr.deflated = 1;
+                }
+        }
+#endif
+
+        snprintf(suffix, sizeof(suffix), ".tmp.%ld.%lu", (long) getpid(),
+                 __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+        tmp = entry_path(c, key, suffix);
+        path = entry_path(c, key, "");
+
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) {
+                ok = write_all(fd, &hdr, sizeof(hdr)) == 0 &&
+                        write_all(fd, data, hdr.stored) == 0;
+                if (close(fd) < 0 || !ok || rename(tmp, path) < 0)
+                        unlink(tmp);
+        }
+
+        xfree(tmp);
+        xfree(path);
+        xfree(deflated);
+}
+
+uint64_t cache_evict(const struct cache *c)
+{
+        struct cache_file *files = NULL;
+        struct dirent *de;
+        struct stat sb;
+        size_t nfiles = 0, alloc = 0, i;
+        uint64_t total = 0, removed = 0;
+        DIR *d;
+
+        if (!c->max_size || (d = opendir(c->dir)) == NULL)
+                return 0;
+
+        while ((de = readdir(d)) != NULL) {
+                if (!is_entry_name(de->d_name) ||
+                    fstatat(dirfd(d), de->d_name, &sb, 0) < 0)
+                        continue;
+
+                ALLOC_GROW(files, nfiles + 1, alloc);
+                memcpy(files[nfiles].name, de->d_name, CACHE_NAME_LEN + 1);
+                files[nfiles].mtime = sb.st_mtim.tv_sec;
+                files[nfiles].mtime_nsec = sb.st_mtim.tv_nsec;
+                files[nfiles].size = sb.st_size;
+                total += sb.st_size;
+                nfiles++;
+        }
+
+        if (total > c->max_size) {
+                qsort(files, nfiles, sizeof(struct cache_file), file_cmp);
+                for (i = 0; i < nfiles && total > c->max_size; i++) {
+                        if (unlinkat(dirfd(d), files[i].name, 0) < 0)
+                                continue;
+                        total -= files[i].size;
+                        removed++;
+                }
+        }
+
+        closedir(d);
+        xfree(files);
+
+        return removed;
+}
+
+void cache_close(struct cache *c)
+{
+        xfree(c->dir);
+        c->dir = NULL;
+}
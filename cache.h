@@ -0,0 +1,78 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * cache - On-disk cache of converted documents for batch mode.
+ *
+ * Entries are keyed by a 128 bit hash of the input bytes, the conversion
+ * options and the xml2json binary itself, so a rebuilt tool never serves
+ * output of an older one. The output is stored deflated where zlib is
+ * available. Using an entry bumps its modification time, and the least
+ * recently used entries are removed once the cache is over its size.
+ */
+
+#ifndef XML2JSON_CACHE_H
+#define XML2JSON_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHE_VERSION 1
+
+/* Default bound of the cache, see cache_evict() */
+#define CACHE_MAX_SIZE (1024ULL * 1024 * 1024)
+
+struct cache {
+        char *dir;
+        uint64_t max_size;              /* 0 for no bound */
+        uint64_t opts[2];               /* hash of the options and tool */
+};
+
+struct cache_key {
+        uint64_t h[2];
+};
+
+/* cache_open():
+ * Use the directory `dir`, creating it if needed, for output converted
+ * with the options described by the `len` bytes at `opts`. Returns 0 on
+ * success, -1 with errno set on failure.
+ */
+int cache_open(struct cache *c, const char *dir, uint64_t max_size,
+               const void *opts, size_t len);
+
+/* cache_key():
+ * The key of the `len` bytes of input at `buf`.
+ */
+void cache_key(const struct cache *c, const void *buf, size_t len,
+               struct cache_key *key);
+
+/* cache_get():
+ * The output stored under `key`, in a buffer to free(), with its length in
+ * `*len`. Returns 1 on a hit, 0 on a miss; unreadable entries are misses.
+ */
+int cache_get(const struct cache *c, const struct cache_key *key, char **buf,
+              size_t *len);
+
+/* cache_put():
+ * Store the `len` bytes of output at `buf` under `key`. Best effort,
+ * failures leave the entry out.
+ */
+void cache_put(const struct cache *c, const struct cache_key *key,
+               const char *buf, size_t len);
+
+/* cache_evict():
+ * Remove the least recently used entries until the cache is within its
+ * bound. Returns the number of entries removed.
+ */
+uint64_t cache_evict(const struct cache *c);
+
+void cache_close(struct cache *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_CACHE_H */
@@ -0,0 +1,675 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * convert - XML documents to JSON.
+ *
+ * Every element becomes an object of its attributes and children, repeated
+ * names become arrays and text becomes a string, number, boolean or null.
+ * Used by single file mode and, through convert_buffer(), by the batch,
+ * split and daemon modes and the benchmarks.
+ */
+
+#define LIBXML_SCHEMAS_ENABLED
+#include "convert.h"
+#include "cstring.h"
+#include "htable.h"
+#include "input.h"
+#include "json.h"
+#include "output.h"
+#include "probes.h"
+#include "scheduler.h"
+#include "select.h"
+#include "simd.h"
+#include "stats.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libxml/parser.h>
+#include <libxml/chvalid.h>
+
+/**
+ * Hashtable
+ */
+enum  xml_entry_type {
+        ENTRY_TYPE_NULL,
+        ENTRY_TYPE_BOOL,
+        ENTRY_TYPE_STRING,
+        ENTRY_TYPE_NUMBER,
+        ENTRY_TYPE_ARRAY,
+        ENTRY_TYPE_OBJECT,
+};
+
+struct xml_htable {
+        struct htable table;
+};
+
+struct xml_htable_entry {
+        struct htable_entry entry;
+        enum xml_entry_type type;
+        char *key;              /* NUL terminated, in keybuf if it fits */
+        size_t keylen;
+        void *value;
+        union {
+                char keybuf[32];
+                struct xml_htable_entry *next;  /* in the pool */
+        };
+};
+
+/* Freed entries are kept per thread for the next ones */
+#define XML_ENTRY_POOL_MAX 4096
+
+static __thread struct xml_htable_entry *xml_entry_pool;
+static __thread unsigned int xml_entry_pool_len;
+
+/* Global variable not prefered, need to find the correct function to pass - for now developing functionality */
+
+static struct xml_htable_entry *alloc_xml_htable_entry(char *key,
+                                                       size_t keylen,
+                                                       void *value,
+                                                       enum xml_entry_type type)
+{
+        struct xml_htable_entry *e = xml_entry_pool;
+
+        if (e) {
+                xml_entry_pool = e->next;
+                xml_entry_pool_len--;
+        } else {
+                e = xmalloc(sizeof(struct xml_htable_entry));
+        }
+
+        e->key = keylen < sizeof(e->keybuf) ? e->keybuf : xmalloc(keylen + 1);
+        memcpy(e->key, key, keylen);
+        e->key[keylen] = '\0';
+        e->keylen = keylen;
+        e->value = value;
+        e->type = type;
+        return e;
+}
+
+static void free_xml_htable_entry(struct xml_htable_entry **e)
+{
+        if (e && *e) {
+                if ((*e)->key != (*e)->keybuf)
+                        xfree((*e)->key);
+                (*e)->key = NULL;
+                (*e)->keylen = 0;
+                if ((*e)->type == ENTRY_TYPE_STRING) {
+                        xfree((*e)->value);
+                }
+
+                (*e)->value = NULL;
+                if (xml_entry_pool_len < XML_ENTRY_POOL_MAX) {
+                        (*e)->next = xml_entry_pool;
+                        xml_entry_pool = *e;
+                        xml_entry_pool_len++;
+                } else {
+                        xfree(*e);
+                }
+                *e = NULL;
+        }
+}
+
+static void xml_entry_pool_release(void)
+{
+        while (xml_entry_pool) {
+                struct xml_htable_entry *e = xml_entry_pool;
+
+                xml_entry_pool = e->next;
+                xfree(e);
+        }
+        xml_entry_pool_len = 0;
+}
+
+static int xml_htable_entry_cmpfn(const void *unused1 _unused_,
+                                  const void *entry1,
+                                  const void *entry2,
+                                  const void *unused2 _unused_)
+{
+        const struct xml_htable_entry *e1 = entry1;
+        const struct xml_htable_entry *e2 = entry2;
+
+        return memcmp_raw(e1->key, e1->keylen, e2->key, e2->keylen);
+}
+
+static void xml_htable_init(struct xml_htable *ht)
+{
+        htable_init(&ht->table, xml_htable_entry_cmpfn, NULL, 0);
+}
+
+static void *xml_htable_get(struct xml_htable *ht, char *key,
+                            size_t keylen)
+{
+        struct xml_htable_entry k;
+        struct xml_htable_entry *e;
+
+        if (!ht->table.size)
+                xml_htable_init(ht);
+
+        htable_entry_init(&k, bufhash(key, keylen));
+        k.key = key;
+        k.keylen = keylen;
+        e = htable_get(&ht->table, &k, NULL);
+
+        return e ? e : NULL;
+}
+
+static void xml_htable_put(struct xml_htable *ht,
+                           char *key,
+                           size_t keylen, void *value,
+                           enum xml_entry_type type)
+{
+        struct xml_htable_entry *e;
+
+        if (!ht->table.size)
+                xml_htable_init(ht);
+
+        e = alloc_xml_htable_entry(key, keylen, value, type);
+        htable_entry_init(e, bufhash(key, keylen));
+
+        htable_put(&ht->table, e);
+}
+
+static void *xml_htable_remove(struct xml_htable *ht, char *key,
+                               size_t keylen)
+{
+        struct xml_htable_entry e;
+
+        if (!ht->table.size)
+                xml_htable_init(ht);
+
+        htable_entry_init(&e, bufhash(key, keylen));
+
+        return htable_remove(&ht->table, &e, key);
+}
+
+/* Object values are owned by the table until xml_htable_to_json_obj() hands
+ * them over, `free_objects` frees the ones that were never handed over.
+ */
+static void xml_htable_free(struct xml_htable *ht, int free_objects)
+{
+        struct htable_iter iter;
+        struct xml_htable_entry *e;
+
+        htable_iter_init(&ht->table, &iter);
+        while ((e = htable_iter_next(&iter))) {
+                if (free_objects && e->type == ENTRY_TYPE_OBJECT)
+                        json_free(e->value);
+                free_xml_htable_entry(&e);
+        }
+
+        htable_free(&ht->table, 0);
+}
+
+/**
+ * XML parsing
+ */
+
+static void *parse_xmlnode(xmlNodePtr node, enum xml_entry_type *type);
+
+static void *parse_xml_element_attributes(xmlAttrPtr attr, void *attrobj,
+                                          enum xml_entry_type *type)
+
+{
+        if (attr == NULL) {
+                *type = ENTRY_TYPE_NULL;
+                return NULL;
+        }
+
+        if (attrobj == NULL)
+                attrobj = json_new();
+
+        while (attr != NULL) {
+                cstring str;
+                void *val;
+
+                STATS_ADD(attributes, 1);
+
+                /* Append '@' to the attribute name */
+                cstring_init(&str, 0);
+                cstring_addch(&str, '@');
+                cstring_addstr(&str, (char *)attr->name);
+
+                val = parse_xmlnode(attr->children, type);
+
+                if (*type == ENTRY_TYPE_STRING) {
+                        JsonObject *strobj;
+                        strobj = json_string_obj(val);
+                        xfree(val);
+                        json_prepend_member(attrobj, str.buf, strobj);
+                } else {
+                        printf("attributes: non string type entry!\n");
+                }
+
+                attr = attr->next;
+
+                cstring_release(&str);
+        }
+
+        *type = ENTRY_TYPE_OBJECT;
+        return attrobj;
+}
+
+static int parse_xml_element_node(xmlNodePtr node, struct xml_htable *ht,
+                                    enum xml_entry_type *type)
+{
+        void *val = NULL;
+        int has_attr = 0;
+        void *attrval = NULL;
+        JsonObject *attrobj = NULL;
+        enum xml_entry_type first_type;
+
+        if (node == NULL) {
+                *type = ENTRY_TYPE_NULL;
+                return -1;
+        }
+
+        PROBE1(element__start, node->name);
+
+        val = parse_xmlnode(node->children, type);
+        first_type = *type;
+        switch (*type) {
+        case ENTRY_TYPE_NULL:
+                xfree(val);
+                val = NULL;
+                break;
+        case ENTRY_TYPE_STRING:
+                if (node->properties) {
+                        attrobj = json_new();
+                        json_prepend_member(attrobj, "#text",
+                                            json_string_obj(val));
+                        xfree(val);
+                        val = attrobj;
+                }
+                break;
+        case ENTRY_TYPE_OBJECT:
+        case ENTRY_TYPE_ARRAY:
+        case ENTRY_TYPE_BOOL:
+        case ENTRY_TYPE_NUMBER:
+        default:
+                break;
+        }
+
+        if (node->properties != NULL) {
+                /* We need to parse XML attributes */
+                attrval = parse_xml_element_attributes(node->properties, val,
+                                                       type);
+                if (val == NULL)
+                        val = attrval;
+                has_attr = 1;
+        }
+
+        /* Only has_attr is taken from the first pass */
+        if (has_attr || first_type == ENTRY_TYPE_OBJECT)
+                json_free(val);
+        else
+                xfree(val);
+
+        val = parse_xmlnode(node->children, type);
+        if (has_attr && *type == ENTRY_TYPE_NULL) {
+                xfree(val);
+                PROBE1(element__end, node->name);
+                return has_attr;
+        }
+
+        xml_htable_put(ht, (char *)node->name, xmlStrlen(node->name),
+                       val, *type);
+
+        PROBE1(element__end, node->name);
+        return has_attr;
+}
+
+static char *parse_xml_text_node(xmlNodePtr node, enum xml_entry_type *type,
+                                 size_t *slen)
+{
+        xmlChar *content;
+        cstring str;
+        size_t len = 0;
+
+        if (node->content == NULL)
+                return NULL;
+
+        cstring_init(&str, 0);
+
+        content = xmlNodeGetContent(node);
+        len = xmlStrlen(content);
+
+        if (len) {
+                cstring_grow(&str, len);
+                cstring_setlen(&str, simd_strip_space(str.buf,
+                                                      (const char *) content,
+                                                      len));
+        }
+
+        if (!content) *type = ENTRY_TYPE_NULL;
+
+        xmlFree(content);
+
+        if (str.len == 0) {
+                *type = ENTRY_TYPE_NULL;
+                cstring_release(&str);
+        } else {
+                *type = ENTRY_TYPE_STRING;
+        }
+
+        PROBE1(text, str.len);
+
+        return cstring_detach(&str, slen);
+}
+
+static JsonObject *xml_htable_to_json_obj(struct xml_htable *ht)
+{
+        JsonObject *jobj = NULL;
+        struct htable_iter iter;
+        struct xml_htable_entry *e = NULL;
+
+        jobj = json_new();
+
+        htable_iter_init_ordered(&ht->table, &iter);
+
+        while ((e = htable_iter_next_ordered(&iter))) {
+                if (e->entry.count > 1) { /* Array */
+                        JsonObject *array = NULL;
+                        struct xml_htable_entry *temp = NULL;
+                        temp = e;
+
+                        array = json_array_obj();
+                        PROBE2(array, e->key, e->entry.count);
+
+                        if (e->type == ENTRY_TYPE_NULL)
+                                json_prepend_to_array(array, json_null_obj());
+                        else if (e->type == ENTRY_TYPE_STRING)
+                                json_prepend_to_array(array,
+                                                      json_string_obj(e->value));
+                        else
+                                json_prepend_to_array(array, e->value);
+
+
+                        /* Parse the other entries for the same key */
+                        while ((temp = htable_get_next(&ht->table, temp))) {
+                                if (temp->type == ENTRY_TYPE_NULL)
+                                        json_prepend_to_array(array,
+                                                              json_null_obj());
+                                else if (temp->type == ENTRY_TYPE_STRING)
+                                        json_prepend_to_array(array,
+                                                              json_string_obj(temp->value));
+                                else
+                                        json_prepend_to_array(array, temp->value);
+                        }
+
+                        json_append_member(jobj, (char *)e->key, array);
+
+                } else {                  /* Normal(?) non-array object */
+                        if (e->type == ENTRY_TYPE_NULL)
+                                json_append_member(jobj, e->key,
+                                                   json_null_obj());
+                        else if (e->type == ENTRY_TYPE_STRING)
+                                json_append_member(jobj, e->key,
+                                                   json_string_obj(e->value));
+                        else
+                                json_append_member(jobj, e->key, e->value);
+                }
+        }
+
+        return jobj;
+}
+
+/* Depth of parse_xmlnode(): 1 for the document, 2 for the records, the
+ * children of the root element */
+static __thread int parse_depth;
+
+/* Times the parse_xmlnode() of the document being converted */
+static __thread struct stats_timer *convert_timer;
+
+/* Run waiting small jobs between records. They time their own phases, so
+ * the document's conversion timer is stopped while they run. */
+static void convert_yield(void)
+{
+        struct stats_timer *t = convert_timer;
+
+        if (!sched_yield_wanted())
+                return;
+
+        stats_stop(t, STATS_CONVERT);
+        sched_yield_point();
+        stats_start(t);
+}
+
+static void *parse_xmlnode(xmlNodePtr node, enum xml_entry_type *type)
+{
+        struct xml_htable ht;
+        xmlNodePtr n;
+        JsonObject *jobj;
+
+        if (node == NULL) {
+                *type = ENTRY_TYPE_NULL;
+                return NULL;
+        }
+
+        /* The ordered hash table is set up by the first put, text only
+         * children never need one */
+        memset(&ht, 0, sizeof(struct xml_htable));
+        parse_depth++;
+
+        for (n = node; n; n = n->next) {
+                void *val;
+                size_t slen = 0;
+
+                switch(n->type) {
+                case XML_ELEMENT_NODE:
+                        STATS_ADD(nodes, 1);
+                        parse_xml_element_node(n, &ht, type);
+                        /* Let waiting small jobs run between records */
+                        if (parse_depth == 2)
+                                convert_yield();
+                        break;
+                case XML_TEXT_NODE:
+                        STATS_ADD(texts, 1);
+                        val = parse_xml_text_node(n, type, &slen);
+                        if (slen == 0) {
+                                xfree(val);
+                                continue;
+                        }
+                        xml_htable_free(&ht, 1);
+                        parse_depth--;
+                        return val;
+                default:
+                        break;
+                }
+        }
+
+        parse_depth--;
+
+        /* If we've got here, we are returning a json object */
+        *type = ENTRY_TYPE_OBJECT;
+        jobj = xml_htable_to_json_obj(&ht);
+
+        /* Free the ordered hash table */
+        xml_htable_free(&ht, 0);
+        memset(&ht, 0, sizeof(struct xml_htable));
+
+        return jobj;
+}
+
+void parse_xml_tree(xmlDocPtr doc, xmlNodePtr xsdrootin, struct output *out)
+{
+
+        enum xml_entry_type type;
+
+        if (doc == NULL)
+                return;
+
+        if ((doc->type == XML_DOCUMENT_NODE) && (doc->children != NULL)) {
+                struct stats_timer t, *outer = convert_timer;
+                void *data;
+
+                stats_start(&t);
+                convert_timer = &t;
+                data = parse_xmlnode(doc->children, &type);
+                convert_timer = outer;
+                stats_stop(&t, STATS_CONVERT);
+
+                /* Encode our json object straight into the output sink */
+                stats_start(&t);
+                json_write((JsonObject *)data, out);
+                output_addch(out, '\n');
+                stats_stop(&t, STATS_ENCODE);
+                PROBE1(record__emit, out->bytes + out->len);
+                STATS_ADD(docs, 1);
+
+                json_free(data);
+                data = NULL;
+        }
+}
+
+/* Size of the chunks fed to the push parser when streaming the input */
+#define PARSE_CHUNK_SIZE (1024 * 1024)
+
+xmlDocPtr read_xml_input(struct input *in, const char *name,
+                         int xml_options, const struct select *sel)
+{
+        struct select_state st;
+        xmlParserCtxtPtr ctxt;
+        xmlDocPtr doc = NULL;
+        size_t off, n;
+
+        /* Without progress reports the whole mapping is parsed in one go */
+        if (!(in->flags & (INPUT_STREAM | INPUT_PREFAULT))) {
+                if (sel == NULL)
+                        return xmlReadMemory(in->base ? in->base : "",
+                                             in->size, name, NULL,
+                                             xml_options);
+
+                ctxt = xmlNewParserCtxt();
+                if (ctxt == NULL)
+                        return NULL;
+                select_install(ctxt, sel, &st);
+                doc = xmlCtxtReadMemory(ctxt, in->base ? in->base : "",
+                                        in->size, name, NULL, xml_options);
+                xmlFreeParserCtxt(ctxt);
+                return doc;
+        }
+
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, name);
+        if (ctxt == NULL)
+                return NULL;
+        xmlCtxtUseOptions(ctxt, xml_options);
+        if (sel != NULL)
+                select_install(ctxt, sel, &st);
+
+        for (off = 0; off < in->size; off += n) {
+                n = in->size - off;
+                if (n > PARSE_CHUNK_SIZE)
+                        n = PARSE_CHUNK_SIZE;
+                if (xmlParseChunk(ctxt, in->base + off, n, 0) != 0)
+                        break;
+                input_consumed(in, off + n);
+        }
+        xmlParseChunk(ctxt, NULL, 0, 1);
+
+        if (ctxt->wellFormed)
+                doc = ctxt->myDoc;
+        else
+                xmlFreeDoc(ctxt->myDoc);
+        ctxt->myDoc = NULL;
+        xmlFreeParserCtxt(ctxt);
+
+        return doc;
+}
+
+/* Parser and validation contexts of a batch or daemon worker, reused (and
+ * reset by xmlCtxtReadMemory()) for every document it converts */
+static __thread xmlParserCtxtPtr convert_pctxt;
+static __thread xmlSchemaValidCtxtPtr convert_vctxt;
+static __thread int convert_nested;
+
+int convert_buffer(const char *buf, size_t len, const char *name,
+                   struct output *out, const void *data)
+{
+        const struct convert_opts *opts = data;
+        struct select_state st;
+        struct stats_timer t;
+        xmlParserCtxtPtr ctxt;
+        xmlDocPtr doc;
+        /* The output may already hold earlier records */
+        uint64_t start = out->bytes + out->len;
+
+        if (convert_pctxt == NULL &&
+            (convert_pctxt = xmlNewParserCtxt()) == NULL)
+                return -1;
+
+        /* A small document run from a yield point of a large one must not
+         * reset the parser context the large document came from */
+        xmlResetLastError();
+        stats_start(&t);
+        if (convert_nested && opts->select == NULL) {
+                doc = xmlReadMemory(buf, len, name, NULL, opts->xml_options);
+        } else {
+                ctxt = convert_nested ? xmlNewParserCtxt() : convert_pctxt;
+                if (ctxt == NULL)
+                        return -1;
+                if (opts->select != NULL)
+                        select_install(ctxt, opts->select, &st);
+                doc = xmlCtxtReadMemory(ctxt, buf, len, name, NULL,
+                                        opts->xml_options);
+                if (ctxt != convert_pctxt)
+                        xmlFreeParserCtxt(ctxt);
+        }
+        stats_stop(&t, STATS_PARSE);
+        STATS_ADD(bytes_in, len);
+        if (doc == NULL)
+                return -1;
+
+        if (opts->schema != NULL) {
+                if (convert_vctxt == NULL)
+                        convert_vctxt = xmlSchemaNewValidCtxt(opts->schema);
+                stats_start(&t);
+                if (convert_vctxt == NULL ||
+                    xmlSchemaValidateDoc(convert_vctxt, doc) != 0) {
+                        stats_stop(&t, STATS_VALIDATE);
+                        xmlFreeDoc(doc);
+                        return -1;
+                }
+                stats_stop(&t, STATS_VALIDATE);
+        }
+
+        convert_nested++;
+        parse_xml_tree(doc, NULL, out);
+        convert_nested--;
+        xmlFreeDoc(doc);
+        STATS_ADD(bytes_out, out->bytes + out->len - start);
+
+        return 0;
+}
+
+void convert_last_error(char *msg, size_t size, unsigned long *line,
+                        const void *data)
+{
+        const xmlError *err = xmlGetLastError();
+        size_t len;
+
+        if (err == NULL || err->message == NULL)
+                return;
+
+        snprintf(msg, size, "%s", err->message);
+        len = strlen(msg);
+        while (len && msg[len - 1] == '\n')
+                msg[--len] = '\0';
+        if (err->line > 0)
+                *line = err->line;
+}
+
+void convert_thread_done(const void *data)
+{
+        if (convert_vctxt != NULL)
+                xmlSchemaFreeValidCtxt(convert_vctxt);
+        if (convert_pctxt != NULL)
+                xmlFreeParserCtxt(convert_pctxt);
+        convert_vctxt = NULL;
+        convert_pctxt = NULL;
+
+        xml_entry_pool_release();
+        json_pool_release();
+        htable_pool_release();
+}
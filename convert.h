@@ -0,0 +1,75 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * convert - XML documents to JSON.
+ *
+ * The converter of every mode: single file mode parses with
+ * read_xml_input() and writes with parse_xml_tree(), the other modes and
+ * the benchmarks hand convert_buffer() to batch_run(), split_run() or
+ * serve_run() as their batch_convert_fn, see batch.h.
+ */
+
+#ifndef XML2JSON_CONVERT_H
+#define XML2JSON_CONVERT_H
+
+#include <libxml/tree.h>
+#include <libxml/xmlschemas.h>
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct input;
+struct output;
+struct select;
+
+struct convert_opts {
+        int xml_options;
+        xmlSchemaPtr schema;    /* validate against, daemon and split
+                                 * modes only */
+        const struct select *select;    /* convert only these paths */
+};
+
+/* read_xml_input():
+ * Parse `in`, named `name` in libxml2's errors, with `xml_options` and
+ * keeping only the elements `sel` selects if it is not NULL. Streamed and
+ * prefaulted inputs are fed to a push parser a chunk at a time, so their
+ * progress is reported. Returns NULL if the document is not well formed.
+ */
+xmlDocPtr read_xml_input(struct input *in, const char *name,
+                         int xml_options, const struct select *sel);
+
+/* parse_xml_tree():
+ * Write `doc` as one line of JSON to `out`.
+ */
+void parse_xml_tree(xmlDocPtr doc, xmlNodePtr xsdrootin, struct output *out);
+
+/* convert_buffer():
+ * Convert the document in the `len` bytes at `buf` into a line of `out`,
+ * with the struct convert_opts at `data`. The parser and validation
+ * contexts are kept per thread for the next document. Returns 0 on
+ * success, -1 if the document did not parse or validate.
+ */
+int convert_buffer(const char *buf, size_t len, const char *name,
+                   struct output *out, const void *data);
+
+/* convert_last_error():
+ * Why convert_buffer() just failed on this thread, from libxml2: the
+ * message into the `size` bytes at `msg` and the line into `*line`, if
+ * known.
+ */
+void convert_last_error(char *msg, size_t size, unsigned long *line,
+                        const void *data);
+
+/* convert_thread_done():
+ * Free what a converter thread keeps across documents.
+ */
+void convert_thread_done(const void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_CONVERT_H */
@@ -40,7 +40,7 @@ void cstring_init(cstring *cstr, size_t len)
 void cstring_release(cstring *cstr)
 {
         if (cstr->alloc) {
-                free(cstr->buf);
+                xfree(cstr->buf);
                 cstring_init(cstr, 0);
         }
 }
@@ -6,6 +6,7 @@
  */
 
 #include "htable.h"
+#include "probes.h"
 #include "util.h"
 
 #include <stdio.h>
@@ -19,7 +20,40 @@
 #define HTABLE_RESIZE_BITS       2
 #define HTABLE_RESIZE_THRESHOLD 80
 
+/* Tables of the initial size are kept per thread for the next table, most
+ * tables never grow and small documents make many of them */
+#define HTABLE_POOL_MAX 64
+
+static __thread struct htable_entry **table_pool;  /* linked through [0] */
+static __thread unsigned int table_pool_len;
+
 /* Private functions */
+static struct htable_entry **table_get(size_t size)
+{
+        struct htable_entry **table = table_pool;
+
+        if (size != HTABLE_INIT_SIZE || table == NULL)
+                return xcalloc(size, sizeof(struct htable_entry *));
+
+        table_pool = (struct htable_entry **) (void *) table[0];
+        table_pool_len--;
+        memset(table, 0, size * sizeof(struct htable_entry *));
+
+        return table;
+}
+
+static void table_put(struct htable_entry **table, size_t size)
+{
+        if (size != HTABLE_INIT_SIZE || table_pool_len >= HTABLE_POOL_MAX) {
+                xfree(table);
+                return;
+        }
+
+        table[0] = (struct htable_entry *) (void *) table_pool;
+        table_pool = table;
+        table_pool_len++;
+}
+
 static int default_cmp_fn(const void *data _unused_,
                           const void *entry1 _unused_,
                           const void *entry2 _unused_,
@@ -31,7 +65,7 @@ static int default_cmp_fn(const void *data _unused_,
 static void alloc_htable(struct htable *ht, size_t size)
 {
         ht->size = size;
-        ht->table = xcalloc(size, sizeof(struct htable *));
+        ht->table = table_get(size);
 
         ht->grow_mark = size * HTABLE_RESIZE_THRESHOLD / 100;
         if (size <= HTABLE_INIT_SIZE)
@@ -72,20 +106,48 @@ static void rehash(struct htable *ht, unsigned int newsize)
 {
         unsigned int i, oldsize = ht->size;
         struct htable_entry **oldtable = ht->table;
+        struct htable_entry ***tails;
 
+        PROBE2(htable__grow, oldsize, newsize);
         alloc_htable(ht, newsize);
+
+        /* Chains keep their order, so duplicates stay together newest first */
+        ALLOC_ARRAY(tails, newsize);
+        for (i = 0; i < newsize; i++)
+                tails[i] = &ht->table[i];
+
         for (i = 0; i < oldsize; i++) {
                 struct htable_entry *e = oldtable[i];
                 while (e) {
                         struct htable_entry *n = e->next;
                         unsigned int b = bucket(ht, e);
-                        e->next = ht->table[b];
-                        ht->table[b] = e;
+
+                        *tails[b] = e;
+                        tails[b] = &e->next;
+                        e->next = NULL;
                         e = n;
                 }
         }
 
-        free(oldtable);
+        xfree(tails);
+        table_put(oldtable, oldsize);
+}
+
+/* Let `new` take the place of `old` in the insertion ordered list */
+static void iter_list_replace(struct htable *ht, struct htable_entry *old,
+                              struct htable_entry *new)
+{
+        new->iter_prev = old->iter_prev;
+        new->iter_next = old->iter_next;
+        if (new->iter_prev)
+                new->iter_prev->iter_next = new;
+        else
+                ht->iter_head = new;
+        if (new->iter_next)
+                new->iter_next->iter_prev = new;
+        else
+                ht->iter_tail = new;
+        old->iter_prev = old->iter_next = NULL;
 }
 
 /* Public functions */
@@ -111,7 +173,6 @@ void htable_init(struct htable *ht, htable_cmp_fn cmp_fn,
 
         ht->cmpfn = cmp_fn ? cmp_fn : default_cmp_fn;
         ht->cmpfndata = cmpfndata;
-        ht->iter_head = ht->iter_tail = UINT_MAX;
 
         /* calculate initial size */
         size = size * 100 / HTABLE_RESIZE_THRESHOLD;
@@ -132,13 +193,24 @@ void htable_free(struct htable *ht, int free_entries)
 
                 htable_iter_init(ht, &iter);
                 while((e = htable_iter_next(&iter)))
-                        free(e);
+                        xfree(e);
         }
 
-        free(ht->table);
+        table_put(ht->table, ht->size);
         memset(ht, 0, sizeof(struct htable));
 }
 
+void htable_pool_release(void)
+{
+        while (table_pool) {
+                struct htable_entry **table = table_pool;
+
+                table_pool = (struct htable_entry **) (void *) table[0];
+                xfree(table);
+        }
+        table_pool_len = 0;
+}
+
 void *htable_get(const struct htable *ht, const void *key, const void *keydata)
 {
         return *find_entry(ht, key, keydata);
@@ -156,57 +228,66 @@ const void *htable_get_next(const struct htable *ht, const void *entry)
 
 void htable_put(struct htable *ht, void *entry)
 {
-        unsigned int b = bucket(ht, entry);
-        int collision = 0;
-
-        collision = ht->table[b] ? 1 : 0;
-
-        if (collision) {
-                ((struct htable_entry *) entry)->iter_prev =
-                        ((struct htable_entry *) ht->table[b])->iter_prev;
-                ((struct htable_entry *) entry)->iter_next =
-                        ((struct htable_entry *) ht->table[b])->iter_next;
-                ((struct htable_entry *) entry)->count =
-                        ((struct htable_entry *) ht->table[b])->count;
-        }
-
-        ((struct htable_entry *) entry)->next = ht->table[b];
-        ht->table[b] = entry;
-
-        ((struct htable_entry *) entry)->count += 1;
-
-        if (ht->iter_head == UINT_MAX) { /* First entry */
-                ((struct htable_entry *) entry)->iter_prev = UINT_MAX;
-                ((struct htable_entry *) entry)->iter_next = UINT_MAX;
-                ht->iter_head = b;
-                ht->iter_tail = b;
+        struct htable_entry *e = entry;
+        struct htable_entry **pos = find_entry(ht, e, NULL);
+        struct htable_entry *old = *pos;
+
+        /* A duplicate goes in front of the newest entry of its key and
+         * replaces it in the ordered list, a new key goes to the end of both
+         * its chain and the list.
+         */
+        e->next = old;
+        *pos = e;
+        if (old) {
+                e->count = old->count + 1;
+                iter_list_replace(ht, old, e);
         } else {
-                if (!collision) {
-                        ((struct htable_entry *) ht->table[ht->iter_tail])->iter_next = b;
-                        ((struct htable_entry *) entry)->iter_prev = ht->iter_tail;
-                        ht->iter_tail = b;
-                }
+                e->count = 1;
+                e->iter_next = NULL;
+                e->iter_prev = ht->iter_tail;
+                if (ht->iter_tail)
+                        ht->iter_tail->iter_next = e;
+                else
+                        ht->iter_head = e;
+                ht->iter_tail = e;
         }
 
         ht->count++;
-        if (ht->count < ht->shrink_mark)
+        PROBE2(htable__put, e->hash, ht->count);
+        if (ht->count > ht->grow_mark)
                 rehash(ht, ht->size << HTABLE_RESIZE_BITS);
 }
 
 void *htable_remove(struct htable *ht, const void *key,
                     const void *keydata)
 {
-        struct htable_entry *old;
+        struct htable_entry *old, *n;
         struct htable_entry **e = find_entry(ht, key, keydata);
 
         if (!*e)
                 return NULL;
 
+        /* The newest entry of a key is found first, the next older one of
+         * the same key, if any, takes over its count and list position.
+         */
         old = *e;
-        *e = old->next;
+        n = old->next;
+        *e = n;
+        if (n && entries_equal(ht, n, old, keydata)) {
+                n->count = old->count - 1;
+                iter_list_replace(ht, old, n);
+        } else {
+                if (old->iter_prev)
+                        old->iter_prev->iter_next = old->iter_next;
+                else
+                        ht->iter_head = old->iter_next;
+                if (old->iter_next)
+                        old->iter_next->iter_prev = old->iter_prev;
+                else
+                        ht->iter_tail = old->iter_prev;
+                old->iter_prev = old->iter_next = NULL;
+        }
         old->next = NULL;
-        /* TODO: Update entry count */
-        /* TODO: Update the iter_prev and iter_next values */
 
         ht->count--;
         if (ht->count < ht->shrink_mark)
@@ -250,36 +331,22 @@ void *htable_iter_next(struct htable_iter *iter)
 void htable_iter_init_ordered(struct htable *ht, struct htable_iter *iter)
 {
         iter->ht = ht;
-        iter->pos = ht->iter_head;
+        iter->pos = 0;
         iter->count = 0;
-        iter->next = NULL;
+        iter->next = ht->iter_head;
 }
 
 void *htable_iter_ordered_get(struct htable_iter *iter)
 {
-        struct htable_entry *current = iter->ht->table[iter->pos];
-
-        return current;
+        return iter->next;
 }
 
 void *htable_iter_next_ordered(struct htable_iter *iter)
 {
-        struct htable_entry *current = NULL;
-
-        iter->count += 1;
-
-        if (iter->pos == UINT_MAX)
-                return NULL;
-
-        if (iter->count > iter->ht->count)
-                return NULL;
-
-        current = iter->ht->table[iter->pos];
+        struct htable_entry *current = iter->next;
 
-        if (current) {
-                iter->pos = current->iter_next;
-                return current;
-        }
+        if (current)
+                iter->next = current->iter_next;
 
-        return NULL;
+        return current;
 }
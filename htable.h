@@ -31,7 +31,8 @@ struct htable_entry {
         struct htable_entry *next; /* next element in case of collision */
         unsigned int hash;
         unsigned int count;        /* count of members in this entry */
-        unsigned int iter_prev, iter_next;
+        /* insertion order of the distinct keys, see htable_put() */
+        struct htable_entry *iter_prev, *iter_next;
 };
 
 struct htable {
@@ -45,13 +46,18 @@ struct htable {
 
         unsigned int grow_mark;
         unsigned int shrink_mark;
-        unsigned int iter_head, iter_tail;
+        struct htable_entry *iter_head, *iter_tail;
 };
 
 extern void htable_init(struct htable *ht, htable_cmp_fn cmp_fn,
                         const void *cmpfndata, size_t size);
 extern void htable_free(struct htable *ht, int free_entries);
 
+/* htable_pool_release():
+ *   free the tables the calling thread keeps for reuse, before it exits.
+ */
+extern void htable_pool_release(void);
+
 /* htable_entry_init():
  *   initialise htable entry
  */
@@ -61,8 +67,8 @@ static inline void htable_entry_init(void *entry, unsigned int hash)
         e->hash = hash;
         e->next = NULL;
         e->count = 0;
-        e->iter_prev = 0;
-        e->iter_next = 0;
+        e->iter_prev = NULL;
+        e->iter_next = NULL;
 }
 
 /* htable_get():
@@ -79,7 +85,9 @@ extern void *htable_get(const struct htable *ht, const void *key,
 extern const void *htable_get_next(const struct htable *ht, const void *entry);
 
 /* htable_put():
- *  adds a entry into the hash table. Allows duplicate entries.
+ *  adds a entry into the hash table. Allows duplicate entries, which are
+ * kept together newest first; the newest one carries the count and stands
+ * for the key in ordered iteration.
  */
 extern void htable_put(struct htable *ht, void *entry);
 
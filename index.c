@@ -0,0 +1,284 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * index - Sidecar index of the records of a large file.
+ *
+ * Records are found with the markup scan of split mode, they are not
+ * parsed. Keys are kept sorted so a lookup is a binary search over the
+ * mapped index, which only touches the key values it compares.
+ */
+
+#include "index.h"
+#include "input.h"
+#include "output.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct index_entry {
+        const char *value;
+        size_t len;
+        uint64_t record;
+};
+
+/* Private functions */
+static int value_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+        int ret = memcmp(a, b, alen < blen ? alen : blen);
+
+        if (ret)
+                return ret;
+        return alen < blen ? -1 : alen > blen;
+}
+
+/* By value, then in file order */
+static int entry_cmp(const void *a, const void *b)
+{
+        const struct index_entry *x = a, *y = b;
+        int ret = value_cmp(x->value, x->len, y->value, y->len);
+
+        if (ret)
+                return ret;
+        return x->record < y->record ? -1 : x->record > y->record;
+}
+
+static int index_check(const struct index *idx)
+{
+        const struct index_header *hdr = idx->hdr;
+        uint64_t i;
+
+        if (memchr(hdr->key, '\0', INDEX_KEY_MAX) == NULL ||
+            hdr->mode > SPLIT_RECORDS)
+                return -1;
+
+        for (i = 0; i < hdr->records; i++)
+                if (idx->records[i].off > hdr->input_size ||
+                    idx->records[i].len >
+                    hdr->input_size - idx->records[i].off)
+                        return -1;
+
+        for (i = 0; i < hdr->keys; i++)
+                if (idx->keys[i].value > hdr->strings ||
+                    idx->keys[i].len > hdr->strings - idx->keys[i].value ||
+                    idx->keys[i].record >= hdr->records)
+                        return -1;
+
+        return 0;
+}
+
+/* Public functions */
+int index_build(const char *path, struct input *in, enum split_mode mode,
+                const char *key, uint64_t *records)
+{
+        struct index_header hdr;
+        struct index_record *recs = NULL;
+        struct index_entry *keys = NULL;
+        struct index_key k;
+        struct output out;
+        struct split sp;
+        struct stat sb;
+        size_t nrecs = 0, allocrecs = 0, nkeys = 0, allockeys = 0, i;
+        size_t off, len, vlen;
+        const char *value;
+        char *tmp;
+        int fd, ret;
+
+        if (key != NULL && strlen(key) >= INDEX_KEY_MAX) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        if (fstat(in->fd, &sb) < 0)
+                return -1;
+
+        split_init(&sp, mode, in->base, in->size);
+        while ((ret = split_next(&sp, &off, &len)) > 0) {
+                ALLOC_GROW(recs, nrecs + 1, allocrecs);
+                recs[nrecs].off = off;
+                recs[nrecs].len = len;
+
+                if (key != NULL &&
+                    (value = split_attr(in->base + off, len, key,
+                                        &vlen)) != NULL) {
+                        ALLOC_GROW(keys, nkeys + 1, allockeys);
+                        keys[nkeys].value = value;
+                        keys[nkeys].len = vlen;
+                        keys[nkeys].record = nrecs;
+                        nkeys++;
+                }
+                nrecs++;
+                input_consumed(in, off + len);
+        }
+        ret = ret < 0;
+
+        if (nkeys)
+                qsort(keys, nkeys, sizeof(struct index_entry), entry_cmp);
+
+        memset(&hdr, 0, sizeof(struct index_header));
+        memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+        hdr.version = INDEX_VERSION;
+        hdr.mode = mode;
+        hdr.input_size = in->size;
+        hdr.input_mtime_sec = sb.st_mtim.tv_sec;
+        hdr.input_mtime_nsec = sb.st_mtim.tv_nsec;
+        hdr.records = nrecs;
+        hdr.keys = nkeys;
+        for (i = 0; i < nkeys; i++)
+                hdr.strings += keys[i].len;
+        if (key != NULL)
+                strcpy(hdr.key, key);
+
+        /* Written aside and renamed, so a reader never sees half of it */
+        tmp = xmalloc(strlen(path) + 5);
+        sprintf(tmp, "%s.tmp", path);
+        if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+                ret = -1;
+                goto done;
+        }
+
+        output_init(&out, fd);
+        output_add(&out, &hdr, sizeof(struct index_header));
+        output_add(&out, recs, nrecs * sizeof(struct index_record));
+        for (i = 0, k.value = 0; i < nkeys; i++) {
+                k.len = keys[i].len;
+                k.record = keys[i].record;
+                output_add(&out, &k, sizeof(struct index_key));
+                k.value += k.len;
+        }
+        for (i = 0; i < nkeys; i++)
+                output_add(&out, keys[i].value, keys[i].len);
+        output_release(&out);
+
+        if (close(fd) < 0 || rename(tmp, path) < 0) {
+                unlink(tmp);
+                ret = -1;
+        }
+        *records = nrecs;
+
+done:
+        xfree(tmp);
+        xfree(recs);
+        xfree(keys);
+
+        return ret;
+}
+
+int index_open(struct index *idx, const char *path, const struct input *in)
+{
+        const struct index_header *hdr;
+        struct stat sb, isb;
+        size_t need;
+        int fd, err;
+
+        memset(idx, 0, sizeof(struct index));
+
+        if ((fd = open(path, O_RDONLY)) < 0)
+                return -1;
+        if (fstat(fd, &sb) < 0 || fstat(in->fd, &isb) < 0)
+                goto fail;
+        if ((size_t) sb.st_size < sizeof(struct index_header)) {
+                errno = EINVAL;
+                goto fail;
+        }
+
+        idx->size = sb.st_size;
+        idx->base = mmap(NULL, idx->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (idx->base == MAP_FAILED) {
+                idx->base = NULL;
+                goto fail;
+        }
+        close(fd);
+        fd = -1;
+
+        hdr = idx->hdr = idx->base;
+        if (memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) ||
+            hdr->version != INDEX_VERSION ||
+            hdr->records > idx->size / sizeof(struct index_record) ||
+            hdr->keys > idx->size / sizeof(struct index_key) ||
+            hdr->strings > idx->size) {
+                errno = EINVAL;
+                goto fail;
+        }
+        need = sizeof(struct index_header) +
+                hdr->records * sizeof(struct index_record) +
+                hdr->keys * sizeof(struct index_key) + hdr->strings;
+        if (need != idx->size) {
+                errno = EINVAL;
+                goto fail;
+        }
+        if (hdr->input_size != (uint64_t) isb.st_size ||
+            hdr->input_mtime_sec != isb.st_mtim.tv_sec ||
+            hdr->input_mtime_nsec != isb.st_mtim.tv_nsec) {
+                errno = ESTALE;
+                goto fail;
+        }
+
+        idx->records = (const struct index_record *) (hdr + 1);
+        idx->keys = (const struct index_key *) (idx->records + hdr->records);
+        idx->strings = (const char *) (idx->keys + hdr->keys);
+
+        /* Every range must be inside the input or the index, as they are
+         * used without further checks */
+        if (index_check(idx) < 0) {
+                errno = EINVAL;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        err = errno;
+        if (fd >= 0)
+                close(fd);
+        index_close(idx);
+        errno = err;
+        return -1;
+}
+
+int index_record(const struct index *idx, uint64_t n, size_t *off,
+                 size_t *len)
+{
+        if (n >= idx->hdr->records)
+                return 0;
+
+        *off = idx->records[n].off;
+        *len = idx->records[n].len;
+        return 1;
+}
+
+int index_find(const struct index *idx, const char *value, size_t vlen,
+               size_t *off, size_t *len)
+{
+        const struct index_key *k;
+        uint64_t lo = 0, hi = idx->hdr->keys, mid;
+
+        /* The first key not below `value` */
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                k = &idx->keys[mid];
+                if (value_cmp(idx->strings + k->value, k->len, value,
+                              vlen) < 0)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        if (lo == idx->hdr->keys)
+                return 0;
+        k = &idx->keys[lo];
+        if (value_cmp(idx->strings + k->value, k->len, value, vlen))
+                return 0;
+
+        return index_record(idx, k->record, off, len);
+}
+
+void index_close(struct index *idx)
+{
+        if (idx->base != NULL)
+                munmap(idx->base, idx->size);
+        memset(idx, 0, sizeof(struct index));
+}
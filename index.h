@@ -0,0 +1,112 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * index - Sidecar index of the records of a large file.
+ *
+ * One pass over a file finds its records (or documents, see split.h) and
+ * writes where each one is to an index file, by number and, optionally, by
+ * the value of an attribute of the record's element. With the index a
+ * single record is converted from its own bytes without reading the rest
+ * of the file.
+ *
+ * The index is in the machine's byte order and is only good for the file
+ * as it was: its size and modification time are checked when it is opened.
+ */
+
+#ifndef XML2JSON_INDEX_H
+#define XML2JSON_INDEX_H
+
+#include "split.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct input;
+
+#define INDEX_MAGIC "X2JINDEX"
+#define INDEX_VERSION 1
+#define INDEX_KEY_MAX 64
+
+struct index_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t mode;                  /* enum split_mode */
+        uint64_t input_size;
+        int64_t input_mtime_sec;
+        int64_t input_mtime_nsec;
+        uint64_t records;
+        uint64_t keys;
+        uint64_t strings;               /* bytes of key values */
+        char key[INDEX_KEY_MAX];        /* attribute name, "" for none */
+};
+
+/* Followed by `records` of these, in file order */
+struct index_record {
+        uint64_t off;
+        uint64_t len;
+};
+
+/* then `keys` of these, sorted by value, and the values themselves */
+struct index_key {
+        uint64_t value;                 /* offset in the values */
+        uint64_t len;
+        uint64_t record;                /* index of the record */
+};
+
+struct index {
+        void *base;
+        size_t size;
+        const struct index_header *hdr;
+        const struct index_record *records;
+        const struct index_key *keys;
+        const char *strings;
+};
+
+/* index_build():
+ * Find every record of `in` as split into `mode` and write their byte
+ * ranges, and the values of their `key` attribute unless it is NULL, to
+ * `path`. The number of records goes to `*records`. Returns 0 on success,
+ * 1 if the input ends inside a record, which is left out along with the
+ * rest, and -1 with errno set on failure.
+ */
+int index_build(const char *path, struct input *in, enum split_mode mode,
+                const char *key, uint64_t *records);
+
+/* index_open():
+ * Map the index at `path` of the file `in`. Returns 0 on success, -1 with
+ * errno set on failure, ESTALE if the file changed since it was indexed
+ * and EINVAL if `path` is not an index, or any record or key in it is out
+ * of range. Checking them reads every record and key, but not the key
+ * values.
+ */
+int index_open(struct index *idx, const char *path, const struct input *in);
+
+/* index_record():
+ * The byte range of record `n`, counting from 0. Returns 1 if there is
+ * one, 0 otherwise.
+ */
+int index_record(const struct index *idx, uint64_t n, size_t *off,
+                 size_t *len);
+
+/* index_find():
+ * The byte range of the first record, in file order, whose key attribute
+ * is the `vlen` bytes at `value`, as written in the file. Returns 1 if
+ * there is one, 0 otherwise.
+ */
+int index_find(const struct index *idx, const char *value, size_t vlen,
+               size_t *off, size_t *len);
+
+/* index_close():
+ * Unmap the index.
+ */
+void index_close(struct index *idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_INDEX_H */
@@ -0,0 +1,209 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * input - Memory mapped input files and how they are paged in.
+ */
+
+#include "input.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Private functions */
+static size_t page_size(void)
+{
+        static size_t size;
+
+        if (!size)
+                size = sysconf(_SC_PAGESIZE);
+
+        return size;
+}
+
+/* Touch every page of the window [consumed, consumed + ahead) so the parser
+ * never stalls on a fault, then sleep until the parser moves on.
+ */
+static void *prefault_thread(void *arg)
+{
+        struct input *in = arg;
+        volatile const char *p = (volatile const char *) in->base;
+        size_t pg = page_size();
+        size_t pos = 0;
+
+        pthread_mutex_lock(&in->lock);
+        while (!in->stop && pos < in->size) {
+                size_t limit = in->consumed + in->ahead;
+
+                if (pos < in->consumed)
+                        pos = in->consumed & ~(pg - 1);
+                if (limit > in->size)
+                        limit = in->size;
+                if (pos >= limit) {
+                        pthread_cond_wait(&in->cond, &in->lock);
+                        continue;
+                }
+                pthread_mutex_unlock(&in->lock);
+
+                madvise(in->base + pos, limit - pos, MADV_WILLNEED);
+                for (; pos < limit; pos += pg)
+                        (void) p[pos];
+
+                pthread_mutex_lock(&in->lock);
+        }
+        pthread_mutex_unlock(&in->lock);
+
+        return NULL;
+}
+
+/* Public functions */
+int input_parse_flags(const char *spec, unsigned int *flags, size_t *ahead)
+{
+        char *s, *tok, *save = NULL;
+        int ret = 0;
+
+        s = xstrdup(spec);
+        for (tok = strtok_r(s, ",", &save); tok;
+             tok = strtok_r(NULL, ",", &save)) {
+                if (!strcmp(tok, "sequential")) {
+                        *flags |= INPUT_SEQUENTIAL;
+                } else if (!strcmp(tok, "hugepage")) {
+                        *flags |= INPUT_HUGEPAGE;
+                } else if (!strcmp(tok, "populate")) {
+                        *flags |= INPUT_POPULATE;
+                } else if (!strcmp(tok, "stream")) {
+                        *flags |= INPUT_STREAM;
+                } else if (!strcmp(tok, "prefault")) {
+                        *flags |= INPUT_PREFAULT;
+                } else if (!strncmp(tok, "prefault=", 9)) {
+                        unsigned long mb = strtoul(tok + 9, NULL, 10);
+                        if (!mb) {
+                                ret = -1;
+                                break;
+                        }
+                        *flags |= INPUT_PREFAULT;
+                        *ahead = mb * 1024 * 1024;
+                } else {
+                        ret = -1;
+                        break;
+                }
+        }
+        xfree(s);
+
+        return ret;
+}
+
+int input_open(struct input *in, const char *path, unsigned int flags,
+               size_t ahead)
+{
+        struct stat sb;
+        int mflags = MAP_SHARED;
+        int err;
+
+        memset(in, 0, sizeof(struct input));
+        in->flags = flags;
+        in->ahead = ahead ? ahead : INPUT_PREFAULT_AHEAD;
+
+        if ((in->fd = open(path, O_RDONLY)) < 0)
+                return -1;
+
+        if (fstat(in->fd, &sb) < 0)
+                goto fail;
+
+        /* Nothing to map, nor to fault in */
+        in->size = sb.st_size;
+        if (!in->size) {
+                in->flags &= ~INPUT_PREFAULT;
+                return 0;
+        }
+
+#ifdef MAP_POPULATE
+        if (flags & INPUT_POPULATE)
+                mflags |= MAP_POPULATE;
+#endif
+
+        in->base = mmap(NULL, in->size, PROT_READ, mflags, in->fd, 0);
+        if (in->base == (void *) MAP_FAILED) {
+                in->base = NULL;
+                goto fail;
+        }
+
+        if (flags & INPUT_SEQUENTIAL)
+                madvise(in->base, in->size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        if (flags & INPUT_HUGEPAGE)
+                madvise(in->base, in->size, MADV_HUGEPAGE);
+#endif
+
+        if (flags & INPUT_PREFAULT) {
+                pthread_mutex_init(&in->lock, NULL);
+                pthread_cond_init(&in->cond, NULL);
+                if (pthread_create(&in->thread, NULL, prefault_thread,
+                                   in) != 0) {
+                        pthread_mutex_destroy(&in->lock);
+                        pthread_cond_destroy(&in->cond);
+                        in->flags &= ~INPUT_PREFAULT;
+                }
+        }
+
+        return 0;
+
+fail:
+        err = errno;
+        close(in->fd);
+        in->fd = -1;
+        errno = err;
+        return -1;
+}
+
+void input_consumed(struct input *in, size_t offset)
+{
+        if (offset > in->size)
+                offset = in->size;
+
+        if (in->flags & INPUT_PREFAULT) {
+                pthread_mutex_lock(&in->lock);
+                in->consumed = offset;
+                pthread_cond_signal(&in->cond);
+                pthread_mutex_unlock(&in->lock);
+        } else {
+                in->consumed = offset;
+        }
+
+        if (in->flags & INPUT_STREAM) {
+                size_t drop = offset & ~(page_size() - 1);
+
+                if (drop > in->released) {
+                        madvise(in->base + in->released,
+                                drop - in->released, MADV_DONTNEED);
+                        in->released = drop;
+                }
+        }
+}
+
+void input_close(struct input *in)
+{
+        if (in->flags & INPUT_PREFAULT) {
+                pthread_mutex_lock(&in->lock);
+                in->stop = 1;
+                pthread_cond_signal(&in->cond);
+                pthread_mutex_unlock(&in->lock);
+
+                pthread_join(in->thread, NULL);
+                pthread_mutex_destroy(&in->lock);
+                pthread_cond_destroy(&in->cond);
+                in->flags &= ~INPUT_PREFAULT;
+        }
+
+        if (in->base)
+                munmap(in->base, in->size);
+        if (in->fd >= 0)
+                close(in->fd);
+
+        in->base = NULL;
+        in->fd = -1;
+        in->size = 0;
+}
@@ -0,0 +1,73 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * input - Memory mapped input files and how they are paged in.
+ */
+
+#ifndef XML2JSON_INPUT_H
+#define XML2JSON_INPUT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INPUT_SEQUENTIAL (1 << 0) /* madvise(MADV_SEQUENTIAL) */
+#define INPUT_HUGEPAGE   (1 << 1) /* madvise(MADV_HUGEPAGE), best effort */
+#define INPUT_POPULATE   (1 << 2) /* mmap(MAP_POPULATE) */
+#define INPUT_PREFAULT   (1 << 3) /* a thread faults pages in ahead */
+#define INPUT_STREAM     (1 << 4) /* consumed pages are dropped */
+
+/* Default distance the prefault thread stays ahead of the parser */
+#define INPUT_PREFAULT_AHEAD (64 * 1024 * 1024)
+
+struct input {
+        int fd;
+        char *base;
+        size_t size;
+        unsigned int flags;
+
+        size_t ahead;             /* prefault window */
+        size_t consumed;          /* parser position */
+        size_t released;          /* dropped with MADV_DONTNEED up to here */
+
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        int stop;
+};
+
+/* input_parse_flags():
+ * Parse a comma separated list of strategies: sequential, hugepage,
+ * populate, prefault[=MB] and stream. Returns 0 on success, -1 on an
+ * unknown strategy.
+ */
+int input_parse_flags(const char *spec, unsigned int *flags, size_t *ahead);
+
+/* input_open():
+ * mmap() `path` according to `flags`. `ahead` is only used with
+ * INPUT_PREFAULT, 0 means INPUT_PREFAULT_AHEAD. Returns 0 on success, -1
+ * with errno set on failure.
+ */
+int input_open(struct input *in, const char *path, unsigned int flags,
+               size_t ahead);
+
+/* input_consumed():
+ * Tell the input that the parser is done with everything before `offset`.
+ * Moves the prefault window and, with INPUT_STREAM, drops the pages behind
+ * it so the resident set stays flat.
+ */
+void input_consumed(struct input *in, size_t offset);
+
+/* input_close():
+ * Stop the prefault thread and unmap the file.
+ */
+void input_close(struct input *in);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_INPUT_H */
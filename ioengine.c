@@ -0,0 +1,798 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * ioengine - Asynchronous whole-file reads and writes for batch mode.
+ *
+ * Two engines are available:
+ *  - uring:   a single io_uring carries the open/statx/read/write/close of
+ *             every file, small reads land in registered buffers.
+ *  - threads: a small pool of threads doing the same with blocking calls,
+ *             used where io_uring is missing or not permitted.
+ */
+
+#include "ioengine.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef LINUX
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#define IO_THREADS_MAX   8
+
+/* Reads up to this size go to a registered buffer */
+#define IO_FIXED_BUFSZ   (128 * 1024)
+
+/*
+ * Request queues
+ */
+struct io_queue {
+        struct io_request *head;
+        struct io_request *tail;
+};
+
+static void io_queue_push(struct io_queue *q, struct io_request *req)
+{
+        req->next = NULL;
+        if (q->tail)
+                q->tail->next = req;
+        else
+                q->head = req;
+        q->tail = req;
+}
+
+static struct io_request *io_queue_pop(struct io_queue *q)
+{
+        struct io_request *req = q->head;
+
+        if (req) {
+                q->head = req->next;
+                if (!q->head)
+                        q->tail = NULL;
+                req->next = NULL;
+        }
+
+        return req;
+}
+
+/*
+ * Thread pool engine
+ */
+struct io_threads {
+        pthread_mutex_t lock;
+        pthread_cond_t work_cond;
+        pthread_cond_t done_cond;
+        struct io_queue work;
+        struct io_queue done;
+        int woken;
+        int stop;
+        unsigned int nthreads;
+        pthread_t threads[IO_THREADS_MAX];
+};
+
+static void read_file_sync(struct io_request *req)
+{
+        struct stat sb;
+        ssize_t n;
+
+        if ((req->fd = open(req->path, O_RDONLY)) < 0) {
+                req->error = errno;
+                return;
+        }
+
+        if (fstat(req->fd, &sb) < 0) {
+                req->error = errno;
+                goto done;
+        }
+
+        req->buf = xmalloc(sb.st_size);
+        req->len = sb.st_size;
+        for (req->done = 0; req->done < req->len; req->done += n) {
+                n = read(req->fd, req->buf + req->done, req->len - req->done);
+                if (n < 0 && errno == EINTR) {
+                        n = 0;
+                        continue;
+                }
+                if (n < 0) {
+                        req->error = errno;
+                        goto done;
+                }
+                if (n == 0) {   /* file shrank under us */
+                        req->len = req->done;
+                        break;
+                }
+        }
+
+done:
+        close(req->fd);
+        req->fd = -1;
+}
+
+static void write_file_sync(struct io_request *req)
+{
+        ssize_t n;
+
+        if ((req->fd = open(req->path, O_WRONLY | O_CREAT | O_TRUNC,
+                            0644)) < 0) {
+                req->error = errno;
+                return;
+        }
+
+        for (req->done = 0; req->done < req->len; req->done += n) {
+                n = write(req->fd, req->buf + req->done, req->len - req->done);
+                if (n < 0 && errno == EINTR) {
+                        n = 0;
+                        continue;
+                }
+                if (n < 0) {
+                        req->error = errno;
+                        break;
+                }
+        }
+
+        if (close(req->fd) < 0 && !req->error)
+                req->error = errno;
+        req->fd = -1;
+}
+
+static void *threads_engine_worker(void *arg)
+{
+        struct io_threads *t = arg;
+        struct io_request *req;
+
+        pthread_mutex_lock(&t->lock);
+        for (;;) {
+                while (!t->work.head && !t->stop)
+                        pthread_cond_wait(&t->work_cond, &t->lock);
+                if (t->stop)
+                        break;
+
+                req = io_queue_pop(&t->work);
+                pthread_mutex_unlock(&t->lock);
+
+                if (req->op == IO_OP_READ)
+                        read_file_sync(req);
+                else
+                        write_file_sync(req);
+
+                pthread_mutex_lock(&t->lock);
+                io_queue_push(&t->done, req);
+                pthread_cond_signal(&t->done_cond);
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        return NULL;
+}
+
+static int threads_engine_init(struct io_engine *io, unsigned int depth)
+{
+        struct io_threads *t;
+        unsigned int i;
+
+        t = xcalloc(1, sizeof(struct io_threads));
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->work_cond, NULL);
+        pthread_cond_init(&t->done_cond, NULL);
+
+        t->nthreads = depth < IO_THREADS_MAX ? depth : IO_THREADS_MAX;
+        if (!t->nthreads)
+                t->nthreads = 1;
+
+        for (i = 0; i < t->nthreads; i++) {
+                if (pthread_create(&t->threads[i], NULL,
+                                   threads_engine_worker, t) != 0) {
+                        perror("pthread_create: ");
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        io->priv = t;
+        return 0;
+}
+
+static void threads_engine_submit(struct io_engine *io, struct io_request *req)
+{
+        struct io_threads *t = io->priv;
+
+        req->error = 0;
+        req->fd = -1;
+
+        pthread_mutex_lock(&t->lock);
+        io_queue_push(&t->work, req);
+        pthread_cond_signal(&t->work_cond);
+        pthread_mutex_unlock(&t->lock);
+}
+
+static struct io_request *threads_engine_wait(struct io_engine *io)
+{
+        struct io_threads *t = io->priv;
+        struct io_request *req;
+
+        pthread_mutex_lock(&t->lock);
+        while (!t->done.head && !t->woken)
+                pthread_cond_wait(&t->done_cond, &t->lock);
+
+        req = io_queue_pop(&t->done);
+        if (!req)
+                t->woken = 0;
+        pthread_mutex_unlock(&t->lock);
+
+        return req;
+}
+
+static void threads_engine_wake(struct io_engine *io)
+{
+        struct io_threads *t = io->priv;
+
+        pthread_mutex_lock(&t->lock);
+        t->woken = 1;
+        pthread_cond_signal(&t->done_cond);
+        pthread_mutex_unlock(&t->lock);
+}
+
+static void threads_engine_release(struct io_engine *io, struct io_request *req)
+{
+        xfree(req->buf);
+        req->len = 0;
+}
+
+static void threads_engine_free(struct io_engine *io)
+{
+        struct io_threads *t = io->priv;
+        unsigned int i;
+
+        pthread_mutex_lock(&t->lock);
+        t->stop = 1;
+        pthread_cond_broadcast(&t->work_cond);
+        pthread_mutex_unlock(&t->lock);
+
+        for (i = 0; i < t->nthreads; i++)
+                pthread_join(t->threads[i], NULL);
+
+        pthread_mutex_destroy(&t->lock);
+        pthread_cond_destroy(&t->work_cond);
+        pthread_cond_destroy(&t->done_cond);
+        xfree(t);
+        io->priv = NULL;
+}
+
+static const struct io_engine_ops threads_engine_ops = {
+        .name = "threads",
+        .init = threads_engine_init,
+        .submit = threads_engine_submit,
+        .wait = threads_engine_wait,
+        .wake = threads_engine_wake,
+        .release = threads_engine_release,
+        .free = threads_engine_free,
+};
+
+/*
+ * io_uring engine
+ */
+#ifdef LINUX
+enum uring_stage {
+        STAGE_OPEN,
+        STAGE_STAT,
+        STAGE_RW,
+        STAGE_CLOSE,
+};
+
+struct uring {
+        int fd;
+        unsigned int *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+        unsigned int *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_sqe *sqes;
+        struct io_uring_cqe *cqes;
+        unsigned int to_submit;
+
+        void *sq_ring, *cq_ring;
+        size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+
+        /* wake-ups arrive as reads completing on an eventfd */
+        int evfd;
+        uint64_t evbuf;
+
+        /* registered buffers */
+        char *bufs;
+        unsigned int nbufs;
+        int *freebufs;
+        unsigned int nfree;
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+        return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit,
+                       unsigned int min_complete, unsigned int flags)
+{
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit,
+                             min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg,
+                          unsigned int nr_args)
+{
+        return (int) syscall(__NR_io_uring_register, fd, opcode, arg,
+                             nr_args);
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *u)
+{
+        unsigned int tail = *u->sq_tail;
+        unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        struct io_uring_sqe *sqe;
+
+        while (tail - head >= *u->sq_entries) {
+                if (uring_enter(u->fd, u->to_submit, 0, 0) < 0 &&
+                    errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        perror("io_uring_enter: ");
+                        exit(EXIT_FAILURE);
+                }
+                u->to_submit = 0;
+                head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        }
+
+        sqe = &u->sqes[tail & *u->sq_mask];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+        return sqe;
+}
+
+static void uring_queue_sqe(struct uring *u, struct io_uring_sqe *sqe)
+{
+        unsigned int tail = *u->sq_tail;
+        unsigned int idx = tail & *u->sq_mask;
+
+        u->sq_array[idx] = sqe - u->sqes;
+        __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        u->to_submit++;
+}
+
+static void uring_arm_eventfd(struct uring *u)
+{
+        struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = u->evfd;
+        sqe->addr = (uintptr_t) &u->evbuf;
+        sqe->len = sizeof(u->evbuf);
+        sqe->user_data = 0;
+        uring_queue_sqe(u, sqe);
+}
+
+static void uring_prep_close(struct uring *u, struct io_request *req)
+{
+        struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = req->fd;
+        sqe->user_data = (uintptr_t) req;
+        uring_queue_sqe(u, sqe);
+
+        req->stage = STAGE_CLOSE;
+}
+
+static void uring_prep_rw(struct uring *u, struct io_request *req)
+{
+        struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+        if (req->op == IO_OP_READ) {
+                if (req->bufidx >= 0) {
+                        sqe->opcode = IORING_OP_READ_FIXED;
+                        sqe->buf_index = req->bufidx;
+                } else {
+                        sqe->opcode = IORING_OP_READ;
+                }
+        } else {
+                sqe->opcode = IORING_OP_WRITE;
+        }
+        sqe->fd = req->fd;
+        sqe->addr = (uintptr_t) (req->buf + req->done);
+        sqe->len = req->len - req->done;
+        sqe->off = req->done;
+        sqe->user_data = (uintptr_t) req;
+        uring_queue_sqe(u, sqe);
+
+        req->stage = STAGE_RW;
+}
+
+/* Move `req` to its next stage given the result of the previous one.
+ * Returns 1 once the request is complete.
+ */
+static int uring_advance(struct uring *u, struct io_request *req, int res)
+{
+        struct io_uring_sqe *sqe;
+        struct statx *stx = req->priv;
+
+        switch (req->stage) {
+        case STAGE_OPEN:
+                if (res < 0) {
+                        req->error = -res;
+                        return 1;
+                }
+                req->fd = res;
+                if (req->op == IO_OP_WRITE) {
+                        if (req->len)
+                                uring_prep_rw(u, req);
+                        else
+                                uring_prep_close(u, req);
+                        return 0;
+                }
+
+                sqe = uring_get_sqe(u);
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = req->fd;
+                sqe->addr = (uintptr_t) "";
+                sqe->statx_flags = AT_EMPTY_PATH;
+                sqe->len = STATX_SIZE;
+                sqe->off = (uintptr_t) stx;
+                sqe->user_data = (uintptr_t) req;
+                uring_queue_sqe(u, sqe);
+                req->stage = STAGE_STAT;
+                return 0;
+        case STAGE_STAT:
+                if (res < 0) {
+                        req->error = -res;
+                        uring_prep_close(u, req);
+                        return 0;
+                }
+                req->len = stx->stx_size;
+                if (req->len <= IO_FIXED_BUFSZ && u->nfree) {
+                        req->bufidx = u->freebufs[--u->nfree];
+                        req->buf = u->bufs + (size_t) req->bufidx * IO_FIXED_BUFSZ;
+                } else {
+                        req->buf = xmalloc(req->len);
+                }
+                if (req->len)
+                        uring_prep_rw(u, req);
+                else
+                        uring_prep_close(u, req);
+                return 0;
+        case STAGE_RW:
+                if (res < 0) {
+                        if (res == -EINTR || res == -EAGAIN) {
+                                uring_prep_rw(u, req);
+                                return 0;
+                        }
+                        req->error = -res;
+                        uring_prep_close(u, req);
+                        return 0;
+                }
+                if (res == 0 && req->op == IO_OP_READ) {
+                        req->len = req->done;   /* file shrank under us */
+                } else if (res == 0) {
+                        req->error = EIO;
+                        uring_prep_close(u, req);
+                        return 0;
+                }
+                req->done += res;
+                if (req->done < req->len)
+                        uring_prep_rw(u, req);
+                else
+                        uring_prep_close(u, req);
+                return 0;
+        case STAGE_CLOSE:
+        default:
+                if (res < 0 && !req->error)
+                        req->error = -res;
+                req->fd = -1;
+                return 1;
+        }
+}
+
+static void uring_free_rings(struct uring *u)
+{
+        if (u->sqes)
+                munmap(u->sqes, u->sqes_sz);
+        if (u->cq_ring && u->cq_ring != u->sq_ring)
+                munmap(u->cq_ring, u->cq_ring_sz);
+        if (u->sq_ring)
+                munmap(u->sq_ring, u->sq_ring_sz);
+        if (u->fd >= 0)
+                close(u->fd);
+        if (u->evfd >= 0)
+                close(u->evfd);
+        if (u->bufs)
+                munmap(u->bufs, (size_t) u->nbufs * IO_FIXED_BUFSZ);
+        xfree(u->freebufs);
+        xfree(u);
+}
+
+/* Whether the kernel knows opcode `op`, from an IORING_REGISTER_PROBE */
+static int uring_op_supported(const struct io_uring_probe *probe, int op)
+{
+        return op <= probe->last_op &&
+                (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+/* Every opcode the engine needs, and whether READ_FIXED is there too.
+ * Kernels that cannot tell, older than 5.6, have no OPENAT or STATX
+ * either. Returns -1 if anything needed is missing. */
+static int uring_probe(struct uring *u, int *read_fixed)
+{
+        static const int needed[] = {
+                IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                IORING_OP_WRITE, IORING_OP_CLOSE,
+        };
+        struct io_uring_probe *probe;
+        size_t i;
+        int ret = 0;
+
+        probe = xcalloc(1, sizeof(struct io_uring_probe) +
+                        256 * sizeof(struct io_uring_probe_op));
+        if (uring_register(u->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+                xfree(probe);
+                return -1;
+        }
+
+        for (i = 0; i < sizeof(needed) / sizeof(needed[0]); i++)
+                if (!uring_op_supported(probe, needed[i]))
+                        ret = -1;
+        *read_fixed = uring_op_supported(probe, IORING_OP_READ_FIXED);
+        xfree(probe);
+
+        return ret;
+}
+
+static int uring_engine_init(struct io_engine *io, unsigned int depth)
+{
+        struct io_uring_params p;
+        struct uring *u;
+        struct iovec *iov;
+        unsigned int i;
+        int read_fixed;
+
+        u = xcalloc(1, sizeof(struct uring));
+        u->evfd = -1;
+
+        /* One sqe per request in flight, plus the eventfd read */
+        memset(&p, 0, sizeof(p));
+        if ((u->fd = uring_setup(depth + 1, &p)) < 0) {
+                uring_free_rings(u);
+                return -1;
+        }
+
+        /* Without these the threads engine is used instead */
+        if (uring_probe(u, &read_fixed) < 0) {
+                uring_free_rings(u);
+                return -1;
+        }
+
+        u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+        u->cq_ring_sz = p.cq_off.cqes +
+                p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                if (u->cq_ring_sz > u->sq_ring_sz)
+                        u->sq_ring_sz = u->cq_ring_sz;
+                u->cq_ring_sz = u->sq_ring_sz;
+        }
+
+        u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd,
+                          IORING_OFF_SQ_RING);
+        if (u->sq_ring == MAP_FAILED) {
+                u->sq_ring = NULL;
+                uring_free_rings(u);
+                return -1;
+        }
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+                u->cq_ring = u->sq_ring;
+        else
+                u->cq_ring = mmap(NULL, u->cq_ring_sz,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, u->fd,
+                                  IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+                u->cq_ring = NULL;
+                uring_free_rings(u);
+                return -1;
+        }
+
+        u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+        if (u->sqes == MAP_FAILED) {
+                u->sqes = NULL;
+                uring_free_rings(u);
+                return -1;
+        }
+
+        u->sq_head = (unsigned int *) ((char *) u->sq_ring + p.sq_off.head);
+        u->sq_tail = (unsigned int *) ((char *) u->sq_ring + p.sq_off.tail);
+        u->sq_mask = (unsigned int *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+        u->sq_entries = (unsigned int *) ((char *) u->sq_ring +
+                                          p.sq_off.ring_entries);
+        u->sq_array = (unsigned int *) ((char *) u->sq_ring + p.sq_off.array);
+        u->cq_head = (unsigned int *) ((char *) u->cq_ring + p.cq_off.head);
+        u->cq_tail = (unsigned int *) ((char *) u->cq_ring + p.cq_off.tail);
+        u->cq_mask = (unsigned int *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+        u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring +
+                                           p.cq_off.cqes);
+
+        if ((u->evfd = eventfd(0, EFD_CLOEXEC)) < 0) {
+                uring_free_rings(u);
+                return -1;
+        }
+
+        /* Registered buffers are an optimisation only: carry on without
+         * them if READ_FIXED is missing or RLIMIT_MEMLOCK says no. */
+        if (read_fixed) {
+                u->bufs = mmap(NULL, (size_t) depth * IO_FIXED_BUFSZ,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (u->bufs == MAP_FAILED)
+                        u->bufs = NULL;
+                else
+                        u->nbufs = depth;
+        }
+
+        if (u->nbufs) {
+                ALLOC_ARRAY(iov, u->nbufs);
+                ALLOC_ARRAY(u->freebufs, u->nbufs);
+                for (i = 0; i < u->nbufs; i++) {
+                        iov[i].iov_base = u->bufs + (size_t) i * IO_FIXED_BUFSZ;
+                        iov[i].iov_len = IO_FIXED_BUFSZ;
+                        u->freebufs[i] = i;
+                }
+                if (uring_register(u->fd, IORING_REGISTER_BUFFERS,
+                                   iov, u->nbufs) == 0)
+                        u->nfree = u->nbufs;
+                xfree(iov);
+        }
+
+        uring_arm_eventfd(u);
+
+        io->priv = u;
+        return 0;
+}
+
+static void uring_engine_submit(struct io_engine *io, struct io_request *req)
+{
+        struct uring *u = io->priv;
+        struct io_uring_sqe *sqe;
+
+        req->error = 0;
+        req->fd = -1;
+        req->done = 0;
+        req->bufidx = -1;
+        req->priv = NULL;
+        if (req->op == IO_OP_READ) {
+                req->buf = NULL;
+                req->len = 0;
+                req->priv = xmalloc(sizeof(struct statx));
+        }
+
+        sqe = uring_get_sqe(u);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t) req->path;
+        sqe->open_flags = req->op == IO_OP_READ ?
+                O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC;
+        sqe->len = 0644;
+        sqe->user_data = (uintptr_t) req;
+        uring_queue_sqe(u, sqe);
+
+        req->stage = STAGE_OPEN;
+}
+
+static struct io_request *uring_engine_wait(struct io_engine *io)
+{
+        struct uring *u = io->priv;
+        int ret;
+
+        for (;;) {
+                unsigned int head = *u->cq_head;
+                unsigned int tail = __atomic_load_n(u->cq_tail,
+                                                    __ATOMIC_ACQUIRE);
+
+                while (head != tail) {
+                        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+                        struct io_request *req;
+                        int res = cqe->res;
+
+                        req = (struct io_request *) (uintptr_t) cqe->user_data;
+                        head++;
+                        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+                        if (!req) {
+                                uring_arm_eventfd(u);
+                                return NULL;
+                        }
+
+                        if (uring_advance(u, req, res)) {
+                                xfree(req->priv);
+                                return req;
+                        }
+                }
+
+                ret = uring_enter(u->fd, u->to_submit, 1,
+                                  IORING_ENTER_GETEVENTS);
+                if (ret < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("io_uring_enter: ");
+                        exit(EXIT_FAILURE);
+                }
+                u->to_submit -= (unsigned int) ret < u->to_submit ?
+                        (unsigned int) ret : u->to_submit;
+        }
+}
+
+static void uring_engine_wake(struct io_engine *io)
+{
+        struct uring *u = io->priv;
+        uint64_t one = 1;
+
+        while (write(u->evfd, &one, sizeof(one)) < 0 && errno == EINTR)
+                ;
+}
+
+static void uring_engine_release(struct io_engine *io, struct io_request *req)
+{
+        struct uring *u = io->priv;
+
+        if (req->bufidx >= 0) {
+                u->freebufs[u->nfree++] = req->bufidx;
+                req->bufidx = -1;
+                req->buf = NULL;
+        } else {
+                xfree(req->buf);
+        }
+        req->len = 0;
+}
+
+static void uring_engine_free(struct io_engine *io)
+{
+        uring_free_rings(io->priv);
+        io->priv = NULL;
+}
+
+static const struct io_engine_ops uring_engine_ops = {
+        .name = "uring",
+        .init = uring_engine_init,
+        .submit = uring_engine_submit,
+        .wait = uring_engine_wait,
+        .wake = uring_engine_wake,
+        .release = uring_engine_release,
+        .free = uring_engine_free,
+};
+#endif  /* LINUX */
+
+/* Public functions */
+int io_engine_init(struct io_engine *io, const char *name, unsigned int depth)
+{
+        static const struct io_engine_ops *engines[] = {
+#ifdef LINUX
+                &uring_engine_ops,
+#endif
+                &threads_engine_ops,
+                NULL
+        };
+        unsigned int i;
+
+        for (i = 0; engines[i]; i++) {
+                if (name && strcmp(name, engines[i]->name))
+                        continue;
+
+                io->ops = engines[i];
+                if (engines[i]->init(io, depth) == 0)
+                        return 0;
+                if (name)
+                        break;
+        }
+
+        io->ops = NULL;
+        return -1;
+}
@@ -0,0 +1,117 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * ioengine - Asynchronous whole-file reads and writes for batch mode.
+ */
+
+#ifndef XML2JSON_IOENGINE_H
+#define XML2JSON_IOENGINE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum io_op {
+        IO_OP_READ,             /* read all of `path` into `buf` */
+        IO_OP_WRITE,            /* create `path` holding `len` bytes of `buf` */
+};
+
+struct io_request {
+        enum io_op op;
+        const char *path;
+        char *buf;
+        size_t len;
+        int error;              /* errno of the failed step, 0 on success */
+        void *data;             /* owned by the caller */
+
+        /* private to the engine */
+        int fd;
+        int stage;
+        size_t done;
+        int bufidx;
+        void *priv;
+        struct io_request *next;
+};
+
+struct io_engine;
+
+struct io_engine_ops {
+        const char *name;
+        int (*init)(struct io_engine *io, unsigned int depth);
+        void (*submit)(struct io_engine *io, struct io_request *req);
+        struct io_request *(*wait)(struct io_engine *io);
+        void (*wake)(struct io_engine *io);
+        void (*release)(struct io_engine *io, struct io_request *req);
+        void (*free)(struct io_engine *io);
+};
+
+/* Apart from io_engine_wake(), an engine must only be used from the thread
+ * that set it up.
+ */
+struct io_engine {
+        const struct io_engine_ops *ops;
+        void *priv;
+};
+
+/* io_engine_init():
+ * Set up the engine called `name` ("uring" or "threads"), or the best one
+ * available if `name` is NULL. `depth` is the maximum number of requests
+ * the caller keeps in flight. Returns 0 on success, -1 if no engine with
+ * that name could be set up.
+ */
+int io_engine_init(struct io_engine *io, const char *name, unsigned int depth);
+
+/* io_engine_submit():
+ * Queue a request. For reads the engine allocates `buf` and sets `len`,
+ * hand the buffer back with io_engine_release() once done with it.
+ */
+static inline void io_engine_submit(struct io_engine *io,
+                                    struct io_request *req)
+{
+        io->ops->submit(io, req);
+}
+
+/* io_engine_wait():
+ * Block until a request completes and return it, or return NULL if
+ * io_engine_wake() was called in the meantime.
+ */
+static inline struct io_request *io_engine_wait(struct io_engine *io)
+{
+        return io->ops->wait(io);
+}
+
+/* io_engine_wake():
+ * Make a blocked (or the next) io_engine_wait() return NULL. Can be called
+ * from any thread.
+ */
+static inline void io_engine_wake(struct io_engine *io)
+{
+        io->ops->wake(io);
+}
+
+/* io_engine_release():
+ * Give back the buffer of a completed read.
+ */
+static inline void io_engine_release(struct io_engine *io,
+                                     struct io_request *req)
+{
+        io->ops->release(io, req);
+}
+
+static inline void io_engine_free(struct io_engine *io)
+{
+        io->ops->free(io);
+}
+
+static inline const char *io_engine_name(const struct io_engine *io)
+{
+        return io->ops->name;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_IOENGINE_H */
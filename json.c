@@ -5,7 +5,7 @@
 
 #include "json.h"
 
-#include "cstring.h"
+#include "output.h"
 #include "util.h"
 
 #include <assert.h>
@@ -13,86 +13,92 @@
 #include <stdio.h>
 #include <string.h>
 
+/* Freed objects are kept per thread for the next document, linked through
+ * `next`, so small documents build their tree without calling malloc */
+#define JSON_POOL_MAX 4096
+
+static __thread JsonObject *json_pool;
+static __thread unsigned int json_pool_len;
 
 /*
  * Private Functions
  */
-static void parse_json_object(JsonObject *object, cstring *str);
+static void parse_json_object(JsonObject *object, struct output *out);
 
 static bool is_json_type_valid(unsigned int type)
 {
         return (type <= JSON_OBJECT);
 }
 
-static void parse_string_object(const char *s, cstring *str)
+static void parse_string_object(const char *s, struct output *out)
 {
         /* TODO: Make this function utf-8 aware */
-        cstring_addch(str, '"');
-        cstring_addstr(str, s);
-        cstring_addch(str, '"');
+        output_addch(out, '"');
+        output_addstr(out, s);
+        output_addch(out, '"');
 }
 
-static void parse_num_object(double num, cstring *str)
+static void parse_num_object(double num, struct output *out)
 {
         char buf[64];
 
         sprintf(buf, "%.16g", num);
         /* TODO: Check if `buf` has a valid number */
-        cstring_addstr(str, buf);
+        output_addstr(out, buf);
 }
 
-static void parse_array_object(JsonObject *object, cstring *str)
+static void parse_array_object(JsonObject *object, struct output *out)
 {
         JsonObject *element;
 
-        cstring_addch(str, '[');
+        output_addch(out, '[');
         json_foreach(element, object) {
-                parse_json_object(element, str);
+                parse_json_object(element, out);
                 if (element->next != NULL)
-                        cstring_addch(str, ',');
+                        output_addch(out, ',');
         }
-        cstring_addch(str, ']');
+        output_addch(out, ']');
 }
 
-static void parse_object(JsonObject *object, cstring *str)
+static void parse_object(JsonObject *object, struct output *out)
 {
         JsonObject *member;
 
-        cstring_addch(str, '{');
+        output_addch(out, '{');
 
         json_foreach(member, object) {
-                parse_string_object(member->key, str);
-                cstring_addch(str, ':');
-                parse_json_object(member, str);
+                parse_string_object(member->key, out);
+                output_addch(out, ':');
+                parse_json_object(member, out);
                 if (member->next != NULL)
-                        cstring_addch(str, ',');
+                        output_addch(out, ',');
         }
 
-        cstring_addch(str, '}');
+        output_addch(out, '}');
 }
 
-static void parse_json_object(JsonObject *object, cstring *str)
+static void parse_json_object(JsonObject *object, struct output *out)
 {
         assert(is_json_type_valid(object->type));
 
         switch (object->type) {
         case JSON_NULL:
-                cstring_addstr(str, "null");
+                output_addstr(out, "null");
                 break;
         case JSON_BOOL:
-                cstring_addstr(str, object->bool_ ? "true" : "false");
+                output_addstr(out, object->bool_ ? "true" : "false");
                 break;
         case JSON_STRING:
-                parse_string_object(object->str_, str);
+                parse_string_object(object->str_, out);
                 break;
         case JSON_NUMBER:
-                parse_num_object(object->num_, str);
+                parse_num_object(object->num_, out);
                 break;
         case JSON_ARRAY:
-                parse_array_object(object, str);
+                parse_array_object(object, out);
                 break;
         case JSON_OBJECT:
-                parse_object(object, str);
+                parse_object(object, out);
                 break;
         default:
                 assert(false);
@@ -101,19 +107,27 @@ static void parse_json_object(JsonObject *object, cstring *str)
 
 static char *json_object_to_string(JsonObject *object)
 {
-        cstring jsonstr;
+        struct output jsonstr;
         size_t len = 0;
 
-        cstring_init(&jsonstr, 0);
+        output_init_mem(&jsonstr);
 
         parse_json_object(object, &jsonstr);
 
-        return cstring_detach(&jsonstr, &len);
+        return output_detach(&jsonstr, &len);
 }
 
 static JsonObject *json_obj_new(JsonType type)
 {
-        JsonObject *obj = (JsonObject *) xcalloc(1, sizeof(JsonObject));
+        JsonObject *obj = json_pool;
+
+        if (obj) {
+                json_pool = obj->next;
+                json_pool_len--;
+                memset(obj, 0, sizeof(JsonObject));
+        } else {
+                obj = (JsonObject *) xcalloc(1, sizeof(JsonObject));
+        }
 
         obj->type = type;
 
@@ -135,7 +149,7 @@ static void json_remove_from_parent(JsonObject *obj)
                 else
                         obj->children.tail = obj->prev;
 
-                free(obj->key);
+                xfree(obj->key);
 
                 obj->parent = NULL;
                 obj->prev = obj->next = NULL;
@@ -150,7 +164,7 @@ static void json_obj_free(JsonObject *obj)
 
                 switch(obj->type) {
                 case JSON_STRING:
-                        free(obj->str_);
+                        xfree(obj->str_);
                         break;
                 case JSON_ARRAY:
                 case JSON_OBJECT:
@@ -166,8 +180,13 @@ static void json_obj_free(JsonObject *obj)
                         break;
                 }
 
-                free(obj);
-                obj = NULL;
+                if (json_pool_len < JSON_POOL_MAX) {
+                        obj->next = json_pool;
+                        json_pool = obj;
+                        json_pool_len++;
+                } else {
+                        xfree(obj);
+                }
         }
 }
 
@@ -208,6 +227,11 @@ char *json_encode(JsonObject *obj)
         return json_object_to_string(obj);
 }
 
+void json_write(JsonObject *obj, struct output *out)
+{
+        parse_json_object(obj, out);
+}
+
 JsonObject *json_null_obj(void)
 {
         return json_obj_new(JSON_NULL);
@@ -288,6 +312,17 @@ void json_free(JsonObject *obj)
         json_obj_free(obj);
 }
 
+void json_pool_release(void)
+{
+        while (json_pool) {
+                JsonObject *obj = json_pool;
+
+                json_pool = obj->next;
+                xfree(obj);
+        }
+        json_pool_len = 0;
+}
+
 JsonObject *json_first_child(JsonObject *object)
 {
         if (object != NULL &&
@@ -42,7 +42,10 @@ struct _JsonObject {
         };
 };
 
+struct output;
+
 extern char *json_encode(JsonObject *obj);
+extern void json_write(JsonObject *obj, struct output *out);
 
 extern JsonObject *json_null_obj(void);
 extern JsonObject *json_bool_obj(bool b);
@@ -52,6 +55,9 @@ extern JsonObject *json_array_obj(void);
 extern JsonObject *json_new(void);
 extern void json_free(JsonObject *obj);
 
+/* Free the objects the calling thread keeps for reuse, before it exits */
+extern void json_pool_release(void);
+
 /* array handler */
 extern void json_append_to_array(JsonObject *array, JsonObject *element);
 extern void json_prepend_to_array(JsonObject *array, JsonObject *element);
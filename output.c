@@ -0,0 +1,281 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * output - Buffered output sink, either in memory or on a file descriptor.
+ */
+
+#include "output.h"
+#include "probes.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Private functions */
+static char *alloc_chunk(void)
+{
+        void *p;
+
+        p = mmap(NULL, OUTPUT_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+                fprintf(stderr, "Out of memory. mmap failed.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        return p;
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+        while (len) {
+                ssize_t n = write(fd, buf, len);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("write: ");
+                        exit(EXIT_FAILURE);
+                }
+                buf += n;
+                len -= n;
+        }
+}
+
+/* Make room for `len` more bytes in a mapped sink, doubling the file and
+ * mapping it again; the pages written so far stay where they are in the
+ * file, nothing is copied */
+static void grow_mapped(struct output *out, size_t len)
+{
+        size_t alloc = out->alloc;
+        void *p;
+
+        if (out->alloc - out->len >= len)
+                return;
+
+        while (alloc - out->len < len) {
+                if (unsigned_mult_overflows(alloc, 2))
+                        goto fail;
+                alloc *= 2;
+        }
+        if (ftruncate(out->fd, alloc) < 0)
+                goto fail;
+        p = mmap(NULL, alloc, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, 0);
+        if (p == MAP_FAILED)
+                goto fail;
+
+        munmap(out->buf, out->alloc);
+        out->buf = p;
+        out->alloc = alloc;
+        return;
+
+fail:
+        fprintf(stderr, "Not enough memory. Giving up!");
+        exit(EXIT_FAILURE);
+}
+
+/* Public functions */
+void output_init(struct output *out, int fd)
+{
+        struct stat sb;
+
+        memset(out, 0, sizeof(struct output));
+        out->fd = fd;
+        out->buf = alloc_chunk();
+        out->alloc = OUTPUT_CHUNK_SIZE;
+
+        if (fstat(fd, &sb) == 0) {
+                if (S_ISFIFO(sb.st_mode))
+                        out->flags |= OUTPUT_PIPE;
+                else if (S_ISREG(sb.st_mode))
+                        out->flags |= OUTPUT_REGULAR;
+        }
+}
+
+void output_init_mem(struct output *out)
+{
+        memset(out, 0, sizeof(struct output));
+        out->fd = -1;
+        out->flags = OUTPUT_MEMORY;
+}
+
+int output_init_mapped(struct output *out, int fd)
+{
+        void *p;
+
+        memset(out, 0, sizeof(struct output));
+        out->fd = fd;
+        out->flags = OUTPUT_MAPPED;
+
+        if (ftruncate(fd, OUTPUT_CHUNK_SIZE) < 0)
+                return -1;
+        p = mmap(NULL, OUTPUT_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+        if (p == MAP_FAILED)
+                return -1;
+
+        out->buf = p;
+        out->alloc = OUTPUT_CHUNK_SIZE;
+        return 0;
+}
+
+void output_flush(struct output *out)
+{
+        if ((out->flags & (OUTPUT_MEMORY | OUTPUT_MAPPED)) || !out->len)
+                return;
+
+        PROBE1(output__flush, out->len);
+
+        write_all(out->fd, out->buf, out->len);
+        out->bytes += out->len;
+        out->len = 0;
+}
+
+void output_release(struct output *out)
+{
+        if (out->flags & OUTPUT_MEMORY) {
+                xfree(out->buf);
+        } else if (out->flags & OUTPUT_MAPPED) {
+                /* What was never written goes, the file keeps the rest */
+                if (out->buf)
+                        munmap(out->buf, out->alloc);
+                if (ftruncate(out->fd, out->len) < 0) {
+                        perror("ftruncate: ");
+                        exit(EXIT_FAILURE);
+                }
+                out->bytes += out->len;
+        } else {
+                output_flush(out);
+                if (out->buf)
+                        munmap(out->buf, out->alloc);
+        }
+
+        out->buf = NULL;
+        out->len = out->alloc = 0;
+}
+
+char *output_detach(struct output *out, size_t *len)
+{
+        char *res;
+
+        output_grow(out, 1);
+        out->buf[out->len] = '\0';
+        res = out->buf;
+        if (len)
+                *len = out->len;
+
+        out->buf = NULL;
+        out->len = out->alloc = 0;
+
+        return res;
+}
+
+void output_grow(struct output *out, size_t len)
+{
+        if (out->flags & OUTPUT_MEMORY) {
+                if (unsigned_add_overflows(out->len, len)) {
+                        fprintf(stderr, "Not enough memory. Giving up!");
+                        exit(EXIT_FAILURE);
+                }
+                ALLOC_GROW(out->buf, out->len + len, out->alloc);
+                return;
+        }
+
+        if (out->flags & OUTPUT_MAPPED) {
+                grow_mapped(out, len);
+                return;
+        }
+
+        if (out->alloc - out->len < len)
+                output_flush(out);
+}
+
+void output_add(struct output *out, const void *data, size_t len)
+{
+        const char *p = data;
+
+        if (out->flags & (OUTPUT_MEMORY | OUTPUT_MAPPED)) {
+                output_grow(out, len);
+                memcpy(out->buf + out->len, p, len);
+                out->len += len;
+                return;
+        }
+
+        while (len) {
+                size_t n = out->alloc - out->len;
+
+                if (!n) {
+                        output_flush(out);
+                        n = out->alloc;
+                }
+                if (n > len)
+                        n = len;
+
+                memcpy(out->buf + out->len, p, n);
+                out->len += n;
+                p += n;
+                len -= n;
+        }
+}
+
+int output_copy_fd(struct output *out, int fd, off_t offset, size_t len)
+{
+        if (out->flags & (OUTPUT_MEMORY | OUTPUT_MAPPED)) {
+                output_grow(out, len);
+                while (len) {
+                        ssize_t n = pread(fd, out->buf + out->len, len, offset);
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n <= 0)
+                                return -1;
+                        out->len += n;
+                        offset += n;
+                        len -= n;
+                }
+                return 0;
+        }
+
+        output_flush(out);
+
+#ifdef LINUX
+        while (len && (out->flags & (OUTPUT_PIPE | OUTPUT_REGULAR))) {
+                ssize_t n;
+
+                if (out->flags & OUTPUT_PIPE)
+                        n = splice(fd, &offset, out->fd, NULL, len,
+                                   SPLICE_F_MOVE | SPLICE_F_MORE);
+                else
+                        n = copy_file_range(fd, &offset, out->fd, NULL,
+                                            len, 0);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EINVAL || errno == ENOSYS ||
+                            errno == EXDEV || errno == EOPNOTSUPP)
+                                break;  /* fall back to read/write */
+                        return -1;
+                }
+                if (n == 0)
+                        return -1;
+                out->bytes += n;
+                len -= n;
+        }
+#endif
+
+        while (len) {
+                size_t want = len < out->alloc ? len : out->alloc;
+                ssize_t n = pread(fd, out->buf, want, offset);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return -1;
+                write_all(out->fd, out->buf, n);
+                out->bytes += n;
+                offset += n;
+                len -= n;
+        }
+
+        return 0;
+}
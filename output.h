@@ -0,0 +1,109 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * output - Buffered output sink, either in memory or on a file descriptor.
+ */
+
+#ifndef XML2JSON_OUTPUT_H
+#define XML2JSON_OUTPUT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the page aligned buffers used by fd sinks */
+#define OUTPUT_CHUNK_SIZE (256 * 1024)
+
+#define OUTPUT_MEMORY    (1 << 0) /* buffer grows, nothing is written */
+#define OUTPUT_PIPE      (1 << 1) /* fd is a pipe */
+#define OUTPUT_REGULAR   (1 << 2) /* fd is a regular file */
+#define OUTPUT_MAPPED    (1 << 3) /* buffer is a shared mapping of fd */
+
+struct output {
+        int fd;
+        unsigned int flags;
+        char *buf;
+        size_t len;
+        size_t alloc;
+        uint64_t bytes;          /* bytes handed to `fd` so far */
+};
+
+/* output_init():
+ * Initialise an output sink writing to `fd`, with write().
+ */
+void output_init(struct output *out, int fd);
+
+/* output_init_mem():
+ * Initialise an in-memory output sink, use output_detach() to get the
+ * result.
+ */
+void output_init_mem(struct output *out);
+
+/* output_init_mapped():
+ * Initialise a sink whose buffer is a shared mapping of the file `fd`,
+ * such as a memfd, grown with ftruncate() as needed, so the output is
+ * never copied into the file. output_release() cuts the file to the output.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int output_init_mapped(struct output *out, int fd);
+
+/* output_flush():
+ * Write out everything buffered so far. No-op for in-memory sinks.
+ */
+void output_flush(struct output *out);
+
+/* output_release():
+ * Flush the sink and release its buffer. The fd is not closed.
+ */
+void output_release(struct output *out);
+
+/* output_detach():
+ * Return the NUL terminated contents of an in-memory sink. The caller
+ * needs to free() the string returned.
+ */
+char *output_detach(struct output *out, size_t *len);
+
+/* output_grow():
+ * Make room for at least `len` more bytes, flushing fd sinks when needed.
+ */
+void output_grow(struct output *out, size_t len);
+
+/* output_add():
+ * Add data of a given length to the sink.
+ */
+void output_add(struct output *out, const void *data, size_t len);
+
+/* output_copy_fd():
+ * Copy `len` bytes at `offset` of `fd` to the sink without passing them
+ * through user space where the kernel allows it (splice() to pipes,
+ * copy_file_range() to files). Returns 0 on success, -1 on error.
+ */
+int output_copy_fd(struct output *out, int fd, off_t offset, size_t len);
+
+/* output_addch():
+ * Add a single character to the sink.
+ */
+static inline void output_addch(struct output *out, int ch)
+{
+        if (out->len == out->alloc)
+                output_grow(out, 1);
+        out->buf[out->len++] = ch;
+}
+
+/* output_addstr():
+ * Add a NULL terminated string to the sink.
+ */
+static inline void output_addstr(struct output *out, const char *str)
+{
+        output_add(out, str, strlen(str));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_OUTPUT_H */
@@ -0,0 +1,155 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * perf - Hardware performance counters of the calling thread.
+ *
+ * Each thread opens its own perf_event_open() group on first use, counting
+ * user space only so that perf_event_paranoid <= 2 is enough.
+ */
+
+#include "perf.h"
+#include "util.h"
+
+#include <unistd.h>
+
+#ifdef LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+const char *perf_counter_names[PERF_COUNTERS] = {
+        "cycles",
+        "instructions",
+        "l1d_misses",
+        "llc_misses",
+        "branch_misses",
+        "page_faults",
+};
+
+static unsigned int perf_mask;
+
+#ifdef LINUX
+#define HW_CACHE(cache, op, result) \
+        ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+        uint32_t type;
+        uint64_t config;
+} perf_events[PERF_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_L1D,
+                                       PERF_COUNT_HW_CACHE_OP_READ,
+                                       PERF_COUNT_HW_CACHE_RESULT_MISS) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static __thread int perf_state;         /* 0 unopened, 1 open, -1 failed */
+static __thread int perf_leader = -1;
+static __thread int perf_fds[PERF_COUNTERS];
+
+static int perf_open(enum perf_counter c, int group)
+{
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[c].type;
+        attr.config = perf_events[c].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void perf_thread_open(void)
+{
+        int c;
+
+        perf_state = -1;
+        for (c = 0; c < PERF_COUNTERS; c++) {
+                perf_fds[c] = -1;
+                if (!(perf_mask & (1U << c)))
+                        continue;
+
+                perf_fds[c] = perf_open(c, perf_leader);
+                if (perf_fds[c] < 0)
+                        continue;
+                if (perf_leader < 0)
+                        perf_leader = perf_fds[c];
+                perf_state = 1;
+        }
+}
+#endif
+
+/* Public functions */
+int perf_init(void)
+{
+        int n = 0;
+#ifdef LINUX
+        int c;
+
+        for (c = 0; c < PERF_COUNTERS; c++) {
+                int fd = perf_open(c, -1);
+                if (fd < 0)
+                        continue;
+                close(fd);
+                perf_mask |= 1U << c;
+                n++;
+        }
+#endif
+        return n;
+}
+
+int perf_available(enum perf_counter c)
+{
+        return !!(perf_mask & (1U << c));
+}
+
+void perf_read(struct perf_sample *s)
+{
+#ifdef LINUX
+        uint64_t buf[1 + PERF_COUNTERS];
+        unsigned int i = 0;
+        int c;
+#endif
+
+        memset(s, 0, sizeof(struct perf_sample));
+
+#ifdef LINUX
+        if (!perf_state)
+                perf_thread_open();
+        if (perf_state < 0)
+                return;
+
+        if (read(perf_leader, buf, sizeof(buf)) < (ssize_t) sizeof(uint64_t))
+                return;
+
+        /* Values come in the order the group members were opened */
+        for (c = 0; c < PERF_COUNTERS && i < buf[0]; c++) {
+                if (perf_fds[c] >= 0)
+                        s->v[c] = buf[1 + i++];
+        }
+#endif
+}
+
+void perf_thread_done(void)
+{
+#ifdef LINUX
+        int c;
+
+        if (perf_state <= 0)
+                return;
+
+        for (c = 0; c < PERF_COUNTERS; c++) {
+                if (perf_fds[c] >= 0 && perf_fds[c] != perf_leader)
+                        close(perf_fds[c]);
+        }
+        close(perf_leader);
+        perf_leader = -1;
+        perf_state = 0;
+#endif
+}
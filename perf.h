@@ -0,0 +1,59 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * perf - Hardware performance counters of the calling thread.
+ */
+
+#ifndef XML2JSON_PERF_H
+#define XML2JSON_PERF_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum perf_counter {
+        PERF_CYCLES,
+        PERF_INSTRUCTIONS,
+        PERF_L1D_MISSES,
+        PERF_LLC_MISSES,
+        PERF_BRANCH_MISSES,
+        PERF_PAGE_FAULTS,
+        PERF_COUNTERS,
+};
+
+struct perf_sample {
+        uint64_t v[PERF_COUNTERS];
+};
+
+extern const char *perf_counter_names[PERF_COUNTERS];
+
+/* perf_init():
+ * Check which counters can be opened by this process. Counters the CPU or
+ * perf_event_paranoid do not allow are left out. Returns the number of
+ * usable counters, 0 if there are none.
+ */
+int perf_init(void);
+
+/* perf_available():
+ * Returns whether counter `c` is being counted.
+ */
+int perf_available(enum perf_counter c);
+
+/* perf_read():
+ * Read the counters of the calling thread, opening them on first use.
+ * Counters that are not available read as 0.
+ */
+void perf_read(struct perf_sample *s);
+
+/* perf_thread_done():
+ * Close the calling thread's counters.
+ */
+void perf_thread_done(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_PERF_H */
@@ -0,0 +1,44 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * probes - Static tracepoints (USDT) on the hot paths.
+ *
+ * With <sys/sdt.h> (systemtap-sdt-dev) every probe is a single nop plus an
+ * ELF note, so it costs nothing until a tracer attaches, e.g.
+ *
+ *   bpftrace -e 'usdt:./xml2json:xml2json:element__start
+ *                { @[str(arg0)] = count(); }'
+ *
+ * Without the header, or with -DXML2JSON_NO_PROBES, the probes compile to
+ * nothing at all.
+ *
+ * Probes and arguments:
+ *   element__start   (name)          element conversion starts
+ *   element__end     (name)          element conversion ends
+ *   text             (len)           text node extracted
+ *   htable__put      (hash, count)   entry added to a hash table
+ *   htable__grow     (oldsize, size) hash table rehashed
+ *   array            (key, count)    repeated siblings turned into an array
+ *   output__flush    (len)           output chunk handed to the kernel
+ *   record__emit     (bytes)         document written out
+ */
+
+#ifndef XML2JSON_PROBES_H
+#define XML2JSON_PROBES_H
+
+#if defined(HAVE_SYS_SDT_H) && !defined(XML2JSON_NO_PROBES)
+#include <sys/sdt.h>
+
+#define PROBE0(name)             DTRACE_PROBE(xml2json, name)
+#define PROBE1(name, a)          DTRACE_PROBE1(xml2json, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2(xml2json, name, a, b)
+
+#else
+
+#define PROBE0(name)             do { } while (0)
+#define PROBE1(name, a)          do { } while (0)
+#define PROBE2(name, a, b)       do { } while (0)
+
+#endif
+
+#endif  /* XML2JSON_PROBES_H */
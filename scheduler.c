@@ -0,0 +1,273 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * scheduler - Size-aware job scheduling for the batch and daemon modes.
+ */
+
+#include "scheduler.h"
+#include "stats.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* With one worker, every this many small jobs a waiting large one gets a
+ * turn, so a steady stream of small jobs cannot starve it */
+#define SCHED_STREAK_MAX 16
+
+static const char *lane_names[SCHED_LANES] = {
+        "small",
+        "large",
+};
+
+/* The scheduler and lane of the job a worker thread is running */
+static __thread struct sched *sched_current;
+static __thread enum sched_lane sched_current_lane;
+
+/* Private functions */
+static void queue_push(struct sched_queue *q, struct sched_job *job)
+{
+        job->next = NULL;
+        if (q->tail)
+                q->tail->next = job;
+        else
+                q->head = job;
+        q->tail = job;
+        __atomic_store_n(&q->len, q->len + 1, __ATOMIC_RELAXED);
+}
+
+static struct sched_job *queue_pop(struct sched_queue *q)
+{
+        struct sched_job *job = q->head;
+
+        if (job) {
+                q->head = job->next;
+                if (!q->head)
+                        q->tail = NULL;
+                job->next = NULL;
+                __atomic_store_n(&q->len, q->len - 1, __ATOMIC_RELAXED);
+        }
+
+        return job;
+}
+
+static enum sched_lane lane_of(const struct sched *s, size_t size)
+{
+        return size <= s->opts.small_max ? SCHED_SMALL : SCHED_LARGE;
+}
+
+/* An oversized large job goes in once no other large one is in flight.
+ * Small jobs always have room of their own, enough to keep every worker
+ * busy, so they never wait for a large one to finish.
+ */
+static int admissible(const struct sched *s, enum sched_lane lane,
+                      size_t size)
+{
+        size_t max = s->opts.max_inflight;
+
+        if (!max || s->inflight[SCHED_SMALL] + s->inflight[SCHED_LARGE] +
+            size <= max)
+                return 1;
+        if (lane == SCHED_LARGE)
+                return s->inflight[SCHED_LARGE] == 0;
+
+        return s->inflight[SCHED_SMALL] + size <=
+                s->opts.small_max * s->opts.jobs;
+}
+
+/* Next job for a free worker, with the lock held */
+static struct sched_job *pick(struct sched *s)
+{
+        struct sched_queue *small = &s->lanes[SCHED_SMALL];
+        struct sched_queue *large = &s->lanes[SCHED_LARGE];
+        unsigned int large_max = s->opts.jobs > 1 ? s->opts.jobs - 1 : 1;
+
+        if (large->head && s->running[SCHED_LARGE] < large_max &&
+            (!small->head || s->small_streak >= SCHED_STREAK_MAX)) {
+                s->small_streak = 0;
+                return queue_pop(large);
+        }
+        if (small->head) {
+                if (large->head)
+                        s->small_streak++;
+                return queue_pop(small);
+        }
+
+        return NULL;
+}
+
+/* Run `job` without the lock, its run() callback may free it */
+static void run_job(struct sched_job *job)
+{
+        enum sched_lane outer = sched_current_lane;
+        enum sched_lane lane = job->lane;
+        struct timespec queued = job->queued;
+
+        sched_current_lane = lane;
+        job->run(job);
+        sched_current_lane = outer;
+
+        if (stats_enabled)
+                stats_latency(lane, stats_elapsed_ns(&queued));
+}
+
+static void *worker(void *arg)
+{
+        struct sched *s = arg;
+        struct sched_job *job;
+
+        sched_current = s;
+
+        stats_mutex_lock(&s->lock);
+        for (;;) {
+                enum sched_lane lane;
+                size_t queued = s->lanes[SCHED_SMALL].len +
+                        s->lanes[SCHED_LARGE].len;
+
+                job = pick(s);
+                if (job == NULL) {
+                        if (s->stop && !queued)
+                                break;
+                        s->idle++;
+                        stats_idle(&s->cond, &s->lock);
+                        s->idle--;
+                        continue;
+                }
+
+                stats_queue(queued);
+                lane = job->lane;
+                s->running[lane]++;
+                pthread_mutex_unlock(&s->lock);
+
+                run_job(job);
+
+                stats_mutex_lock(&s->lock);
+                s->running[lane]--;
+                /* A large job done may let one that waits for a worker go */
+                if (lane == SCHED_LARGE && s->lanes[SCHED_LARGE].head)
+                        pthread_cond_signal(&s->cond);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        if (s->opts.thread_done)
+                s->opts.thread_done(s->opts.data);
+        stats_thread_done();
+        sched_current = NULL;
+
+        return NULL;
+}
+
+/* Public functions */
+void sched_init(struct sched *s, const struct sched_opts *opts)
+{
+        unsigned int i;
+
+        memset(s, 0, sizeof(struct sched));
+        s->opts = *opts;
+        if (!s->opts.jobs)
+                s->opts.jobs = 1;
+        if (!s->opts.small_max)
+                s->opts.small_max = SCHED_SMALL_MAX;
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->cond, NULL);
+        pthread_cond_init(&s->admit, NULL);
+
+        ALLOC_ARRAY(s->threads, s->opts.jobs);
+        for (i = 0; i < s->opts.jobs; i++) {
+                if (pthread_create(&s->threads[i], NULL, worker, s) != 0) {
+                        perror("pthread_create: ");
+                        exit(EXIT_FAILURE);
+                }
+        }
+}
+
+int sched_admit(struct sched *s, size_t size, int wait)
+{
+        enum sched_lane lane = lane_of(s, size);
+
+        stats_mutex_lock(&s->lock);
+        while (!admissible(s, lane, size)) {
+                if (!wait) {
+                        pthread_mutex_unlock(&s->lock);
+                        return -1;
+                }
+                pthread_cond_wait(&s->admit, &s->lock);
+        }
+        s->inflight[lane] += size;
+        pthread_mutex_unlock(&s->lock);
+
+        return 0;
+}
+
+void sched_release(struct sched *s, size_t size)
+{
+        stats_mutex_lock(&s->lock);
+        s->inflight[lane_of(s, size)] -= size;
+        pthread_cond_broadcast(&s->admit);
+        pthread_mutex_unlock(&s->lock);
+}
+
+void sched_submit(struct sched *s, struct sched_job *job)
+{
+        job->lane = lane_of(s, job->size);
+        if (stats_enabled)
+                clock_gettime(CLOCK_MONOTONIC, &job->queued);
+
+        stats_mutex_lock(&s->lock);
+        queue_push(&s->lanes[job->lane], job);
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+}
+
+int sched_yield_wanted(void)
+{
+        struct sched *s = sched_current;
+
+        /* Cheap enough to call for every record: no lock */
+        return s != NULL && sched_current_lane == SCHED_LARGE &&
+                __atomic_load_n(&s->lanes[SCHED_SMALL].len, __ATOMIC_RELAXED);
+}
+
+void sched_yield_point(void)
+{
+        struct sched *s = sched_current;
+        struct sched_job *job;
+
+        if (!sched_yield_wanted())
+                return;
+
+        stats_mutex_lock(&s->lock);
+        while (!s->idle && (job = queue_pop(&s->lanes[SCHED_SMALL]))) {
+                s->running[SCHED_SMALL]++;
+                pthread_mutex_unlock(&s->lock);
+
+                run_job(job);
+
+                stats_mutex_lock(&s->lock);
+                s->running[SCHED_SMALL]--;
+        }
+        pthread_mutex_unlock(&s->lock);
+}
+
+const char *sched_lane_name(enum sched_lane lane)
+{
+        return lane < SCHED_LANES ? lane_names[lane] : "unknown";
+}
+
+void sched_free(struct sched *s)
+{
+        unsigned int i;
+
+        stats_mutex_lock(&s->lock);
+        s->stop = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+
+        for (i = 0; i < s->opts.jobs; i++)
+                pthread_join(s->threads[i], NULL);
+        xfree(s->threads);
+
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->cond);
+        pthread_cond_destroy(&s->admit);
+}
@@ -0,0 +1,127 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * scheduler - Size-aware job scheduling for the batch and daemon modes.
+ *
+ * Jobs go into one of two lanes by input size. Small jobs always run
+ * first, and large jobs may only take `jobs - 1` workers, so one worker is
+ * always left for the small lane and a 2KB message never waits behind a
+ * multi-gigabyte document. With a single worker, long conversions call
+ * sched_yield_point() between records and run waiting small jobs there.
+ *
+ * Admission control bounds the input bytes in flight: sched_admit()
+ * reserves a job's bytes before its input is read, sched_release() gives
+ * them back once its output is gone.
+ */
+
+#ifndef XML2JSON_SCHEDULER_H
+#define XML2JSON_SCHEDULER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum sched_lane {
+        SCHED_SMALL,
+        SCHED_LARGE,
+        SCHED_LANES,
+};
+
+/* Jobs up to this size go into the small lane by default */
+#define SCHED_SMALL_MAX (256 * 1024)
+
+struct sched_job {
+        size_t size;                    /* input bytes, picks the lane */
+        void (*run)(struct sched_job *job);
+        void *data;                     /* owned by the caller */
+
+        /* private to the scheduler */
+        enum sched_lane lane;
+        struct timespec queued;
+        struct sched_job *next;
+};
+
+struct sched_opts {
+        unsigned int jobs;              /* worker threads */
+        size_t small_max;               /* 0 for SCHED_SMALL_MAX */
+        size_t max_inflight;            /* input bytes, 0 for no limit */
+        void (*thread_done)(const void *data);  /* as a worker exits */
+        const void *data;
+};
+
+struct sched_queue {
+        struct sched_job *head;
+        struct sched_job *tail;
+        size_t len;
+};
+
+struct sched {
+        struct sched_opts opts;
+        pthread_t *threads;
+
+        pthread_mutex_t lock;
+        pthread_cond_t cond;            /* work for the workers */
+        pthread_cond_t admit;           /* bytes released */
+        struct sched_queue lanes[SCHED_LANES];
+        unsigned int running[SCHED_LANES];
+        unsigned int idle;
+        unsigned int small_streak;      /* small jobs run while large wait */
+        size_t inflight[SCHED_LANES];   /* admitted input bytes */
+        int stop;
+};
+
+/* sched_init():
+ * Start `opts->jobs` workers.
+ */
+void sched_init(struct sched *s, const struct sched_opts *opts);
+
+/* sched_admit():
+ * Reserve `size` input bytes. Waits, or returns -1 if `wait` is not set,
+ * while that would go over `max_inflight`. A large job over the limit is
+ * admitted once no other large job is in flight, and the small lane may
+ * always hold up to `jobs` times `small_max` bytes. Returns 0 once
+ * admitted.
+ */
+int sched_admit(struct sched *s, size_t size, int wait);
+
+/* sched_release():
+ * Give back bytes reserved with sched_admit().
+ */
+void sched_release(struct sched *s, size_t size);
+
+/* sched_submit():
+ * Queue `job`, its run() callback is called from a worker. Never blocks.
+ */
+void sched_submit(struct sched *s, struct sched_job *job);
+
+/* sched_yield_wanted():
+ * Whether sched_yield_point() would run small jobs now.
+ */
+int sched_yield_wanted(void);
+
+/* sched_yield_point():
+ * Called by long conversions at record boundaries: if the calling worker
+ * runs a large job while small ones wait and no other worker is free, run
+ * those small jobs now. A no-op outside of a scheduler worker.
+ */
+void sched_yield_point(void);
+
+/* sched_lane_name():
+ * "small" or "large".
+ */
+const char *sched_lane_name(enum sched_lane lane);
+
+/* sched_free():
+ * Run the jobs still queued, then stop and join the workers.
+ */
+void sched_free(struct sched *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_SCHEDULER_H */
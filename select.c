@@ -0,0 +1,235 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * select - Convert only the elements on some paths.
+ *
+ * The parser context's SAX2 handlers are wrapped so that libxml2's tree
+ * builder only sees the events of selected elements and of the elements
+ * on the way to them. Every open element on such a path has a bitmap of
+ * the paths it still matches, the rest is tracked as plain depth counts.
+ */
+
+#include "select.h"
+#include "util.h"
+
+#include <libxml/SAX2.h>
+#include <libxml/tree.h>
+
+#include <string.h>
+
+/* Private functions */
+static void select_start(void *ctx, const xmlChar *localname,
+                         const xmlChar *prefix, const xmlChar *uri,
+                         int nb_namespaces, const xmlChar **namespaces,
+                         int nb_attributes, int nb_defaulted,
+                         const xmlChar **attributes)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+        const struct select *sel = st->sel;
+        uint64_t parent, alive = 0;
+        int matched = 0;
+        size_t i;
+
+        if (st->skip) {
+                st->skip++;
+                return;
+        }
+        if (st->inside) {
+                st->inside++;
+                xmlSAX2StartElementNs(ctx, localname, prefix, uri,
+                                      nb_namespaces, namespaces,
+                                      nb_attributes, nb_defaulted,
+                                      attributes);
+                return;
+        }
+
+        parent = st->depth < SELECT_MAX_STEPS ? st->alive[st->depth] : 0;
+        for (i = 0; i < sel->nr && parent; i++) {
+                const struct select_path *path = &sel->paths[i];
+                const char *step;
+
+                if (!(parent & (UINT64_C(1) << i)) ||
+                    st->depth >= path->nsteps)
+                        continue;
+
+                step = path->steps[st->depth];
+                if (strcmp(step, "*") && strcmp(step, (const char *) localname))
+                        continue;
+
+                if (st->depth + 1 == path->nsteps)
+                        matched = 1;
+                else
+                        alive |= UINT64_C(1) << i;
+        }
+
+        if (matched) {
+                st->inside = 1;
+                xmlSAX2StartElementNs(ctx, localname, prefix, uri,
+                                      nb_namespaces, namespaces,
+                                      nb_attributes, nb_defaulted,
+                                      attributes);
+        } else if (alive) {
+                /* On the way to a selected element, the attributes are not
+                 * wanted either */
+                st->alive[++st->depth] = alive;
+                xmlSAX2StartElementNs(ctx, localname, prefix, uri,
+                                      nb_namespaces, namespaces, 0, 0, NULL);
+        } else {
+                st->skip = 1;
+        }
+}
+
+static void select_end(void *ctx, const xmlChar *localname,
+                       const xmlChar *prefix, const xmlChar *uri)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+        xmlNodePtr node = ctxt->node;
+
+        if (st->skip) {
+                st->skip--;
+                return;
+        }
+
+        xmlSAX2EndElementNs(ctx, localname, prefix, uri);
+        if (st->inside) {
+                st->inside--;
+                return;
+        }
+
+        /* Nothing was selected below this element, it would only show up
+         * as a null. The root stays, for the shape of the output. */
+        if (st->depth-- > 1 && node != NULL && node->children == NULL) {
+                xmlUnlinkNode(node);
+                xmlFreeNode(node);
+        }
+}
+
+static void select_characters(void *ctx, const xmlChar *ch, int len)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+
+        if (st->inside)
+                xmlSAX2Characters(ctx, ch, len);
+}
+
+static void select_whitespace(void *ctx, const xmlChar *ch, int len)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+
+        if (st->inside && ctxt->keepBlanks)
+                xmlSAX2Characters(ctx, ch, len);
+}
+
+static void select_cdata(void *ctx, const xmlChar *value, int len)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+
+        if (st->inside)
+                xmlSAX2CDataBlock(ctx, value, len);
+}
+
+static void select_comment(void *ctx, const xmlChar *value)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+
+        if (st->inside)
+                xmlSAX2Comment(ctx, value);
+}
+
+static void select_pi(void *ctx, const xmlChar *target, const xmlChar *data)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+
+        if (st->inside)
+                xmlSAX2ProcessingInstruction(ctx, target, data);
+}
+
+static void select_reference(void *ctx, const xmlChar *name)
+{
+        xmlParserCtxtPtr ctxt = ctx;
+        struct select_state *st = ctxt->_private;
+
+        if (st->inside)
+                xmlSAX2Reference(ctx, name);
+}
+
+/* Public functions */
+int select_add(struct select *sel, const char *expr)
+{
+        struct select_path path;
+        const char *p, *slash;
+        unsigned int i;
+        size_t len;
+
+        if (expr[0] != '/' || sel->nr == SELECT_MAX_PATHS)
+                return -1;
+
+        memset(&path, 0, sizeof(struct select_path));
+        ALLOC_ARRAY(path.steps, SELECT_MAX_STEPS);
+        for (p = expr + 1; ; p = slash + 1) {
+                slash = strchr(p, '/');
+                len = slash ? (size_t) (slash - p) : strlen(p);
+
+                /* Only element names, attributes are never converted */
+                if (len == 0 || memchr(p, '@', len) || memchr(p, '[', len) ||
+                    path.nsteps == SELECT_MAX_STEPS)
+                        goto fail;
+
+                path.steps[path.nsteps] = xmalloc(len + 1);
+                memcpy(path.steps[path.nsteps], p, len);
+                path.steps[path.nsteps++][len] = '\0';
+
+                if (slash == NULL)
+                        break;
+        }
+
+        ALLOC_GROW(sel->paths, sel->nr + 1, sel->alloc);
+        sel->paths[sel->nr++] = path;
+        return 0;
+
+fail:
+        for (i = 0; i < path.nsteps; i++)
+                xfree(path.steps[i]);
+        xfree(path.steps);
+        return -1;
+}
+
+void select_free(struct select *sel)
+{
+        unsigned int j;
+        size_t i;
+
+        for (i = 0; i < sel->nr; i++) {
+                for (j = 0; j < sel->paths[i].nsteps; j++)
+                        xfree(sel->paths[i].steps[j]);
+                xfree(sel->paths[i].steps);
+        }
+        xfree(sel->paths);
+        memset(sel, 0, sizeof(struct select));
+}
+
+void select_install(xmlParserCtxtPtr ctxt, const struct select *sel,
+                    struct select_state *st)
+{
+        memset(st, 0, sizeof(struct select_state));
+        st->sel = sel;
+        st->alive[0] = sel->nr == SELECT_MAX_PATHS ? ~UINT64_C(0) :
+                (UINT64_C(1) << sel->nr) - 1;
+
+        ctxt->_private = st;
+        ctxt->sax->startElementNs = select_start;
+        ctxt->sax->endElementNs = select_end;
+        ctxt->sax->characters = select_characters;
+        ctxt->sax->ignorableWhitespace = select_whitespace;
+        ctxt->sax->cdataBlock = select_cdata;
+        ctxt->sax->comment = select_comment;
+        ctxt->sax->processingInstruction = select_pi;
+        ctxt->sax->reference = select_reference;
+}
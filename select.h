@@ -0,0 +1,72 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * select - Convert only the elements on some paths.
+ *
+ * Paths are absolute, like /mondial/country/name, and a step may be `*`
+ * for any element. Steps match the local name of an element. Whatever
+ * lies below a selected element is converted as usual, the elements on
+ * the way to it are kept (without their text) so the JSON has the same
+ * shape, and everything else is dropped while parsing: libxml2 still
+ * reads those bytes, but no nodes, strings or JSON objects are made.
+ */
+
+#ifndef XML2JSON_SELECT_H
+#define XML2JSON_SELECT_H
+
+#include <libxml/parser.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SELECT_MAX_PATHS 64
+#define SELECT_MAX_STEPS 32
+
+struct select_path {
+        char **steps;
+        unsigned int nsteps;
+};
+
+struct select {
+        struct select_path *paths;
+        size_t nr;
+        size_t alloc;
+};
+
+/* Where the parser is, for one document */
+struct select_state {
+        const struct select *sel;
+        unsigned int depth;             /* of the elements on a path */
+        unsigned long inside;           /* depth within a selected element */
+        unsigned long skip;             /* depth within a dropped element */
+        uint64_t alive[SELECT_MAX_STEPS + 1];   /* paths matching so far */
+};
+
+/* select_add():
+ * Add the path `expr`. Returns 0 on success, -1 if it is not an absolute
+ * path of element names or there are too many paths or steps.
+ */
+int select_add(struct select *sel, const char *expr);
+
+/* select_free():
+ * Free every path.
+ */
+void select_free(struct select *sel);
+
+/* select_install():
+ * Make `ctxt` build only the selected parts of the next document it
+ * parses. `st` holds the state of that parse and must live until it is
+ * done; install again before every document.
+ */
+void select_install(xmlParserCtxtPtr ctxt, const struct select *sel,
+                    struct select_state *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_SELECT_H */
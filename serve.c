@@ -0,0 +1,700 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * serve - Conversion daemon on a Unix socket, and its client.
+ *
+ * An acceptor thread starts a thread for every connection, which reads its
+ * requests, has them converted by the scheduler (see scheduler.h) and sends the
+ * responses. Conversions are only ever run by the `jobs` scheduler workers,
+ * which keep whatever the convert callback keeps per thread warm across
+ * requests; a small request is converted ahead of large ones whichever
+ * connection it comes on. The main thread only waits for a signal to stop.
+ *
+ * Headers go through sendmsg()/recvmsg() so that a memfd can ride along
+ * with them (see serve.h).
+ */
+
+#include "serve.h"
+#include "output.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#ifdef SERVE_HAVE_MEMFD
+#include <sys/sendfile.h>
+#endif
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct serve_conn {
+        struct serve *s;
+        int fd;
+        struct serve_conn *prev;
+        struct serve_conn *next;
+};
+
+struct serve {
+        const struct serve_opts *opts;
+        int listenfd;
+        struct sched sched;
+
+        pthread_mutex_t lock;
+        pthread_cond_t gone;            /* a connection closed */
+        struct serve_conn *conns;
+        unsigned int nconns;
+        volatile sig_atomic_t stop;
+};
+
+/* A request being converted by a scheduler worker, while the connection
+ * thread waits for it */
+struct serve_req {
+        struct sched_job job;
+        const struct serve_opts *opts;
+        const char *doc;
+        struct output *out;
+        int ret;
+        int done;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+};
+
+/* Private functions */
+static int read_full(int fd, void *buf, size_t len)
+{
+        char *p = buf;
+
+        while (len) {
+                ssize_t n = read(fd, p, len);
+
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0) {
+                        if (n == 0)
+                                errno = ECONNRESET;
+                        return -1;
+                }
+                p += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+static int writev_full(int fd, struct iovec *iov, int iovcnt)
+{
+        while (iovcnt) {
+                ssize_t n = writev(fd, iov, iovcnt);
+
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                while (iovcnt && (size_t) n >= iov->iov_len) {
+                        n -= iov->iov_len;
+                        iov++;
+                        iovcnt--;
+                }
+                if (iovcnt) {
+                        iov->iov_base = (char *) iov->iov_base + n;
+                        iov->iov_len -= n;
+                }
+        }
+
+        return 0;
+}
+
+/* Read a header, and the file descriptor passed with it if any (else -1).
+ * Descriptors past the first are closed, and a header whose control data
+ * did not fit is refused, as some of what came with it is lost. */
+static int recv_header(int fd, uint32_t hdr[2], int *passed)
+{
+        union {
+                struct cmsghdr hdr;
+                char buf[CMSG_SPACE(sizeof(int))];
+        } cmsg;
+        struct msghdr msg;
+        struct cmsghdr *c;
+        struct iovec iov;
+        ssize_t n;
+        size_t i, nfds;
+        int passfd;
+
+        *passed = -1;
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = hdr;
+        iov.iov_len = SERVE_HEADER_SIZE;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg.buf;
+        msg.msg_controllen = sizeof(cmsg.buf);
+
+        do {
+                n = recvmsg(fd, &msg, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+                if (n == 0)
+                        errno = ECONNRESET;
+                return -1;
+        }
+
+        for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+                if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+                        continue;
+                nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (i = 0; i < nfds; i++) {
+                        memcpy(&passfd, CMSG_DATA(c) + i * sizeof(int),
+                               sizeof(int));
+                        if (*passed < 0)
+                                *passed = passfd;
+                        else
+                                close(passfd);
+                }
+        }
+
+        if (msg.msg_flags & MSG_CTRUNC)
+                errno = EPROTO;
+        else if (n == SERVE_HEADER_SIZE ||
+                 read_full(fd, (char *) hdr + n, SERVE_HEADER_SIZE - n) == 0)
+                return 0;
+
+        if (*passed >= 0)
+                close(*passed);
+        *passed = -1;
+        return -1;
+}
+
+/* Send a header with `passfd` attached */
+static int send_header_fd(int fd, uint32_t word, size_t len, int passfd)
+{
+        uint32_t hdr[2] = { htonl(word), htonl((uint32_t) len) };
+        union {
+                struct cmsghdr hdr;
+                char buf[CMSG_SPACE(sizeof(int))];
+        } cmsg;
+        struct msghdr msg;
+        struct cmsghdr *c;
+        struct iovec iov;
+        ssize_t n;
+
+        memset(&msg, 0, sizeof(msg));
+        memset(&cmsg, 0, sizeof(cmsg));
+        iov.iov_base = hdr;
+        iov.iov_len = sizeof(hdr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg.buf;
+        msg.msg_controllen = sizeof(cmsg.buf);
+        c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &passfd, sizeof(int));
+
+        do {
+                n = sendmsg(fd, &msg, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0)
+                return -1;
+
+        /* The descriptor went with the first byte, the rest is plain data */
+        iov.iov_base = (char *) hdr + n;
+        iov.iov_len = sizeof(hdr) - n;
+
+        return writev_full(fd, &iov, iov.iov_len ? 1 : 0);
+}
+
+static int send_frame(int fd, uint32_t word, const char *buf, size_t len)
+{
+        uint32_t hdr[2] = { htonl(word), htonl((uint32_t) len) };
+        struct iovec iov[2];
+
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = (void *) (uintptr_t) buf;
+        iov[1].iov_len = len;
+
+        return writev_full(fd, iov, len ? 2 : 1);
+}
+
+static int send_error(int fd, enum serve_status status, const char *msg)
+{
+        return send_frame(fd, status, msg, strlen(msg));
+}
+
+static void run_req(struct sched_job *job)
+{
+        struct serve_req *r = job->data;
+
+        r->ret = r->opts->convert(r->doc, job->size, "request", r->out,
+                                  r->opts->convert_data);
+
+        pthread_mutex_lock(&r->lock);
+        r->done = 1;
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+}
+
+/* Convert `len` bytes of `doc` into `out` on the scheduler */
+static int convert(struct serve *s, const char *doc, size_t len,
+                   struct output *out)
+{
+        struct serve_req r;
+
+        memset(&r, 0, sizeof(struct serve_req));
+        r.job.size = len;
+        r.job.run = run_req;
+        r.job.data = &r;
+        r.opts = s->opts;
+        r.doc = doc;
+        r.out = out;
+        pthread_mutex_init(&r.lock, NULL);
+        pthread_cond_init(&r.cond, NULL);
+
+        sched_submit(&s->sched, &r.job);
+        pthread_mutex_lock(&r.lock);
+        while (!r.done)
+                pthread_cond_wait(&r.cond, &r.lock);
+        pthread_mutex_unlock(&r.lock);
+
+        pthread_mutex_destroy(&r.lock);
+        pthread_cond_destroy(&r.cond);
+
+        return r.ret;
+}
+
+#ifdef SERVE_HAVE_MEMFD
+/* Convert the document in `docfd` into a new sealed memfd and send it */
+static int serve_fd(struct serve *s, int fd, int docfd, size_t len)
+{
+        const char *msg = NULL;
+        struct output out;
+        struct stat st;
+        void *doc = NULL;
+        int resfd, ret, seals;
+
+        /* Anything that could shrink or change under the parser, a regular
+         * file in particular, has no seals at all */
+        seals = fcntl(docfd, F_GET_SEALS);
+        if (fstat(docfd, &st) < 0 || (size_t) st.st_size < len ||
+            seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) !=
+            (F_SEAL_SHRINK | F_SEAL_WRITE))
+                return send_error(fd, SERVE_BAD_REQUEST, "the document must "
+                                  "be in a memfd sealed against shrinking "
+                                  "and writes");
+
+        if (len) {
+                doc = mmap(NULL, len, PROT_READ, MAP_SHARED, docfd, 0);
+                if (doc == MAP_FAILED)
+                        return send_error(fd, SERVE_FAILED, strerror(errno));
+        }
+
+        /* The JSON is written straight into the memfd's pages */
+        resfd = memfd_create("xml2json-result", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (resfd < 0 || output_init_mapped(&out, resfd) < 0) {
+                msg = strerror(errno);
+        } else {
+                if (convert(s, doc ? doc : "", len, &out) < 0)
+                        msg = "conversion failed";
+                output_release(&out);
+        }
+        if (doc)
+                munmap(doc, len);
+
+        if (msg != NULL) {
+                if (resfd >= 0)
+                        close(resfd);
+                return send_error(fd, SERVE_FAILED, msg);
+        }
+
+        fcntl(resfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+              F_SEAL_WRITE | F_SEAL_SEAL);
+        ret = send_header_fd(fd, SERVE_OK, out.bytes, resfd);
+        close(resfd);
+
+        return ret;
+}
+#endif
+
+/* Serve requests on `fd` until the client hangs up or breaks the protocol.
+ * The bytes of every request are admitted before its payload is read, so
+ * a client over the in-flight limit waits with its data still in the
+ * socket. */
+static void serve_conn(struct serve *s, int fd)
+{
+        char *buf = NULL;
+        size_t alloc = 0;
+
+        while (!s->stop) {
+                uint32_t hdr[2], op, len;
+                struct output out;
+                int ret, passed;
+
+                if (recv_header(fd, hdr, &passed) < 0)
+                        break;
+                op = ntohl(hdr[0]);
+                len = ntohl(hdr[1]);
+
+#ifdef SERVE_HAVE_MEMFD
+                if (op == SERVE_OP_CONVERT_FD && passed >= 0) {
+                        sched_admit(&s->sched, len, 1);
+                        ret = serve_fd(s, fd, passed, len);
+                        sched_release(&s->sched, len);
+                        close(passed);
+                        if (ret < 0)
+                                break;
+                        continue;
+                }
+#endif
+                if (passed >= 0)
+                        close(passed);
+                if (op != SERVE_OP_CONVERT) {
+                        send_error(fd, SERVE_BAD_REQUEST, "unknown request");
+                        break;
+                }
+                if (len > SERVE_MAX_PAYLOAD) {
+                        send_error(fd, SERVE_BAD_REQUEST, "request too large");
+                        break;
+                }
+
+                sched_admit(&s->sched, len, 1);
+                if (len > alloc) {
+                        alloc = len;
+                        buf = xrealloc(buf, alloc);
+                }
+                if (read_full(fd, buf, len) < 0) {
+                        sched_release(&s->sched, len);
+                        break;
+                }
+
+                output_init_mem(&out);
+                if (convert(s, buf, len, &out) < 0)
+                        ret = send_error(fd, SERVE_FAILED,
+                                         "conversion failed");
+                else
+                        ret = send_frame(fd, SERVE_OK, out.buf, out.len);
+                output_release(&out);
+                sched_release(&s->sched, len);
+                if (ret < 0)
+                        break;
+        }
+
+        xfree(buf);
+}
+
+static void *conn_thread(void *arg)
+{
+        struct serve_conn *c = arg;
+        struct serve *s = c->s;
+
+        if (!s->stop)
+                serve_conn(s, c->fd);
+        stats_thread_done();
+
+        /* Closed under the lock, so serve_run() never shuts down a
+         * descriptor that has been reused */
+        pthread_mutex_lock(&s->lock);
+        if (c->prev)
+                c->prev->next = c->next;
+        else
+                s->conns = c->next;
+        if (c->next)
+                c->next->prev = c->prev;
+        s->nconns--;
+        close(c->fd);
+        pthread_cond_signal(&s->gone);
+        pthread_mutex_unlock(&s->lock);
+        xfree(c);
+
+        return NULL;
+}
+
+static void *acceptor(void *arg)
+{
+        struct serve *s = arg;
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        while (!s->stop) {
+                struct serve_conn *c;
+                pthread_t thread;
+                int fd = accept(s->listenfd, NULL, NULL);
+
+                if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED)
+                                continue;
+                        if (!s->stop)
+                                perror("accept: ");
+                        break;
+                }
+
+                c = xcalloc(1, sizeof(struct serve_conn));
+                c->s = s;
+                c->fd = fd;
+                pthread_mutex_lock(&s->lock);
+                c->next = s->conns;
+                if (s->conns)
+                        s->conns->prev = c;
+                s->conns = c;
+                s->nconns++;
+                pthread_mutex_unlock(&s->lock);
+
+                if (pthread_create(&thread, &attr, conn_thread, c) != 0) {
+                        perror("pthread_create: ");
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        pthread_attr_destroy(&attr);
+
+        return NULL;
+}
+
+static int make_addr(struct sockaddr_un *addr, const char *path)
+{
+        memset(addr, 0, sizeof(struct sockaddr_un));
+        addr->sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr->sun_path)) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        strcpy(addr->sun_path, path);
+
+        return 0;
+}
+
+static int listen_on(const char *path)
+{
+        struct sockaddr_un addr;
+        struct stat st;
+        int fd;
+
+        if (make_addr(&addr, path) < 0)
+                return -1;
+
+        /* A socket nobody answers on is left over from an earlier run */
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+                fd = serve_connect(path);
+                if (fd >= 0) {
+                        close(fd);
+                        errno = EADDRINUSE;
+                        return -1;
+                }
+                unlink(path);
+        }
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+                return -1;
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(fd, SOMAXCONN) < 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+/* Read the rest of a response whose header is in `hdr` */
+static int recv_response(int fd, uint32_t hdr[2], char **resp, size_t *len)
+{
+        uint32_t status, n;
+        char *p;
+
+        status = ntohl(hdr[0]);
+        n = ntohl(hdr[1]);
+
+        p = xmalloc((size_t) n + 1);
+        if (read_full(fd, p, n) < 0) {
+                xfree(p);
+                return -1;
+        }
+        p[n] = '\0';
+
+        *resp = p;
+        *len = n;
+
+        return (int) status;
+}
+
+/* Public functions */
+int serve_run(const struct serve_opts *opts)
+{
+        struct serve s;
+        struct serve_conn *c;
+        struct sched_opts sopts;
+        pthread_t thread;
+        sigset_t set, old;
+        int sig;
+
+        memset(&s, 0, sizeof(struct serve));
+        s.opts = opts;
+        pthread_mutex_init(&s.lock, NULL);
+        pthread_cond_init(&s.gone, NULL);
+
+        s.listenfd = listen_on(opts->path);
+        if (s.listenfd < 0) {
+                fprintf(stderr, "%s: %s\n", opts->path, strerror(errno));
+                return -1;
+        }
+
+        /* Clients that hang up early must not kill the daemon, and only
+         * the main thread takes the signals that stop it */
+        signal(SIGPIPE, SIG_IGN);
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &set, &old);
+
+        memset(&sopts, 0, sizeof(struct sched_opts));
+        sopts.jobs = opts->jobs;
+        sopts.small_max = opts->small_max;
+        sopts.max_inflight = opts->max_inflight;
+        sopts.thread_done = opts->thread_done;
+        sopts.data = opts->convert_data;
+        sched_init(&s.sched, &sopts);
+
+        if (pthread_create(&thread, NULL, acceptor, &s) != 0) {
+                perror("pthread_create: ");
+                exit(EXIT_FAILURE);
+        }
+
+        sigwait(&set, &sig);
+
+        /* Wake up the acceptor, then every connection waiting for a
+         * request; requests being converted are finished first */
+        s.stop = 1;
+        shutdown(s.listenfd, SHUT_RDWR);
+        pthread_join(thread, NULL);
+
+        pthread_mutex_lock(&s.lock);
+        for (c = s.conns; c; c = c->next)
+                shutdown(c->fd, SHUT_RD);
+        while (s.nconns)
+                pthread_cond_wait(&s.gone, &s.lock);
+        pthread_mutex_unlock(&s.lock);
+
+        sched_free(&s.sched);
+
+        close(s.listenfd);
+        unlink(opts->path);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        pthread_mutex_destroy(&s.lock);
+        pthread_cond_destroy(&s.gone);
+
+        return 0;
+}
+
+int serve_connect(const char *path)
+{
+        struct sockaddr_un addr;
+        int fd;
+
+        if (make_addr(&addr, path) < 0)
+                return -1;
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+                return -1;
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+                int err = errno;
+
+                close(fd);
+                errno = err;
+                return -1;
+        }
+
+        return fd;
+}
+
+int serve_call(int fd, const char *buf, size_t buflen, char **resp,
+               size_t *len)
+{
+        uint32_t hdr[2];
+
+        if (buflen > SERVE_MAX_PAYLOAD) {
+                errno = EMSGSIZE;
+                return -1;
+        }
+        if (send_frame(fd, SERVE_OP_CONVERT, buf, buflen) < 0 ||
+            read_full(fd, hdr, sizeof(hdr)) < 0)
+                return -1;
+
+        return recv_response(fd, hdr, resp, len);
+}
+
+int serve_call_fd(int fd, int docfd, size_t doclen, int *resfd, char **resp,
+                  size_t *len)
+{
+        uint32_t hdr[2];
+        int passed;
+
+        *resfd = -1;
+        *resp = NULL;
+        if (doclen > UINT32_MAX) {
+                errno = EMSGSIZE;
+                return -1;
+        }
+        if (send_header_fd(fd, SERVE_OP_CONVERT_FD, doclen, docfd) < 0 ||
+            recv_header(fd, hdr, &passed) < 0)
+                return -1;
+
+        if (ntohl(hdr[0]) == SERVE_OK && passed >= 0) {
+                *resfd = passed;
+                *len = ntohl(hdr[1]);
+                return SERVE_OK;
+        }
+        if (passed >= 0)
+                close(passed);
+
+        return recv_response(fd, hdr, resp, len);
+}
+
+int serve_memfd(int fd, size_t len)
+{
+#ifdef SERVE_HAVE_MEMFD
+        int memfd, err;
+
+        memfd = memfd_create("xml2json-doc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memfd < 0)
+                return -1;
+
+        while (len) {
+                ssize_t n = sendfile(memfd, fd, NULL, len);
+
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0) {
+                        err = n ? errno : EIO;
+                        close(memfd);
+                        errno = err;
+                        return -1;
+                }
+                len -= n;
+        }
+
+        if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                  F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+                err = errno;
+                close(memfd);
+                errno = err;
+                return -1;
+        }
+
+        return memfd;
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
@@ -0,0 +1,114 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * serve - Conversion daemon on a Unix socket, and its client.
+ *
+ * A connection carries any number of requests, one after the other. Every
+ * request is an 8 byte header, the operation and the payload length as 32
+ * bit big-endian integers, followed by the payload; every response is the
+ * status and the payload length, followed by the payload:
+ *
+ *   request:  | op | len | XML document      |
+ *   response: | status | len | JSON document |   status SERVE_OK
+ *             | status | len | error message |   otherwise
+ *
+ * On Linux, SERVE_OP_CONVERT_FD passes the document as a memfd instead
+ * (SCM_RIGHTS, along with the header) and `len` is the document size. The
+ * memfd must be sealed against shrinking and writes, the daemon parses it
+ * where it maps it read-only. A successful response then carries no
+ * payload but a sealed memfd holding the `len` bytes of JSON, which the
+ * daemon converts straight into the memfd's mapped pages. Neither document
+ * goes through the socket and the daemon copies neither. The client still
+ * has to get its document into a memfd: one it builds there costs nothing
+ * more, one read from a file is copied once by serve_memfd().
+ */
+
+#ifndef XML2JSON_SERVE_H
+#define XML2JSON_SERVE_H
+
+#include "batch.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SERVE_HEADER_SIZE       8
+#define SERVE_MAX_PAYLOAD       (1U << 30)
+
+#if defined(LINUX)
+#define SERVE_HAVE_MEMFD
+#endif
+
+/* The client passes documents from this size on as a memfd */
+#define SERVE_MEMFD_MIN_SIZE    (64 * 1024)
+
+enum serve_op {
+        SERVE_OP_CONVERT = 1,   /* payload is the document */
+        SERVE_OP_CONVERT_FD = 2,/* the document is in the memfd passed */
+};
+
+enum serve_status {
+        SERVE_OK = 0,
+        SERVE_FAILED = 1,       /* the document could not be converted */
+        SERVE_BAD_REQUEST = 2,  /* unknown op or oversized payload */
+};
+
+struct serve_opts {
+        const char *path;         /* Unix socket to listen on */
+        unsigned int jobs;        /* converter threads */
+        size_t small_max;         /* scheduler lanes, see scheduler.h */
+        size_t max_inflight;
+        batch_convert_fn convert; /* called from the converters */
+        const void *convert_data;
+        void (*thread_done)(const void *convert_data);
+};
+
+/* serve_run():
+ * Listen on `opts->path` until SIGINT or SIGTERM. Every connection gets a
+ * thread of its own, and up to `jobs` requests are converted at once, the
+ * small ones first. Requests over `max_inflight` input bytes wait for
+ * earlier ones to be answered before their payload is read. Returns 0 on a
+ * clean shutdown, -1 if the socket could not be set up.
+ */
+int serve_run(const struct serve_opts *opts);
+
+/* serve_connect():
+ * Connect to the daemon at `path`. Returns the socket, or -1 with errno
+ * set.
+ */
+int serve_connect(const char *path);
+
+/* serve_call():
+ * Send one request on `fd` and wait for its response. The payload of the
+ * response is returned in `*resp` (NUL terminated, to be free()d) and its
+ * length in `*len`. Returns the response status, or -1 with errno set if
+ * the connection failed.
+ */
+int serve_call(int fd, const char *buf, size_t buflen, char **resp,
+               size_t *len);
+
+/* serve_call_fd():
+ * Like serve_call(), with the document in the sealed memfd `docfd` of
+ * `doclen` bytes. On SERVE_OK, `*resfd` is a sealed memfd holding the
+ * `*len` bytes of the result, to be closed by the caller; otherwise
+ * `*resp` is the error message, as for serve_call().
+ */
+int serve_call_fd(int fd, int docfd, size_t doclen, int *resfd, char **resp,
+                  size_t *len);
+
+/* serve_memfd():
+ * Copy `len` bytes of `fd`, from its current offset, into a new memfd and
+ * seal it. Returns the memfd, or -1 with errno set. A caller that makes
+ * its documents in memory can write them to a memfd of its own and seal
+ * it the same way, instead of copying them twice.
+ */
+int serve_memfd(int fd, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_SERVE_H */
@@ -0,0 +1,192 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * simd - Byte kernels with scalar, SSE4.2, AVX2 and AVX-512 versions.
+ */
+
+#include "simd.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+enum simd_level simd_level = SIMD_SCALAR;
+size_t (*simd_strip_space)(char *dst, const char *src, size_t len);
+
+static const char *simd_names[SIMD_LEVELS] = {
+        "scalar", "sse4.2", "avx2", "avx512",
+};
+
+/* Private functions */
+static inline int is_space(unsigned char c)
+{
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static size_t strip_space_scalar(char *dst, const char *src, size_t len)
+{
+        size_t i, n = 0;
+
+        for (i = 0; i < len; i++)
+                if (!is_space(src[i]))
+                        dst[n++] = src[i];
+
+        return n;
+}
+
+#ifdef SIMD_X86
+/* Text nodes are mostly indentation or words, so whole blocks are either
+ * dropped or copied; mixed blocks copy the bytes that are left one by one.
+ */
+static inline size_t keep_bytes(char *dst, const char *src, uint64_t keep,
+                                uint64_t all, size_t width)
+{
+        size_t n = 0;
+
+        if (keep == all) {
+                memcpy(dst, src, width);
+                return width;
+        }
+        while (keep) {
+                dst[n++] = src[__builtin_ctzll(keep)];
+                keep &= keep - 1;
+        }
+
+        return n;
+}
+
+__attribute__((target("sse4.2")))
+static size_t strip_space_sse42(char *dst, const char *src, size_t len)
+{
+        const __m128i set = _mm_setr_epi8(' ', '\t', '\n', '\r', 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+        size_t i, n = 0;
+
+        for (i = 0; i + 16 <= len; i += 16) {
+                __m128i b = _mm_loadu_si128((const __m128i *) (src + i));
+                __m128i m = _mm_cmpestrm(set, 4, b, 16, _SIDD_UBYTE_OPS |
+                                         _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+                uint64_t ws = (uint32_t) _mm_cvtsi128_si32(m);
+
+                n += keep_bytes(dst + n, src + i, ~ws & 0xffff, 0xffff, 16);
+        }
+
+        return n + strip_space_scalar(dst + n, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t strip_space_avx2(char *dst, const char *src, size_t len)
+{
+        const __m256i sp = _mm256_set1_epi8(' ');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const __m256i cr = _mm256_set1_epi8('\r');
+        size_t i, n = 0;
+
+        for (i = 0; i + 32 <= len; i += 32) {
+                __m256i b = _mm256_loadu_si256((const __m256i *) (src + i));
+                __m256i m = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(b, sp),
+                                        _mm256_cmpeq_epi8(b, tab)),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(b, lf),
+                                        _mm256_cmpeq_epi8(b, cr)));
+                uint64_t ws = (uint32_t) _mm256_movemask_epi8(m);
+
+                n += keep_bytes(dst + n, src + i, ~ws & 0xffffffffULL,
+                                0xffffffffULL, 32);
+        }
+
+        return n + strip_space_scalar(dst + n, src + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t strip_space_avx512(char *dst, const char *src, size_t len)
+{
+        const __m512i sp = _mm512_set1_epi8(' ');
+        const __m512i tab = _mm512_set1_epi8('\t');
+        const __m512i lf = _mm512_set1_epi8('\n');
+        const __m512i cr = _mm512_set1_epi8('\r');
+        size_t i, n = 0;
+
+        for (i = 0; i + 64 <= len; i += 64) {
+                __m512i b = _mm512_loadu_si512((const void *) (src + i));
+                uint64_t ws = _mm512_cmpeq_epi8_mask(b, sp) |
+                        _mm512_cmpeq_epi8_mask(b, tab) |
+                        _mm512_cmpeq_epi8_mask(b, lf) |
+                        _mm512_cmpeq_epi8_mask(b, cr);
+
+                n += keep_bytes(dst + n, src + i, ~ws, ~0ULL, 64);
+        }
+
+        return n + strip_space_scalar(dst + n, src + i, len - i);
+}
+#endif
+
+static int simd_supported(enum simd_level level)
+{
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+
+        switch (level) {
+        case SIMD_SCALAR: return 1;
+        case SIMD_SSE42: return __builtin_cpu_supports("sse4.2");
+        case SIMD_AVX2: return __builtin_cpu_supports("avx2");
+        case SIMD_AVX512: return __builtin_cpu_supports("avx512f") &&
+                        __builtin_cpu_supports("avx512bw");
+        default: return 0;
+        }
+#else
+        return level == SIMD_SCALAR;
+#endif
+}
+
+__attribute__((constructor))
+static void simd_init(void)
+{
+        enum simd_level level = SIMD_LEVELS - 1;
+        const char *env = getenv("XML2JSON_SIMD");
+        int i;
+
+        if (env != NULL && *env != '\0') {
+                for (i = 0; i < SIMD_LEVELS; i++)
+                        if (strcmp(env, simd_names[i]) == 0)
+                                break;
+                if (i == SIMD_LEVELS)
+                        fprintf(stderr, "xml2json: unknown XML2JSON_SIMD "
+                                "'%s', using the best available\n", env);
+                else
+                        level = i;
+        }
+
+        simd_select(level);
+}
+
+/* Public functions */
+enum simd_level simd_select(enum simd_level level)
+{
+        while (level > SIMD_SCALAR && !simd_supported(level))
+                level--;
+
+        switch (level) {
+#ifdef SIMD_X86
+        case SIMD_SSE42: simd_strip_space = strip_space_sse42; break;
+        case SIMD_AVX2: simd_strip_space = strip_space_avx2; break;
+        case SIMD_AVX512: simd_strip_space = strip_space_avx512; break;
+#endif
+        default: simd_strip_space = strip_space_scalar; break;
+        }
+        simd_level = level;
+
+        return level;
+}
+
+const char *simd_level_name(enum simd_level level)
+{
+        return level < SIMD_LEVELS ? simd_names[level] : "unknown";
+}
@@ -0,0 +1,52 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * simd - Byte kernels with scalar, SSE4.2, AVX2 and AVX-512 versions.
+ *
+ * The best version the CPU supports is picked once at startup, so the same
+ * binary runs everywhere. XML2JSON_SIMD=scalar|sse4.2|avx2|avx512 caps the
+ * choice, for testing and for comparing the kernels against each other.
+ */
+
+#ifndef XML2JSON_SIMD_H
+#define XML2JSON_SIMD_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum simd_level {
+        SIMD_SCALAR,
+        SIMD_SSE42,
+        SIMD_AVX2,
+        SIMD_AVX512,
+        SIMD_LEVELS,
+};
+
+extern enum simd_level simd_level;
+
+/* simd_strip_space():
+ * Copy `len` bytes from `src` to `dst` leaving out XML white space (space,
+ * tab, CR and LF) and return the number of bytes written. `dst` must have
+ * room for `len` bytes, it may not overlap `src`.
+ */
+extern size_t (*simd_strip_space)(char *dst, const char *src, size_t len);
+
+/* simd_select():
+ * Switch the kernels to `level`, or the best level below it that the CPU
+ * supports. Returns the level in use. Done automatically at startup.
+ */
+enum simd_level simd_select(enum simd_level level);
+
+/* simd_level_name():
+ * Name of a level, as accepted in XML2JSON_SIMD.
+ */
+const char *simd_level_name(enum simd_level level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_SIMD_H */
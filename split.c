@@ -0,0 +1,805 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * split - Streams of many XML documents, converted to NDJSON.
+ *
+ * The calling thread finds the documents and hands them to the scheduler
+ * (see scheduler.h), up to a window of them at a time. Each converts into
+ * memory of its own, and the calling thread writes them out in order as
+ * they complete.
+ */
+
+#include "input.h"
+#include "output.h"
+#include "scheduler.h"
+#include "split.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Documents in flight per converter thread, converted but not written */
+#define SPLIT_WINDOW_PER_JOB 4
+
+#define SPLIT_ERROR_MAX 256
+
+struct split_run {
+        const struct split_opts *opts;
+        const char *buf;
+        const char *name;
+        const char *what;               /* "document" or "record" */
+        FILE *errors;
+
+        /* Lines are counted up to where the last failure was reported */
+        size_t line_off;
+        unsigned long line;
+
+        pthread_mutex_t lock;
+        pthread_cond_t cond;            /* a document is converted */
+};
+
+struct split_doc {
+        struct sched_job job;
+        struct split_run *run;
+        size_t index;
+        size_t off;
+        struct output out;
+        int ret;
+        int done;
+        unsigned long line;             /* of the failure, in the document */
+        char error[SPLIT_ERROR_MAX];
+};
+
+/* Private functions */
+static int is_space(char c)
+{
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Just past the first `s` from `p` on, NULL if there is none */
+static const char *skip_past(const char *p, const char *end, const char *s)
+{
+        size_t n = strlen(s);
+        const char *q = memmem(p, end - p, s, n);
+
+        return q ? q + n : NULL;
+}
+
+/* Just past the '>' closing a tag, skipping quoted attribute values.
+ * `*empty` tells a <tag/> apart. A '<', which may not appear in a tag, ends
+ * a broken one there, so that one bad tag does not swallow the input; it
+ * counts as empty, with `*empty` -1. */
+static const char *skip_tag(const char *p, const char *end, int *empty)
+{
+        const char *start = p;
+        char quote = 0;
+
+        *empty = 0;
+        for (; p < end; p++) {
+                if (*p == '<') {
+                        *empty = -1;
+                        return p;
+                } else if (quote) {
+                        if (*p == quote)
+                                quote = 0;
+                } else if (*p == '"' || *p == '\'') {
+                        quote = *p;
+                } else if (*p == '>') {
+                        *empty = p > start && p[-1] == '/';
+                        return p + 1;
+                }
+        }
+
+        return NULL;
+}
+
+/* Just past a <!DOCTYPE ...> or other declaration, internal subset and
+ * all */
+static const char *skip_decl(const char *p, const char *end)
+{
+        char quote = 0;
+        int brackets = 0;
+
+        for (; p < end; p++) {
+                if (quote) {
+                        if (*p == quote)
+                                quote = 0;
+                } else if (*p == '"' || *p == '\'') {
+                        quote = *p;
+                } else if (*p == '[') {
+                        brackets++;
+                } else if (*p == ']') {
+                        brackets--;
+                } else if (*p == '>' && brackets <= 0) {
+                        return p + 1;
+                }
+        }
+
+        return NULL;
+}
+
+/* Just past the markup at `p` if it is a processing instruction, comment,
+ * CDATA section or declaration, `p` itself if it is a tag and NULL if it
+ * does not end */
+static const char *skip_markup(const char *p, const char *end)
+{
+        size_t left = end - p;
+
+        if (left >= 2 && p[1] == '?')
+                return skip_past(p + 2, end, "?>");
+        if (left >= 4 && !memcmp(p, "<!--", 4))
+                return skip_past(p + 4, end, "-->");
+        if (left >= 9 && !memcmp(p, "<![CDATA[", 9))
+                return skip_past(p + 9, end, "]]>");
+        if (left >= 2 && p[1] == '!')
+                return skip_decl(p + 2, end);
+
+        return p;
+}
+
+/* Whether the tag name at `p` is the `len` bytes at `name` */
+static int name_is(const char *p, const char *end, const char *name,
+                   size_t len)
+{
+        if ((size_t) (end - p) < len || memcmp(p, name, len))
+                return 0;
+
+        p += len;
+        return p == end || is_space(*p) || *p == '>' || *p == '/';
+}
+
+static size_t name_len(const char *p, const char *end)
+{
+        const char *q = p;
+
+        while (q < end && !is_space(*q) && *q != '>' && *q != '/' &&
+               *q != '<')
+                q++;
+
+        return q - p;
+}
+
+/*
+ * Just past the element that starts at or after `p`, NULL if the input ends
+ * first. Only markup is looked at, text is skipped with memchr().
+ *
+ * Tags are not matched up, but the end tag of the element's own name ends
+ * it even when some child is left open, so that a broken element is cut
+ * off where it was meant to end and the next one is found. `*clean` tells
+ * whether it ended that way, on its own end tag, without broken tags.
+ */
+static const char *element_end(const char *p, const char *end, int *clean)
+{
+        const char *name = NULL, *q;
+        size_t namelen = 0;
+        int depth = 0, same = 0, empty, own;
+
+        *clean = 1;
+
+        while ((p = memchr(p, '<', end - p)) != NULL) {
+                q = skip_markup(p, end);
+                if (q == NULL)
+                        return NULL;
+                if (q != p) {
+                        p = q;
+                        continue;
+                }
+
+                if (p + 1 < end && p[1] == '/') {
+                        q = skip_tag(p + 2, end, &empty);
+                        if (q == NULL)
+                                return NULL;
+                        own = name != NULL &&
+                                name_is(p + 2, end, name, namelen);
+                        if (own)
+                                same--;
+                        if (empty < 0)
+                                *clean = 0;
+                        if (--depth <= 0 || same <= 0) {
+                                if (depth || !own)
+                                        *clean = 0;
+                                return q;
+                        }
+                } else {
+                        q = skip_tag(p + 1, end, &empty);
+                        if (q == NULL)
+                                return NULL;
+                        if (empty < 0)
+                                *clean = 0;
+                        if (name == NULL) {
+                                name = p + 1;
+                                namelen = name_len(name, end);
+                        }
+                        if (!empty) {
+                                depth++;
+                                if (name_is(p + 1, end, name, namelen))
+                                        same++;
+                        } else if (depth == 0) {
+                                return q;
+                        }
+                }
+                p = q;
+        }
+
+        return NULL;
+}
+
+/* The first start or end tag from `p` on, or an XML declaration, skipping
+ * other markup and text. NULL if there is none. */
+static const char *first_tag(const char *p, const char *end)
+{
+        const char *q;
+
+        while ((p = memchr(p, '<', end - p)) != NULL) {
+                if (name_is(p + 1, end, "?xml", 4))
+                        return p;
+                q = skip_markup(p, end);
+                if (q == NULL)
+                        return NULL;
+                if (q == p)
+                        return p;
+                p = q;
+        }
+
+        return NULL;
+}
+
+/* The first tag at or after `pos` a shard may start on, the end of the
+ * input if there is none */
+static size_t sync_at(struct split *sp, size_t pos)
+{
+        const char *p = sp->buf + pos, *end = sp->buf + sp->len;
+        struct split walk;
+        size_t off, len;
+
+        if (sp->mode == SPLIT_LENGTH) {
+                split_init(&walk, SPLIT_LENGTH, sp->buf, sp->len);
+                while (walk.pos < pos && split_next(&walk, &off, &len) > 0)
+                        ;
+                return walk.pos;
+        }
+
+        if (sp->sync == NULL)
+                return sp->len;
+
+        while ((p = memchr(p, '<', end - p)) != NULL) {
+                if (name_is(p + 1, end, sp->sync, sp->synclen))
+                        return p - sp->buf;
+                p++;
+        }
+
+        return sp->len;
+}
+
+/* len * index / count, without overflowing */
+static size_t shard_start(size_t len, unsigned int index, unsigned int count)
+{
+        return len / count * index + len % count * index / count;
+}
+
+/* Move past the prolog and the root element's start tag. Returns 0 if
+ * there are no records to find, -1 if the input ends first. */
+static int enter_root(struct split *sp)
+{
+        const char *p = sp->buf + sp->pos, *end = sp->buf + sp->len, *q;
+        int empty;
+
+        while ((p = memchr(p, '<', end - p)) != NULL) {
+                q = skip_markup(p, end);
+                if (q == NULL)
+                        break;
+                if (q != p) {
+                        p = q;
+                        continue;
+                }
+
+                q = skip_tag(p + 1, end, &empty);
+                if (q == NULL)
+                        break;
+                sp->pos = q - sp->buf;
+                sp->in_root = 1;
+                sp->root = p + 1;
+                sp->rootlen = name_len(p + 1, end);
+                return empty ? 0 : 1;
+        }
+
+        return -1;
+}
+
+/* The next child of the root element, see split_next() */
+static int next_record(struct split *sp, size_t *off, size_t *len)
+{
+        const char *p = sp->buf + sp->pos, *end = sp->buf + sp->len, *q;
+        int ret, clean, empty;
+
+        if (!sp->in_root) {
+                ret = enter_root(sp);
+                if (ret <= 0) {
+                        *off = sp->pos;
+                        *len = sp->len - sp->pos;
+                        sp->pos = sp->len;
+                        return ret;
+                }
+                p = sp->buf + sp->pos;
+        }
+
+        /* Text and other markup between records is skipped */
+        while ((p = memchr(p, '<', end - p)) != NULL) {
+                q = skip_markup(p, end);
+                if (q == NULL)
+                        break;
+                if (q != p) {
+                        p = q;
+                        continue;
+                }
+
+                /* The next shard starts */
+                if ((size_t) (p - sp->buf) >= sp->stop) {
+                        sp->pos = sp->len;
+                        return 0;
+                }
+
+                if (p + 1 < end && p[1] == '/') {
+                        /* Only the root's own end tag ends it */
+                        if (sp->root == NULL ||
+                            name_is(p + 2, end, sp->root, sp->rootlen)) {
+                                sp->pos = sp->len;
+                                return 0;
+                        }
+                        /* A shard that started inside a record meets the end
+                         * of it */
+                        if (sp->synced && sp->resync == NULL) {
+                                sp->error = "the shard starts inside a "
+                                        "record, which ends here";
+                                break;
+                        }
+                        /* Any other is left over from a broken record */
+                        q = skip_tag(p + 2, end, &empty);
+                        if (q == NULL)
+                                break;
+                        p = q;
+                        continue;
+                }
+
+                /* After a broken record, what is left of it is skipped up
+                 * to the next start tag of the same name */
+                if (sp->resync != NULL &&
+                    !name_is(p + 1, end, sp->resync, sp->resynclen)) {
+                        q = skip_tag(p + 1, end, &empty);
+                        if (q == NULL)
+                                break;
+                        p = q;
+                        continue;
+                }
+
+                *off = p - sp->buf;
+                q = element_end(p, end, &clean);
+                if (q == NULL)
+                        break;
+                if ((size_t) (q - sp->buf) > sp->stop) {
+                        sp->error = "the next shard starts inside it";
+                        break;
+                }
+                *len = q - p;
+                sp->pos = q - sp->buf;
+                sp->resync = clean ? NULL : p + 1;
+                sp->resynclen = clean ? 0 : name_len(p + 1, end);
+                return 1;
+        }
+
+        *off = p ? (size_t) (p - sp->buf) : sp->pos;
+        *len = sp->len - *off;
+        sp->pos = sp->len;
+        return -1;
+}
+
+static void convert_doc(struct sched_job *job)
+{
+        struct split_doc *d = job->data;
+        struct split_run *run = d->run;
+
+        output_init_mem(&d->out);
+        d->ret = run->opts->convert(run->buf + d->off, job->size, run->name,
+                                    &d->out, run->opts->convert_data);
+        if (d->ret < 0) {
+                d->line = 1;
+                strcpy(d->error, "conversion failed");
+                if (run->opts->last_error != NULL)
+                        run->opts->last_error(d->error, SPLIT_ERROR_MAX,
+                                              &d->line,
+                                              run->opts->convert_data);
+        }
+
+        pthread_mutex_lock(&run->lock);
+        d->done = 1;
+        pthread_cond_signal(&run->cond);
+        pthread_mutex_unlock(&run->lock);
+}
+
+/* Report a failure at `off`, on line `line` counted from there */
+static void report(struct split_run *run, size_t index, size_t off,
+                   unsigned long line, const char *msg)
+{
+        const char *p = run->buf + run->line_off, *end = run->buf + off;
+
+        while ((p = memchr(p, '\n', end - p)) != NULL) {
+                run->line++;
+                p++;
+        }
+        run->line_off = off;
+
+        /* A shard does not know how many came before its range */
+        if (run->opts->shards > 1)
+                fprintf(run->errors, "%s:%lu: %s at byte %zu: %s\n",
+                        run->name, run->line + line - 1, run->what, off, msg);
+        else
+                fprintf(run->errors, "%s:%lu: %s %zu at byte %zu: %s\n",
+                        run->name, run->line + line - 1, run->what,
+                        index + 1, off, msg);
+}
+
+/* Public functions */
+int split_parse_mode(const char *name, enum split_mode *mode)
+{
+        if (!strcmp(name, "length"))
+                *mode = SPLIT_LENGTH;
+        else if (!strcmp(name, "documents"))
+                *mode = SPLIT_DOCUMENTS;
+        else if (!strcmp(name, "records"))
+                *mode = SPLIT_RECORDS;
+        else
+                return -1;
+
+        return 0;
+}
+
+void split_init(struct split *sp, enum split_mode mode, const char *buf,
+                size_t len)
+{
+        sp->mode = mode;
+        sp->buf = buf;
+        sp->len = len;
+        sp->pos = 0;
+        sp->stop = SIZE_MAX;
+        sp->in_root = 0;
+        sp->root = NULL;
+        sp->rootlen = 0;
+        sp->resync = NULL;
+        sp->resynclen = 0;
+        sp->synced = 0;
+        sp->error = NULL;
+        sp->sync = NULL;
+        sp->synclen = 0;
+}
+
+int split_next(struct split *sp, size_t *off, size_t *len)
+{
+        const unsigned char *p;
+        const char *end;
+        const char *tag;
+        uint32_t n;
+        int clean;
+
+        if (sp->pos >= sp->stop)
+                return 0;
+
+        if (sp->mode == SPLIT_LENGTH) {
+                if (sp->pos == sp->len)
+                        return 0;
+
+                p = (const unsigned char *) sp->buf + sp->pos;
+                n = 0;
+                if (sp->len - sp->pos >= SPLIT_LENGTH_SIZE)
+                        n = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+                                (uint32_t) p[2] << 8 | p[3];
+                if (sp->len - sp->pos < SPLIT_LENGTH_SIZE ||
+                    n > sp->len - sp->pos - SPLIT_LENGTH_SIZE) {
+                        *off = sp->pos;
+                        *len = sp->len - sp->pos;
+                        sp->pos = sp->len;
+                        return -1;
+                }
+
+                *off = sp->pos + SPLIT_LENGTH_SIZE;
+                *len = n;
+                sp->pos = *off + n;
+                return 1;
+        }
+
+        if (sp->mode == SPLIT_RECORDS)
+                return next_record(sp, off, len);
+
+        while (sp->pos < sp->len && is_space(sp->buf[sp->pos]))
+                sp->pos++;
+        if (sp->pos == sp->len)
+                return 0;
+
+        /* A document belongs to the shard its declaration or root element
+         * is in, not its leading comments */
+        if (sp->stop < sp->len) {
+                tag = first_tag(sp->buf + sp->pos, sp->buf + sp->len);
+                if (tag != NULL && (size_t) (tag - sp->buf) >= sp->stop) {
+                        sp->pos = sp->len;
+                        return 0;
+                }
+        }
+
+        *off = sp->pos;
+        end = element_end(sp->buf + sp->pos, sp->buf + sp->len, &clean);
+        if (end == NULL || (size_t) (end - sp->buf) > sp->stop) {
+                if (end != NULL)
+                        sp->error = "the next shard starts inside it";
+                *len = sp->len - sp->pos;
+                sp->pos = sp->len;
+                return -1;
+        }
+
+        *len = end - (sp->buf + sp->pos);
+        sp->pos += *len;
+        return 1;
+}
+
+const char *split_attr(const char *buf, size_t len, const char *name,
+                       size_t *vlen)
+{
+        const char *p, *end = buf + len, *tag_end, *attr, *value;
+        size_t n = strlen(name), attrlen;
+        int empty;
+
+        /* Past an XML declaration, to the first element */
+        p = first_tag(buf, end);
+        if (p != NULL && name_is(p + 1, end, "?xml", 4) &&
+            (p = skip_past(p + 5, end, "?>")) != NULL)
+                p = first_tag(p, end);
+        if (p == NULL || p[1] == '/' ||
+            (tag_end = skip_tag(p + 1, end, &empty)) == NULL)
+                return NULL;
+
+        p += 1 + name_len(p + 1, end);
+        for (;;) {
+                while (p < tag_end && is_space(*p))
+                        p++;
+                attr = p;
+                while (p < tag_end && *p != '=' && !is_space(*p) &&
+                       *p != '>' && *p != '/')
+                        p++;
+                attrlen = p - attr;
+                while (p < tag_end && is_space(*p))
+                        p++;
+                if (!attrlen || p == tag_end || *p != '=')
+                        return NULL;
+                p++;
+                while (p < tag_end && is_space(*p))
+                        p++;
+                if (p == tag_end || (*p != '"' && *p != '\''))
+                        return NULL;
+
+                value = p + 1;
+                p = memchr(value, *p, tag_end - value);
+                if (p == NULL)
+                        return NULL;
+                if (attrlen == n && !memcmp(attr, name, n)) {
+                        *vlen = p - value;
+                        return value;
+                }
+                p++;
+        }
+}
+
+int split_parse_shard(const char *spec, unsigned int *index,
+                      unsigned int *count)
+{
+        unsigned long i, n;
+        char *end;
+
+        i = strtoul(spec, &end, 10);
+        if (end == spec || *end != '/')
+                return -1;
+        spec = end + 1;
+        n = strtoul(spec, &end, 10);
+        if (end == spec || *end != '\0' || i < 1 || i > n || n > UINT_MAX)
+                return -1;
+
+        *index = i - 1;
+        *count = n;
+        return 0;
+}
+
+void split_shard(struct split *sp, unsigned int index, unsigned int count)
+{
+        struct split head;
+        const char *tag;
+
+        /* The first record or document names the tag to look for */
+        if (sp->mode != SPLIT_LENGTH) {
+                split_init(&head, sp->mode, sp->buf, sp->len);
+                if (sp->mode != SPLIT_RECORDS || enter_root(&head) > 0) {
+                        sp->root = head.root;
+                        sp->rootlen = head.rootlen;
+                        tag = first_tag(sp->buf + head.pos,
+                                        sp->buf + sp->len);
+                        if (tag != NULL && tag[1] != '/') {
+                                sp->sync = tag + 1;
+                                sp->synclen = name_len(tag + 1,
+                                                       sp->buf + sp->len);
+                        }
+                }
+        }
+
+        if (index > 0) {
+                sp->pos = sync_at(sp, shard_start(sp->len, index, count));
+                sp->in_root = 1;
+                sp->synced = sp->mode != SPLIT_LENGTH;
+        }
+        if (index + 1 < count)
+                sp->stop = sync_at(sp, shard_start(sp->len, index + 1,
+                                                   count));
+        else
+                sp->stop = sp->len;
+}
+
+int split_run(const struct split_opts *opts, struct input *in,
+              const char *name, struct output *out)
+{
+        struct split_run run;
+        struct split_doc *docs, *d;
+        struct sched_opts sopts;
+        struct sched s;
+        struct split sp;
+        size_t window, head = 0, pending = 0, index = 0, off = 0, len = 0;
+        size_t written = 0;
+        int failed = 0, next = 0, end = 0, incomplete = 0;
+
+        memset(&run, 0, sizeof(struct split_run));
+        run.opts = opts;
+        run.buf = in->base;
+        run.name = name;
+        run.what = opts->mode == SPLIT_RECORDS ? "record" : "document";
+        run.errors = opts->errors ? opts->errors : stderr;
+        run.line = 1;
+        pthread_mutex_init(&run.lock, NULL);
+        pthread_cond_init(&run.cond, NULL);
+
+        memset(&sopts, 0, sizeof(struct sched_opts));
+        sopts.jobs = opts->jobs;
+        sopts.small_max = opts->small_max;
+        sopts.max_inflight = opts->max_inflight;
+        sopts.thread_done = opts->thread_done;
+        sopts.data = opts->convert_data;
+        sched_init(&s, &sopts);
+
+        window = (size_t) s.opts.jobs * SPLIT_WINDOW_PER_JOB;
+        ALLOC_ARRAY(docs, window);
+
+        split_init(&sp, opts->mode, in->base, in->size);
+        if (opts->shards > 1) {
+                split_shard(&sp, opts->shard, opts->shards);
+                input_consumed(in, sp.pos);
+        }
+        for (;;) {
+                /* Keep the converters busy, as far as the window and the
+                 * bytes in flight allow */
+                while (!end && pending < window) {
+                        if (opts->limit && written + pending >= opts->limit)
+                                break;
+                        if (!next) {
+                                next = split_next(&sp, &off, &len);
+                                incomplete = next < 0;
+                                if (next <= 0) {
+                                        end = 1;
+                                        break;
+                                }
+                        }
+                        if (sched_admit(&s, len, 0) < 0)
+                                break;
+                        next = 0;
+
+                        d = &docs[(head + pending) % window];
+                        memset(d, 0, sizeof(struct split_doc));
+                        d->run = &run;
+                        d->index = index++;
+                        d->off = off;
+                        d->job.size = len;
+                        d->job.run = convert_doc;
+                        d->job.data = d;
+                        sched_submit(&s, &d->job);
+                        pending++;
+                }
+                if (!pending)
+                        break;
+
+                d = &docs[head];
+                pthread_mutex_lock(&run.lock);
+                while (!d->done)
+                        pthread_cond_wait(&run.cond, &run.lock);
+                pthread_mutex_unlock(&run.lock);
+
+                if (d->ret < 0) {
+                        report(&run, d->index, d->off, d->line, d->error);
+                        failed++;
+                } else {
+                        output_add(out, d->out.buf, d->out.len);
+                        written++;
+                }
+                output_release(&d->out);
+                sched_release(&s, d->job.size);
+                input_consumed(in, d->off + d->job.size);
+
+                head = (head + 1) % window;
+                pending--;
+        }
+
+        /* Nothing more can be found after input that does not end */
+        if (incomplete) {
+                report(&run, index, off, 1,
+                       sp.error ? sp.error : "input ends inside it");
+                failed++;
+        }
+        fflush(run.errors);
+
+        sched_free(&s);
+        xfree(docs);
+        pthread_mutex_destroy(&run.lock);
+        pthread_cond_destroy(&run.cond);
+
+        return failed;
+}
+
+int split_merge(char **paths, int nparts, int array, struct output *out,
+                const char **failed)
+{
+        struct input in;
+        struct stat sb;
+        const char *p, *end, *nl;
+        int i, fd, first = 1;
+
+        if (array)
+                output_addch(out, '[');
+
+        for (i = 0; i < nparts; i++) {
+                *failed = paths[i];
+
+                /* Lines go as they are, without passing through here */
+                if (!array) {
+                        if ((fd = open(paths[i], O_RDONLY)) < 0)
+                                return -1;
+                        if (fstat(fd, &sb) < 0 ||
+                            output_copy_fd(out, fd, 0, sb.st_size) < 0) {
+                                close(fd);
+                                return -1;
+                        }
+                        close(fd);
+                        continue;
+                }
+
+                if (input_open(&in, paths[i], INPUT_SEQUENTIAL, 0) < 0)
+                        return -1;
+                p = in.base;
+                end = in.base + in.size;
+                for (; p < end; p = nl + 1) {
+                        nl = memchr(p, '\n', end - p);
+                        if (nl == NULL)
+                                nl = end;
+                        if (nl == p)
+                                continue;
+                        if (!first)
+                                output_addch(out, ',');
+                        output_add(out, p, nl - p);
+                        first = 0;
+                }
+                input_close(&in);
+        }
+
+        if (array)
+                output_add(out, "]\n", 2);
+        *failed = NULL;
+
+        return 0;
+}
@@ -0,0 +1,167 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * split - Streams of many XML documents, converted to NDJSON.
+ *
+ * Message bus dumps hold many documents in one file, either each behind a
+ * 32 bit big-endian length (as in the daemon protocol, see serve.h) or
+ * simply back to back, where a document ends with its root element. Large
+ * exports are one document whose records, the children of the root element,
+ * can be converted on their own. Every document or record becomes one line
+ * of output, in input order, whichever thread converted it.
+ *
+ * A document or record that does not convert leaves no line. It is
+ * reported with its byte offset and line number and the rest carry on.
+ *
+ * One file can also be shared out between processes, each converting the
+ * documents or records that start in its slice of the bytes into a part of
+ * its own, and the parts merged afterwards.
+ */
+
+#ifndef XML2JSON_SPLIT_H
+#define XML2JSON_SPLIT_H
+
+#include "batch.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct input;
+struct output;
+
+enum split_mode {
+        SPLIT_LENGTH,           /* a length before every document */
+        SPLIT_DOCUMENTS,        /* documents back to back */
+        SPLIT_RECORDS,          /* the children of the root element */
+};
+
+#define SPLIT_LENGTH_SIZE 4
+
+struct split {
+        enum split_mode mode;
+        const char *buf;
+        size_t len;
+        size_t pos;             /* where the next document is looked for */
+        size_t stop;            /* none starting here or later is found */
+        int in_root;            /* records: past the root's start tag */
+        const char *root;       /* records: the root element's name */
+        size_t rootlen;
+        const char *resync;     /* records: after a broken one, the name
+                                 * of the next one to look for */
+        size_t resynclen;
+        int synced;             /* started at a sync point, see below */
+        const char *error;      /* why split_next() returned -1, if not
+                                 * for the end of the input */
+
+        /* Shards: the tag name every shard resynchronises on */
+        const char *sync;
+        size_t synclen;
+};
+
+/* split_parse_mode():
+ * "length", "documents" or "records". Returns 0 on success, -1 on an unknown mode.
+ */
+int split_parse_mode(const char *name, enum split_mode *mode);
+
+/* split_init():
+ * Start splitting the `len` bytes at `buf`.
+ */
+void split_init(struct split *sp, enum split_mode mode, const char *buf,
+                size_t len);
+
+/* split_next():
+ * Find the next document or record and return its offset and length in
+ * `*off` and `*len`. Returns 1 if there is one, 0 at the end of the input
+ * and -1 if the rest of the input is not a complete document, record or
+ * frame, in which case `*off` is where it starts.
+ *
+ * Documents and records are found by looking at markup only, they are not
+ * checked. A broken one is still cut off where its element ends. Should it
+ * end anywhere else, what is left of a broken record is skipped up to the
+ * next start tag of its name, and only the root's own end tag ends the
+ * records.
+ */
+int split_next(struct split *sp, size_t *off, size_t *len);
+
+/* split_attr():
+ * The value of attribute `name` on the first element of the `len` bytes at
+ * `buf`, as it is written there, entities and all, with its length in
+ * `*vlen`. NULL if there is no such attribute.
+ */
+const char *split_attr(const char *buf, size_t len, const char *name,
+                       size_t *vlen);
+
+/* split_parse_shard():
+ * Parse "i/N", the i-th of N shards counting from 1, into a 0 based
+ * `*index` and `*count`. Returns 0 on success, -1 if it is not one.
+ */
+int split_parse_shard(const char *spec, unsigned int *index,
+                      unsigned int *count);
+
+/* split_shard():
+ * Only find the documents or records of the `index`th of `count` equal
+ * byte ranges of the input, those that start in it, whichever shard
+ * converts the ones around it.
+ *
+ * A shard moves on from the start of its range to the next tag of the
+ * same name as the first record, or to the next XML declaration or root
+ * element of the same name as the first document. Length-prefixed frames
+ * are walked from the start of the input, reading their lengths only.
+ *
+ * Where that name also appears inside records or documents, a shard may
+ * start inside one. split_next() then returns -1, with `error` set, in the
+ * shard before, on the one that runs past the end of its range, and in this
+ * shard, for records, on reaching the end tag of the one it started in.
+ */
+void split_shard(struct split *sp, unsigned int index, unsigned int count);
+
+struct split_opts {
+        enum split_mode mode;
+        unsigned int jobs;        /* converter threads */
+        size_t small_max;         /* scheduler lanes, see scheduler.h */
+        size_t max_inflight;
+        size_t limit;             /* stop after this many lines, 0 for all */
+        unsigned int shard;       /* convert only shard `shard` of `shards` */
+        unsigned int shards;
+        batch_convert_fn convert;
+        const void *convert_data;
+        void (*thread_done)(const void *convert_data);
+
+        /* Describe why `convert` just failed on this thread, and on which
+         * line of the document or record */
+        void (*last_error)(char *msg, size_t size, unsigned long *line,
+                           const void *convert_data);
+        FILE *errors;             /* where failures go, stderr if NULL */
+};
+
+/* split_run():
+ * Convert every document or record of `in` into a line of `out`, in order,
+ * on `opts->jobs` threads. Failures are written to `opts->errors` as
+ * "<name>:<line>: <what> <n> at byte <offset>: <message>", without <n>
+ * for a shard. Returns the number of documents or records that failed.
+ *
+ * With `opts->limit`, no more documents are looked for once that many
+ * lines are written or on their way, so the rest of the input is never
+ * read. Those that fail do not count towards it.
+ */
+int split_run(const struct split_opts *opts, struct input *in,
+              const char *name, struct output *out);
+
+/* split_merge():
+ * Write the `nparts` parts at `paths` written by the shards of a file, in
+ * order, to `out`: as they are, one JSON line after another, or with
+ * `array` as one JSON array. Returns 0 on success, -1 with errno set and
+ * `*failed` pointing to the part that could not be read.
+ */
+int split_merge(char **paths, int nparts, int array, struct output *out,
+                const char **failed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_SPLIT_H */
@@ -0,0 +1,407 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * stats - Per phase timing and counters for --stats.
+ */
+
+#include "simd.h"
+#include "stats.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+int stats_enabled;
+int stats_perf_enabled;
+__thread struct stats_counters stats_local;
+__thread struct alloc_stats stats_xml_allocs;
+
+static const char *phase_names[STATS_PHASES] = {
+        "input",
+        "parse",
+        "validate",
+        "xsd",
+        "convert",
+        "encode",
+        "write",
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_counters stats_total;
+static struct alloc_stats alloc_total;
+static struct alloc_stats xml_alloc_total;
+static struct timespec stats_epoch;
+
+/* Private functions */
+static uint64_t ts_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+        return (uint64_t) (b->tv_sec - a->tv_sec) * 1000000000ULL +
+                b->tv_nsec - a->tv_nsec;
+}
+
+static double tv_ms(const struct timeval *tv)
+{
+        return tv->tv_sec * 1000.0 + tv->tv_usec / 1000.0;
+}
+
+/* Public functions */
+void stats_init(void)
+{
+        stats_enabled = 1;
+        alloc_stats_enabled = 1;
+        clock_gettime(CLOCK_MONOTONIC, &stats_epoch);
+}
+
+int stats_init_perf(void)
+{
+        stats_init();
+        if (perf_init() == 0)
+                return -1;
+
+        stats_perf_enabled = 1;
+        return 0;
+}
+
+void stats_stop(struct stats_timer *t, enum stats_phase phase)
+{
+        struct timespec wall, cpu;
+        int c;
+
+        if (!stats_enabled)
+                return;
+
+        if (stats_perf_enabled) {
+                struct perf_sample now;
+
+                perf_read(&now);
+                for (c = 0; c < PERF_COUNTERS; c++)
+                        stats_local.perf[phase][c] += now.v[c] - t->perf.v[c];
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &wall);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        stats_local.wall_ns[phase] += ts_diff_ns(&t->wall, &wall);
+        stats_local.cpu_ns[phase] += ts_diff_ns(&t->cpu, &cpu);
+}
+
+void stats_thread_done(void)
+{
+        int i, c, l;
+
+        if (!stats_enabled)
+                return;
+
+        pthread_mutex_lock(&stats_lock);
+        for (i = 0; i < STATS_PHASES; i++) {
+                stats_total.wall_ns[i] += stats_local.wall_ns[i];
+                stats_total.cpu_ns[i] += stats_local.cpu_ns[i];
+                for (c = 0; c < PERF_COUNTERS; c++)
+                        stats_total.perf[i][c] += stats_local.perf[i][c];
+        }
+        stats_total.docs += stats_local.docs;
+        stats_total.bytes_in += stats_local.bytes_in;
+        stats_total.bytes_out += stats_local.bytes_out;
+        stats_total.nodes += stats_local.nodes;
+        stats_total.attributes += stats_local.attributes;
+        stats_total.texts += stats_local.texts;
+        stats_total.cache_hits += stats_local.cache_hits;
+        stats_total.cache_misses += stats_local.cache_misses;
+        stats_total.cache_evicted += stats_local.cache_evicted;
+        stats_total.lock_acquires += stats_local.lock_acquires;
+        stats_total.lock_contended += stats_local.lock_contended;
+        stats_total.lock_wait_ns += stats_local.lock_wait_ns;
+        stats_total.idle_ns += stats_local.idle_ns;
+        stats_total.queue_samples += stats_local.queue_samples;
+        stats_total.queue_depth += stats_local.queue_depth;
+        if (stats_local.queue_max > stats_total.queue_max)
+                stats_total.queue_max = stats_local.queue_max;
+        for (l = 0; l < SCHED_LANES; l++) {
+                for (i = 0; i < STATS_LATENCY_BUCKETS; i++)
+                        stats_total.latency[l][i] += stats_local.latency[l][i];
+                if (stats_local.latency_max_ns[l] >
+                    stats_total.latency_max_ns[l])
+                        stats_total.latency_max_ns[l] =
+                                stats_local.latency_max_ns[l];
+        }
+
+        alloc_total.mallocs += alloc_stats.mallocs;
+        alloc_total.reallocs += alloc_stats.reallocs;
+        alloc_total.frees += alloc_stats.frees;
+        alloc_total.bytes += alloc_stats.bytes;
+        xml_alloc_total.mallocs += stats_xml_allocs.mallocs;
+        xml_alloc_total.reallocs += stats_xml_allocs.reallocs;
+        xml_alloc_total.frees += stats_xml_allocs.frees;
+        xml_alloc_total.bytes += stats_xml_allocs.bytes;
+        pthread_mutex_unlock(&stats_lock);
+
+        memset(&stats_local, 0, sizeof(struct stats_counters));
+        memset(&alloc_stats, 0, sizeof(struct alloc_stats));
+        memset(&stats_xml_allocs, 0, sizeof(struct alloc_stats));
+
+        if (stats_perf_enabled)
+                perf_thread_done();
+}
+
+static double ratio(uint64_t a, uint64_t b)
+{
+        return b ? (double) a / b : 0;
+}
+
+/* Upper bound of the latency bucket holding the `p` percentile, in ms */
+static double latency_pct(const uint64_t *hist, uint64_t n, double p)
+{
+        uint64_t seen = 0, rank = (uint64_t) (p / 100 * n + 0.5);
+        int i;
+
+        if (rank < 1)
+                rank = 1;
+        for (i = 0; i < STATS_LATENCY_BUCKETS - 1; i++) {
+                seen += hist[i];
+                if (seen >= rank)
+                        break;
+        }
+
+        return (1ULL << i) / 1e3;
+}
+
+/* Latency histogram of every scheduler lane that ran a job */
+static void report_latency(FILE *f, int json)
+{
+        const struct stats_counters *s = &stats_total;
+        int l, i, first = 1;
+
+        for (l = 0; l < SCHED_LANES; l++) {
+                const uint64_t *hist = s->latency[l];
+                uint64_t n = 0;
+
+                for (i = 0; i < STATS_LATENCY_BUCKETS; i++)
+                        n += hist[i];
+                if (!n)
+                        continue;
+
+                if (json) {
+                        int sep = 0;
+
+                        fprintf(f, "%s\"%s\":{\"jobs\":%llu,\"p50_ms\":%.3f,"
+                                "\"p90_ms\":%.3f,\"p99_ms\":%.3f,"
+                                "\"max_ms\":%.3f,\"hist_us\":{",
+                                first ? ",\"lanes\":{" : ",",
+                                sched_lane_name(l), (unsigned long long) n,
+                                latency_pct(hist, n, 50),
+                                latency_pct(hist, n, 90),
+                                latency_pct(hist, n, 99),
+                                s->latency_max_ns[l] / 1e6);
+                        for (i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+                                if (!hist[i])
+                                        continue;
+                                fprintf(f, "%s\"%llu\":%llu", sep ? "," : "",
+                                        1ULL << i,
+                                        (unsigned long long) hist[i]);
+                                sep = 1;
+                        }
+                        fprintf(f, "}}");
+                } else {
+                        fprintf(f, "lane %s:  %llu jobs, p50 < %.3f ms, "
+                                "p90 < %.3f ms, p99 < %.3f ms, max %.3f ms\n",
+                                sched_lane_name(l), (unsigned long long) n,
+                                latency_pct(hist, n, 50),
+                                latency_pct(hist, n, 90),
+                                latency_pct(hist, n, 99),
+                                s->latency_max_ns[l] / 1e6);
+                }
+                first = 0;
+        }
+
+        if (json && !first)
+                fprintf(f, "}");
+}
+
+/* IPC and misses per input KB of every phase that ran */
+static void report_perf(FILE *f, int json)
+{
+        const struct stats_counters *s = &stats_total;
+        double kb = stats_total.bytes_in / 1024.0;
+        int ipc = perf_available(PERF_CYCLES) &&
+                perf_available(PERF_INSTRUCTIONS);
+        int i, c, first = 1;
+
+        if (json) {
+                fprintf(f, ",\"perf\":{");
+        } else {
+                fprintf(f, "%-10s", "phase");
+                if (ipc)
+                        fprintf(f, " %8s", "ipc");
+                for (c = PERF_L1D_MISSES; c < PERF_COUNTERS; c++)
+                        if (perf_available(c))
+                                fprintf(f, " %16s", perf_counter_names[c]);
+                fprintf(f, "   (misses and faults per input KB)\n");
+        }
+
+        for (i = 0; i < STATS_PHASES; i++) {
+                const uint64_t *v = s->perf[i];
+
+                if (!s->wall_ns[i])
+                        continue;
+
+                if (json) {
+                        fprintf(f, "%s\"%s\":{", first ? "" : ",",
+                                phase_names[i]);
+                        if (ipc)
+                                fprintf(f, "\"ipc\":%.3f,", ratio(
+                                        v[PERF_INSTRUCTIONS], v[PERF_CYCLES]));
+                        fprintf(f, "\"input_kb\":%.1f", kb);
+                        for (c = 0; c < PERF_COUNTERS; c++)
+                                if (perf_available(c))
+                                        fprintf(f, ",\"%s\":%llu",
+                                                perf_counter_names[c],
+                                                (unsigned long long) v[c]);
+                        fprintf(f, "}");
+                        first = 0;
+                        continue;
+                }
+
+                fprintf(f, "%-10s", phase_names[i]);
+                if (ipc)
+                        fprintf(f, " %8.3f",
+                                ratio(v[PERF_INSTRUCTIONS], v[PERF_CYCLES]));
+                for (c = PERF_L1D_MISSES; c < PERF_COUNTERS; c++)
+                        if (perf_available(c))
+                                fprintf(f, " %16.3f", kb > 0 ? v[c] / kb : 0);
+                fprintf(f, "\n");
+        }
+
+        if (json)
+                fprintf(f, "}");
+}
+
+void stats_report(FILE *f, int json)
+{
+        const struct stats_counters *s = &stats_total;
+        struct timespec now;
+        struct rusage ru;
+        double wall_ms, cpu_ms, mbps;
+        long rss_kb;
+        int i;
+
+        if (!stats_enabled)
+                return;
+
+        stats_thread_done();
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        getrusage(RUSAGE_SELF, &ru);
+
+        wall_ms = ts_diff_ns(&stats_epoch, &now) / 1e6;
+        cpu_ms = tv_ms(&ru.ru_utime) + tv_ms(&ru.ru_stime);
+        mbps = wall_ms > 0 ? s->bytes_in / 1e6 / (wall_ms / 1e3) : 0;
+#ifdef MACOSX
+        rss_kb = ru.ru_maxrss / 1024;   /* bytes on darwin */
+#else
+        rss_kb = ru.ru_maxrss;
+#endif
+
+        if (json) {
+                fprintf(f, "{\"phases\":{");
+                for (i = 0; i < STATS_PHASES; i++)
+                        fprintf(f, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+                                i ? "," : "", phase_names[i],
+                                s->wall_ns[i] / 1e6, s->cpu_ns[i] / 1e6);
+                fprintf(f, "},\"wall_ms\":%.3f,\"cpu_ms\":%.3f", wall_ms,
+                        cpu_ms);
+                fprintf(f, ",\"docs\":%llu,\"bytes_in\":%llu,"
+                        "\"bytes_out\":%llu,\"mb_per_s\":%.3f",
+                        (unsigned long long) s->docs,
+                        (unsigned long long) s->bytes_in,
+                        (unsigned long long) s->bytes_out, mbps);
+                fprintf(f, ",\"nodes\":%llu,\"attributes\":%llu,"
+                        "\"texts\":%llu",
+                        (unsigned long long) s->nodes,
+                        (unsigned long long) s->attributes,
+                        (unsigned long long) s->texts);
+                fprintf(f, ",\"mallocs\":%llu,\"reallocs\":%llu,"
+                        "\"frees\":%llu,\"alloc_bytes\":%llu",
+                        (unsigned long long) alloc_total.mallocs,
+                        (unsigned long long) alloc_total.reallocs,
+                        (unsigned long long) alloc_total.frees,
+                        (unsigned long long) alloc_total.bytes);
+                fprintf(f, ",\"libxml_mallocs\":%llu,\"libxml_reallocs\":%llu,"
+                        "\"libxml_frees\":%llu,\"libxml_bytes\":%llu",
+                        (unsigned long long) xml_alloc_total.mallocs,
+                        (unsigned long long) xml_alloc_total.reallocs,
+                        (unsigned long long) xml_alloc_total.frees,
+                        (unsigned long long) xml_alloc_total.bytes);
+                fprintf(f, ",\"peak_live_bytes\":%llu,\"peak_rss_kb\":%ld",
+                        (unsigned long long) alloc_peak_bytes, rss_kb);
+                fprintf(f, ",\"simd\":\"%s\"", simd_level_name(simd_level));
+                if (s->cache_hits || s->cache_misses)
+                        fprintf(f, ",\"cache_hits\":%llu,\"cache_misses\":%llu,"
+                                "\"cache_evicted\":%llu",
+                                (unsigned long long) s->cache_hits,
+                                (unsigned long long) s->cache_misses,
+                                (unsigned long long) s->cache_evicted);
+                if (s->lock_acquires)
+                        fprintf(f, ",\"lock_acquires\":%llu,"
+                                "\"lock_contended\":%llu,\"lock_wait_ms\":%.3f,"
+                                "\"idle_ms\":%.3f,\"queue_mean\":%.3f,"
+                                "\"queue_max\":%llu",
+                                (unsigned long long) s->lock_acquires,
+                                (unsigned long long) s->lock_contended,
+                                s->lock_wait_ns / 1e6, s->idle_ns / 1e6,
+                                ratio(s->queue_depth, s->queue_samples),
+                                (unsigned long long) s->queue_max);
+                report_latency(f, json);
+                if (stats_perf_enabled)
+                        report_perf(f, json);
+                fprintf(f, "}\n");
+                return;
+        }
+
+        fprintf(f, "%-10s %12s %12s\n", "phase", "wall ms", "cpu ms");
+        for (i = 0; i < STATS_PHASES; i++)
+                fprintf(f, "%-10s %12.3f %12.3f\n", phase_names[i],
+                        s->wall_ns[i] / 1e6, s->cpu_ns[i] / 1e6);
+        fprintf(f, "%-10s %12.3f %12.3f\n", "total", wall_ms, cpu_ms);
+        fprintf(f, "documents:   %llu\n", (unsigned long long) s->docs);
+        fprintf(f, "bytes in:    %llu (%.2f MB/s)\n",
+                (unsigned long long) s->bytes_in, mbps);
+        fprintf(f, "bytes out:   %llu\n", (unsigned long long) s->bytes_out);
+        fprintf(f, "nodes:       %llu elements, %llu attributes, %llu texts\n",
+                (unsigned long long) s->nodes,
+                (unsigned long long) s->attributes,
+                (unsigned long long) s->texts);
+        fprintf(f, "allocations: %llu malloc, %llu realloc, %llu free, "
+                "%llu bytes\n",
+                (unsigned long long) alloc_total.mallocs,
+                (unsigned long long) alloc_total.reallocs,
+                (unsigned long long) alloc_total.frees,
+                (unsigned long long) alloc_total.bytes);
+        fprintf(f, "libxml2:     %llu malloc, %llu realloc, %llu free, "
+                "%llu bytes\n",
+                (unsigned long long) xml_alloc_total.mallocs,
+                (unsigned long long) xml_alloc_total.reallocs,
+                (unsigned long long) xml_alloc_total.frees,
+                (unsigned long long) xml_alloc_total.bytes);
+        fprintf(f, "peak live:   %llu bytes\n",
+                (unsigned long long) alloc_peak_bytes);
+        fprintf(f, "peak rss:    %ld KB\n", rss_kb);
+        fprintf(f, "simd:        %s\n", simd_level_name(simd_level));
+        if (s->cache_hits || s->cache_misses)
+                fprintf(f, "cache:       %llu hits, %llu misses, %llu "
+                        "evicted\n", (unsigned long long) s->cache_hits,
+                        (unsigned long long) s->cache_misses,
+                        (unsigned long long) s->cache_evicted);
+        if (s->lock_acquires) {
+                fprintf(f, "locking:     %llu of %llu acquisitions contended, "
+                        "%.3f ms blocked\n",
+                        (unsigned long long) s->lock_contended,
+                        (unsigned long long) s->lock_acquires,
+                        s->lock_wait_ns / 1e6);
+                fprintf(f, "workers:     %.3f ms idle, queue depth %.2f mean, "
+                        "%llu max\n", s->idle_ns / 1e6,
+                        ratio(s->queue_depth, s->queue_samples),
+                        (unsigned long long) s->queue_max);
+        }
+        report_latency(f, json);
+        if (stats_perf_enabled)
+                report_perf(f, json);
+}
@@ -0,0 +1,208 @@
+/* xml2json
+ *
+ * Copyright (c) 2018 Partha Susarla <mail@spartha.org>
+ * stats - Per phase timing and counters for --stats.
+ */
+
+#ifndef XML2JSON_STATS_H
+#define XML2JSON_STATS_H
+
+#include "perf.h"
+#include "scheduler.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum stats_phase {
+        STATS_INPUT,            /* open and mmap, batch mode: reads in
+                                 * flight, wall time only */
+        STATS_PARSE,            /* libxml2 builds the document */
+        STATS_VALIDATE,         /* XSD validation */
+        STATS_XSD,              /* walkXsdSchema() */
+        STATS_CONVERT,          /* parse_xmlnode() */
+        STATS_ENCODE,           /* json_write() */
+        STATS_WRITE,            /* final flush of the output, batch
+                                 * mode: writes in flight, likewise */
+        STATS_PHASES,
+};
+
+/* Scheduler latency buckets: bucket 0 is under 1us, bucket i from 2^(i-1)
+ * up to 2^i us, the last one open ended */
+#define STATS_LATENCY_BUCKETS 32
+
+struct stats_counters {
+        uint64_t wall_ns[STATS_PHASES];
+        uint64_t cpu_ns[STATS_PHASES];
+        uint64_t perf[STATS_PHASES][PERF_COUNTERS];
+        uint64_t docs;
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+        uint64_t nodes;         /* element nodes visited by the converter */
+        uint64_t attributes;
+        uint64_t texts;
+
+        /* batch mode conversion cache */
+        uint64_t cache_hits;
+        uint64_t cache_misses;
+        uint64_t cache_evicted;
+
+        /* work queues of the multi-threaded modes */
+        uint64_t lock_acquires;
+        uint64_t lock_contended;
+        uint64_t lock_wait_ns;  /* blocked on a contended lock */
+        uint64_t idle_ns;       /* workers waiting for work */
+        uint64_t queue_samples;
+        uint64_t queue_depth;   /* sum over the samples */
+        uint64_t queue_max;
+
+        /* sched_submit() to the end of the job, per lane */
+        uint64_t latency[SCHED_LANES][STATS_LATENCY_BUCKETS];
+        uint64_t latency_max_ns[SCHED_LANES];
+};
+
+struct stats_timer {
+        struct timespec wall;
+        struct timespec cpu;
+        struct perf_sample perf;
+};
+
+/* Counters are per thread and summed up by stats_thread_done() */
+extern int stats_enabled;
+extern int stats_perf_enabled;
+extern __thread struct stats_counters stats_local;
+extern __thread struct alloc_stats stats_xml_allocs;    /* made by libxml2 */
+
+#define STATS_ADD(field, n) do {                                \
+                if (stats_enabled) stats_local.field += (n);    \
+        } while (0)
+
+/* stats_init():
+ * Turn statistics on, the total wall time is measured from here.
+ */
+void stats_init(void);
+
+/* stats_init_perf():
+ * Also sample hardware performance counters around every phase. Returns -1
+ * if no counter can be opened.
+ */
+int stats_init_perf(void);
+
+/* stats_start():
+ * Start timing a phase.
+ */
+static inline void stats_start(struct stats_timer *t)
+{
+        if (stats_enabled) {
+                clock_gettime(CLOCK_MONOTONIC, &t->wall);
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t->cpu);
+                if (stats_perf_enabled)
+                        perf_read(&t->perf);
+        }
+}
+
+/* stats_stop():
+ * Account the time since stats_start() to `phase`.
+ */
+void stats_stop(struct stats_timer *t, enum stats_phase phase);
+
+static inline uint64_t stats_elapsed_ns(const struct timespec *start)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000ULL +
+                now.tv_nsec - start->tv_nsec;
+}
+
+/* stats_mutex_lock():
+ * pthread_mutex_lock() that counts contended acquisitions and the time
+ * spent blocked on them.
+ */
+static inline void stats_mutex_lock(pthread_mutex_t *lock)
+{
+        struct timespec start;
+
+        if (!stats_enabled) {
+                pthread_mutex_lock(lock);
+                return;
+        }
+
+        stats_local.lock_acquires++;
+        if (pthread_mutex_trylock(lock) == 0)
+                return;
+
+        stats_local.lock_contended++;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(lock);
+        stats_local.lock_wait_ns += stats_elapsed_ns(&start);
+}
+
+/* stats_idle():
+ * pthread_cond_wait() of a worker that has nothing to do, accounted as
+ * idle time.
+ */
+static inline void stats_idle(pthread_cond_t *cond, pthread_mutex_t *lock)
+{
+        struct timespec start;
+
+        if (!stats_enabled) {
+                pthread_cond_wait(cond, lock);
+                return;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_cond_wait(cond, lock);
+        stats_local.idle_ns += stats_elapsed_ns(&start);
+}
+
+/* stats_queue():
+ * Sample the depth of a work queue.
+ */
+static inline void stats_queue(size_t depth)
+{
+        if (stats_enabled) {
+                stats_local.queue_samples++;
+                stats_local.queue_depth += depth;
+                if (depth > stats_local.queue_max)
+                        stats_local.queue_max = depth;
+        }
+}
+
+/* stats_latency():
+ * Count a job of `lane` that took `ns` from being queued to done.
+ */
+static inline void stats_latency(enum sched_lane lane, uint64_t ns)
+{
+        uint64_t us = ns / 1000;
+        int b = us ? 64 - __builtin_clzll(us) : 0;
+
+        if (b >= STATS_LATENCY_BUCKETS)
+                b = STATS_LATENCY_BUCKETS - 1;
+        stats_local.latency[lane][b]++;
+        if (ns > stats_local.latency_max_ns[lane])
+                stats_local.latency_max_ns[lane] = ns;
+}
+
+/* stats_thread_done():
+ * Add the calling thread's counters to the totals. Threads other than the
+ * one calling stats_report() must call this before they exit.
+ */
+void stats_thread_done(void);
+
+/* stats_report():
+ * Print the totals to `f`, as JSON if `json` is set.
+ */
+void stats_report(FILE *f, int json);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* XML2JSON_STATS_H */
@@ -5,10 +5,46 @@
 
 #include "util.h"
 
+#ifdef MACOSX
+#include <malloc/malloc.h>
+#define malloc_usable_size(p) malloc_size(p)
+#else
+#include <malloc.h>
+#endif
+
+int alloc_stats_enabled;
+__thread struct alloc_stats alloc_stats;
+int64_t alloc_live_bytes;
+int64_t alloc_peak_bytes;
+
+void alloc_stat_track(struct alloc_stats *s, void *ptr, int sign)
+{
+        int64_t size, live, peak;
+
+        if (ptr == NULL)
+                return;
+
+        size = malloc_usable_size(ptr);
+        if (sign < 0) {
+                __atomic_sub_fetch(&alloc_live_bytes, size, __ATOMIC_RELAXED);
+                return;
+        }
+
+        s->bytes += size;
+        live = __atomic_add_fetch(&alloc_live_bytes, size, __ATOMIC_RELAXED);
+        peak = __atomic_load_n(&alloc_peak_bytes, __ATOMIC_RELAXED);
+        while (live > peak &&
+               !__atomic_compare_exchange_n(&alloc_peak_bytes, &peak, live, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                ;
+}
+
 void *xmalloc(size_t size)
 {
         void *ret;
 
+        ALLOC_STAT(mallocs);
         ret = malloc(size);
         if (!ret && !size)
                 ret = malloc(1);
@@ -18,6 +54,9 @@ void *xmalloc(size_t size)
                 exit(EXIT_FAILURE);
         }
 
+        if (alloc_stats_enabled)
+                alloc_stat_track(&alloc_stats, ret, 1);
+
         return ret;
 }
 
@@ -26,6 +65,10 @@ void *xrealloc(void *ptr, size_t size)
 {
         void *ret;
 
+        if (alloc_stats_enabled) {
+                alloc_stats.reallocs++;
+                alloc_stat_track(&alloc_stats, ptr, -1);
+        }
         ret = realloc(ptr, size);
         if (!ret && !size)
                 ret = realloc(ptr, 1);
@@ -35,6 +78,9 @@ void *xrealloc(void *ptr, size_t size)
                 exit(EXIT_FAILURE);
         }
 
+        if (alloc_stats_enabled)
+                alloc_stat_track(&alloc_stats, ret, 1);
+
         return ret;
 }
 
@@ -50,12 +96,16 @@ void *xcalloc(size_t nmemb, size_t size)
                 exit(EXIT_FAILURE);
         }
 
+        ALLOC_STAT(mallocs);
         ret = (void *)calloc(nmemb, size);
         if (!ret) {
                 fprintf(stderr, "Memory allocation error\n");
                 exit(EXIT_FAILURE);
         }
 
+        if (alloc_stats_enabled)
+                alloc_stat_track(&alloc_stats, ret, 1);
+
         return ret;
 
 
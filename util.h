@@ -19,6 +19,34 @@
 extern "C" {
 #endif
 
+/*
+ * Allocation counters for the x*alloc() family and xfree(). They are per
+ * thread and only maintained while `alloc_stats_enabled` is set. Bytes are
+ * the usable size of each block, the live and peak byte counts are process
+ * wide and also cover allocations made through alloc_stat_track().
+ */
+struct alloc_stats {
+        uint64_t mallocs;
+        uint64_t reallocs;
+        uint64_t frees;
+        uint64_t bytes;         /* allocated, not counting frees */
+};
+
+extern int alloc_stats_enabled;
+extern __thread struct alloc_stats alloc_stats;
+extern int64_t alloc_live_bytes;
+extern int64_t alloc_peak_bytes;
+
+#define ALLOC_STAT(field) do {                                  \
+                if (alloc_stats_enabled) alloc_stats.field++;   \
+        } while (0)
+
+/* alloc_stat_track():
+ * Account `ptr` as allocated (`sign` > 0) or about to be freed (`sign` < 0)
+ * in the live and peak byte counts, and add allocations to `s->bytes`.
+ */
+extern void alloc_stat_track(struct alloc_stats *s, void *ptr, int sign);
+
 extern void *xmalloc(size_t size);
 extern void *xrealloc(void *ptr, size_t size);
 extern void *xcalloc(size_t nmemb, size_t size);
@@ -55,8 +83,15 @@ extern char *xstrdup(const char *s);
 #define unsigned_mult_overflows(a, b) \
     ((a) && (b) > maximum_unsigned_value_of_type(a) / (a))
 
-#define xfree(ptr) do {                                 \
-                if (ptr) { free(ptr); ptr = NULL; }     \
+#define xfree(ptr) do {                                                 \
+                if (ptr) {                                              \
+                        if (alloc_stats_enabled) {                      \
+                                alloc_stats.frees++;                    \
+                                alloc_stat_track(&alloc_stats, ptr, -1); \
+                        }                                               \
+                        free(ptr);                                      \
+                        ptr = NULL;                                     \
+                }                                                       \
         } while (0)
 
 #define ENSURE_NON_NULL(p) (p)?(p):""
@@ -4,11 +4,24 @@
  */
 
 #define LIBXML_SCHEMAS_ENABLED
+#include "batch.h"
+#include "cache.h"
+#include "convert.h"
 #include "cstring.h"
 #include "htable.h"
+#include "index.h"
+#include "input.h"
 #include "json.h"
+#include "output.h"
 #include "util.h"
 #include "parsexsd.h"
+#include "probes.h"
+#include "scheduler.h"
+#include "select.h"
+#include "serve.h"
+#include "simd.h"
+#include "split.h"
+#include "stats.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -26,425 +39,341 @@
 #include <libxml/xmlschemastypes.h>
 #include <libxml/schemasInternals.h>
 
-/**
- * Hashtable
- */
-enum  xml_entry_type {
-        ENTRY_TYPE_NULL,
-        ENTRY_TYPE_BOOL,
-        ENTRY_TYPE_STRING,
-        ENTRY_TYPE_NUMBER,
-        ENTRY_TYPE_ARRAY,
-        ENTRY_TYPE_OBJECT,
-};
-
-struct xml_htable {
-        struct htable table;
-};
-
-struct xml_htable_entry {
-        struct htable_entry entry;
-        enum xml_entry_type type;
-        char *key;
-        size_t keylen;
-        void *value;
-};
-
-/* Global variable not prefered, need to find the correct function to pass - for now developing functionality */
-
-static struct xml_htable_entry *alloc_xml_htable_entry(char *key,
-                                                       size_t keylen,
-                                                       void *value,
-                                                       enum xml_entry_type type)
+/* Client mode: convert every file through the daemon at `path` */
+static int run_client(const char *path, char **files, int nfiles,
+                      unsigned int input_flags)
 {
-        struct xml_htable_entry *e;
-
-        e = xmalloc(sizeof(struct xml_htable_entry));
-        e->key = xcalloc(1, keylen);
-        memcpy(e->key, key, keylen);
-        e->keylen = keylen;
-        e->value = value;
-        e->type = type;
-        return e;
-}
+        struct output out;
+        struct input in;
+        int fd, i, failed = 0;
 
-static void free_xml_htable_entry(struct xml_htable_entry **e)
-{
-        if (e && *e) {
-                free((*e)->key);
-                (*e)->key = NULL;
-                (*e)->keylen = 0;
-                if ((*e)->type == ENTRY_TYPE_STRING) {
-                        free((*e)->value);
-                }
-
-                (*e)->value = NULL;
-                free(*e);
-                *e = NULL;
+        fd = serve_connect(path);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                return -1;
         }
-}
 
-static int xml_htable_entry_cmpfn(const void *unused1 _unused_,
-                                  const void *entry1,
-                                  const void *entry2,
-                                  const void *unused2 _unused_)
-{
-        const struct xml_htable_entry *e1 = entry1;
-        const struct xml_htable_entry *e2 = entry2;
-
-        return memcmp_raw(e1->key, e1->keylen, e2->key, e2->keylen);
-}
+        output_init(&out, STDOUT_FILENO);
+        for (i = 0; i < nfiles; i++) {
+                char *resp;
+                size_t len;
+                int status;
 
-static void xml_htable_init(struct xml_htable *ht)
-{
-        htable_init(&ht->table, xml_htable_entry_cmpfn, NULL, 0);
-}
+                int docfd = -1, resfd = -1;
 
-static void *xml_htable_get(struct xml_htable *ht, char *key,
-                            size_t keylen)
-{
-        struct xml_htable_entry k;
-        struct xml_htable_entry *e;
-
-        if (!ht->table.size)
-                xml_htable_init(ht);
-
-        htable_entry_init(&k, bufhash(key, keylen));
-        k.key = key;
-        k.keylen = keylen;
-        e = htable_get(&ht->table, &k, NULL);
-
-        return e ? e : NULL;
-}
-
-static void xml_htable_put(struct xml_htable *ht,
-                           char *key,
-                           size_t keylen, void *value,
-                           enum xml_entry_type type)
-{
-        struct xml_htable_entry *e;
+                if (input_open(&in, files[i], input_flags, 0) < 0) {
+                        fprintf(stderr, "%s: %s\n", files[i], strerror(errno));
+                        failed++;
+                        continue;
+                }
 
-        if (!ht->table.size)
-                xml_htable_init(ht);
+                /* Large documents go both ways as memfds */
+                if (in.size >= SERVE_MEMFD_MIN_SIZE)
+                        docfd = serve_memfd(in.fd, in.size);
+                if (docfd >= 0) {
+                        status = serve_call_fd(fd, docfd, in.size, &resfd,
+                                               &resp, &len);
+                        close(docfd);
+                } else {
+                        status = serve_call(fd, in.base, in.size, &resp,
+                                            &len);
+                }
+                input_close(&in);
 
-        e = alloc_xml_htable_entry(key, keylen, value, type);
-        htable_entry_init(e, bufhash(key, keylen));
+                if (status < 0) {
+                        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                        failed += nfiles - i;
+                        break;
+                }
+                if (resfd >= 0) {
+                        if (output_copy_fd(&out, resfd, 0, len) < 0) {
+                                fprintf(stderr, "%s: %s\n", files[i],
+                                        strerror(errno));
+                                failed++;
+                        }
+                        close(resfd);
+                } else if (status == SERVE_OK) {
+                        output_add(&out, resp, len);
+                } else {
+                        fprintf(stderr, "%s: %s\n", files[i], resp);
+                        failed++;
+                }
+                xfree(resp);
+        }
+        output_release(&out);
+        close(fd);
 
-        htable_put(&ht->table, e);
+        return failed;
 }
 
-static void *xml_htable_remove(struct xml_htable *ht, char *key,
-                               size_t keylen)
+/* Index mode: write the index of the records of `path` to `index_path` */
+static int run_index(const char *index_path, const char *path,
+                     enum split_mode mode, const char *key,
+                     unsigned int input_flags)
 {
-        struct xml_htable_entry e;
-
-        if (!ht->table.size)
-                xml_htable_init(ht);
+        struct input in;
+        uint64_t records;
+        int ret;
 
-        htable_entry_init(&e, bufhash(key, keylen));
-
-        return htable_remove(&ht->table, &e, key);
-}
+        if (input_open(&in, path, input_flags | INPUT_SEQUENTIAL, 0) < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                return -1;
+        }
 
-static void xml_htable_free(struct xml_htable *ht)
-{
-        struct htable_iter iter;
-        struct xml_htable_entry *e;
+        ret = index_build(index_path, &in, mode, key, &records);
+        input_close(&in);
 
-        htable_iter_init(&ht->table, &iter);
-        while ((e = htable_iter_next(&iter))) {
-                free_xml_htable_entry(&e);
+        if (ret < 0) {
+                fprintf(stderr, "%s: %s\n", index_path, strerror(errno));
+                return -1;
         }
+        if (ret > 0)
+                fprintf(stderr, "%s: input ends inside record %llu, the "
+                        "rest is not indexed\n", path,
+                        (unsigned long long) records + 1);
 
-        htable_free(&ht->table, 0);
+        return ret;
 }
 
-/**
- * XML parsing
- */
-
-static void *parse_xmlnode(xmlNodePtr node, enum xml_entry_type *type);
-
-static void *parse_xml_element_attributes(xmlAttrPtr attr, void *attrobj,
-                                          enum xml_entry_type *type)
-
+/* Lookup mode: convert the records of `path` asked for in `queries`, by
+ * number counting from 1 or as @<key>=<value>, through its index */
+static int run_lookup(const char *index_path, const char *path,
+                      char **queries, int nqueries,
+                      const struct convert_opts *copts)
 {
-        if (attr == NULL) {
-                *type = ENTRY_TYPE_NULL;
-                return NULL;
+        struct index idx;
+        struct output out;
+        struct input in;
+        const char *q, *value;
+        char msg[256];
+        unsigned long line;
+        unsigned long long n;
+        size_t keylen, off, len;
+        char *end;
+        int i, found, failed = 0;
+
+        if (input_open(&in, path, 0, 0) < 0) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                return -1;
         }
-
-        if (attrobj == NULL)
-                attrobj = json_new();
-
-        while (attr != NULL) {
-                cstring str;
-                void *val;
-
-                /* Append '@' to the attribute name */
-                cstring_init(&str, 0);
-                cstring_addch(&str, '@');
-                cstring_addstr(&str, (char *)attr->name);
-
-                val = parse_xmlnode(attr->children, type);
-
-                if (*type == ENTRY_TYPE_STRING) {
-                        JsonObject *strobj;
-                        strobj = json_string_obj(val);
-                        free(val);
-                        json_prepend_member(attrobj, str.buf, strobj);
+        if (index_open(&idx, index_path, &in) < 0) {
+                fprintf(stderr, "%s: %s\n", index_path,
+                        errno == ESTALE ? "out of date, index the file again" :
+                        errno == EINVAL ? "not an index" : strerror(errno));
+                input_close(&in);
+                return -1;
+        }
+        keylen = strlen(idx.hdr->key);
+
+        output_init(&out, STDOUT_FILENO);
+        for (i = 0; i < nqueries; i++) {
+                q = queries[i];
+                if (q[0] == '@') {
+                        if (!keylen || strncmp(q + 1, idx.hdr->key, keylen) ||
+                            q[keylen + 1] != '=') {
+                                fprintf(stderr, "%s: the index is by %s%s\n",
+                                        q, keylen ? "@" : "number only",
+                                        idx.hdr->key);
+                                failed++;
+                                continue;
+                        }
+                        value = q + keylen + 2;
+                        found = index_find(&idx, value, strlen(value), &off,
+                                           &len);
                 } else {
-                        printf("attributes: non string type entry!\n");
+                        n = strtoull(q, &end, 10);
+                        found = end != q && *end == '\0' && n > 0 &&
+                                index_record(&idx, n - 1, &off, &len);
+                }
+                if (!found) {
+                        fprintf(stderr, "%s: no such record\n", q);
+                        failed++;
+                        continue;
                 }
 
-                attr = attr->next;
-
-                cstring_release(&str);
+                if (convert_buffer(in.base + off, len, path, &out,
+                                   copts) < 0) {
+                        line = 1;
+                        strcpy(msg, "conversion failed");
+                        convert_last_error(msg, sizeof(msg), &line, copts);
+                        fprintf(stderr, "%s: %s at byte %zu: %s\n", path, q,
+                                off, msg);
+                        failed++;
+                }
         }
+        output_release(&out);
+        convert_thread_done(copts);
+
+        index_close(&idx);
+        input_close(&in);
 
-        *type = ENTRY_TYPE_OBJECT;
-        return attrobj;
+        return failed;
 }
 
-static int parse_xml_element_node(xmlNodePtr node, struct xml_htable *ht,
-                                    enum xml_entry_type *type)
+/* A byte count, with an optional K, M or G suffix */
+static int parse_size(const char *str, size_t *size)
 {
-        void *val = NULL;
-        int has_attr = 0;
-        void *attrval = NULL;
-        JsonObject *attrobj = NULL;
+        unsigned long long n;
+        unsigned int shift;
+        char *end;
 
-        if (node == NULL) {
-                *type = ENTRY_TYPE_NULL;
+        if (*str < '0' || *str > '9')
                 return -1;
+        errno = 0;
+        n = strtoull(str, &end, 10);
+        switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: shift = 0; break;
         }
+        if (*end != '\0' || errno == ERANGE || n > (SIZE_MAX >> shift))
+                return -1;
 
-        val = parse_xmlnode(node->children, type);
-        switch (*type) {
-        case ENTRY_TYPE_NULL:
-                xfree(val);
-                val = NULL;
-                break;
-        case ENTRY_TYPE_STRING:
-                if (node->properties) {
-                        attrobj = json_new();
-                        json_prepend_member(attrobj, "#text",
-                                            json_string_obj(val));
-                        free(val);
-                        val = attrobj;
-                }
-                break;
-        case ENTRY_TYPE_OBJECT:
-        case ENTRY_TYPE_ARRAY:
-        case ENTRY_TYPE_BOOL:
-        case ENTRY_TYPE_NUMBER:
-        default:
-                break;
-        }
-
-        if (node->properties != NULL) {
-                /* We need to parse XML attributes */
-                attrval = parse_xml_element_attributes(node->properties, val,
-                                                       type);
-                if (val == NULL)
-                        val = attrval;
-                has_attr = 1;
-        }
-
-        val = parse_xmlnode(node->children, type);
-        if (has_attr && *type == ENTRY_TYPE_NULL) {
-                if (val) free(val);
-                return has_attr;
-        }
-
-        xml_htable_put(ht, (char *)node->name, xmlStrlen(node->name),
-                       val, *type);
-
-        return has_attr;
+        *size = (size_t) n << shift;
+        return 0;
 }
 
-static char *parse_xml_text_node(xmlNodePtr node, enum xml_entry_type *type,
-                                 size_t *slen)
+/* A count of at least 1 and at most `max`, in decimal */
+static int parse_count(const char *str, unsigned long long max,
+                       unsigned long long *count)
 {
-        xmlChar *content;
-        cstring str;
-        size_t len = 0, i = 0;
-
-        if (node->content == NULL)
-                return NULL;
-
-        cstring_init(&str, 0);
-
-        content = xmlNodeGetContent(node);
-        len = xmlStrlen(content);
-
-        for (i = 0; i < len; i++) {
-                if ((content[i] == 0x20) ||
-                    ((0x9 <= content[i]) && (content[i] <= 0xa)) ||
-                    (content[i] == 0xd) ||
-                    (content[i] == '\r') ||
-                    (content[i] == '\n') ||
-                    (content[i] == 0x0a)) {
-                        continue;
-                }
-                cstring_addch(&str, content[i]);
-        }
-
-        if (!content) *type = ENTRY_TYPE_NULL;
-
-        xmlFree(content);
+        unsigned long long n;
+        char *end;
 
-        if (str.len == 0) {
-                *type = ENTRY_TYPE_NULL;
-                cstring_release(&str);
-        } else {
-                *type = ENTRY_TYPE_STRING;
-        }
+        if (*str < '0' || *str > '9')
+                return -1;
+        errno = 0;
+        n = strtoull(str, &end, 10);
+        if (*end != '\0' || errno == ERANGE || n == 0 || n > max)
+                return -1;
 
-        return cstring_detach(&str, slen);
+        *count = n;
+        return 0;
 }
 
-static JsonObject *xml_htable_to_json_obj(struct xml_htable *ht)
+static void usage_and_die(void)
 {
-        JsonObject *jobj = NULL;
-        struct htable_iter iter;
-        struct xml_htable_entry *e = NULL;
-
-        jobj = json_new();
-
-        htable_iter_init_ordered(&ht->table, &iter);
-
-        while ((e = htable_iter_next_ordered(&iter))) {
-                if (e->entry.count > 1) { /* Array */
-                        JsonObject *array = NULL;
-                        struct xml_htable_entry *temp = NULL;
-                        temp = e;
-
-                        array = json_array_obj();
-
-                        if (e->type == ENTRY_TYPE_NULL)
-                                json_prepend_to_array(array, json_null_obj());
-                        else if (e->type == ENTRY_TYPE_STRING)
-                                json_prepend_to_array(array,
-                                                      json_string_obj(e->value));
-                        else
-                                json_prepend_to_array(array, e->value);
-
-
-                        /* Parse the other entries for the same key */
-                        while ((temp = htable_get_next(&ht->table, temp))) {
-                                if (temp->type == ENTRY_TYPE_NULL)
-                                        json_prepend_to_array(array,
-                                                              json_null_obj());
-                                else if (temp->type == ENTRY_TYPE_STRING)
-                                        json_prepend_to_array(array,
-                                                              json_string_obj(temp->value));
-                                else
-                                        json_prepend_to_array(array, temp->value);
-                        }
-
-                        json_append_member(jobj, (char *)e->key, array);
-
-                } else {                  /* Normal(?) non-array object */
-                        if (e->type == ENTRY_TYPE_NULL)
-                                json_append_member(jobj, e->key,
-                                                   json_null_obj());
-                        else if (e->type == ENTRY_TYPE_STRING)
-                                json_append_member(jobj, e->key,
-                                                   json_string_obj(e->value));
-                        else
-                                json_append_member(jobj, e->key, e->value);
-                }
-        }
+        fprintf(stderr, "xml2json - A program to convert an XML file to JSON!\n");
+        fprintf(stderr, "USAGE: xml2json <xmlfile> -x=<xsdfile>\n");
+        fprintf(stderr, "       xml2json -o <dir> [-j <n>] [--cache=<dir>] <xmlfile|dir>...\n");
+        fprintf(stderr, "       xml2json --serve=<socket> [-j <n>] [-x=<xsdfile>]\n");
+        fprintf(stderr, "       xml2json --connect=<socket> <xmlfile>...\n");
+        fprintf(stderr, "       xml2json --split=<mode> [-j <n>] [-x=<xsdfile>]\n");
+        fprintf(stderr, "                [--errors=<file>] [--limit=<n>] [--shard=<i>/<n>]\n");
+        fprintf(stderr, "                <xmlfile>\n");
+        fprintf(stderr, "       xml2json --merge=ndjson|array <part>...\n");
+        fprintf(stderr, "       xml2json --index=<idxfile> [--index-key=<attr>]\n");
+        fprintf(stderr, "                [--split=<mode>] <xmlfile>\n");
+        fprintf(stderr, "       xml2json --lookup=<idxfile> <xmlfile> <n|@attr=value>...\n");
+        fprintf(stderr, " xsd|x  : use the xsd file to validate!\n");
+        fprintf(stderr, "          (This is optional)\n");
+        fprintf(stderr, " input  : how the input file is paged in, a list of\n");
+        fprintf(stderr, "          sequential, hugepage, populate, prefault[=MB]\n");
+        fprintf(stderr, "          and stream (drop pages once parsed)\n");
+        fprintf(stderr, " output-dir|o : batch mode, write <dir>/<name>.json\n");
+        fprintf(stderr, "          for every input file or *.xml in a directory\n");
+        fprintf(stderr, " cache  : batch mode, keep the output of every file in\n");
+        fprintf(stderr, "          this directory and reuse it while the file\n");
+        fprintf(stderr, "          and options stay the same\n");
+        fprintf(stderr, " cache-size : bound the cache, least recently used\n");
+        fprintf(stderr, "          files go first (default 1G, 0 for none)\n");
+        fprintf(stderr, " jobs|j : converter threads in batch mode\n");
+        fprintf(stderr, "          (defaults to the number of CPUs)\n");
+        fprintf(stderr, " serve  : run as a daemon on a Unix socket, with -j\n");
+        fprintf(stderr, "          worker threads, until SIGINT or SIGTERM\n");
+        fprintf(stderr, " connect : convert through the daemon on the socket\n");
+        fprintf(stderr, " split  : the file holds many documents, each behind a\n");
+        fprintf(stderr, "          4 byte big-endian length (length) or back to\n");
+        fprintf(stderr, "          back (documents), or is a list of records under\n");
+        fprintf(stderr, "          the root element (records); write one JSON line\n");
+        fprintf(stderr, "          for each, in order, converted on -j threads\n");
+        fprintf(stderr, " errors : split mode, report the documents or records\n");
+        fprintf(stderr, "          that fail to this file instead of stderr\n");
+        fprintf(stderr, " limit  : split mode, stop after the first n lines,\n");
+        fprintf(stderr, "          without reading the rest of the input\n");
+        fprintf(stderr, " shard  : split mode, convert only the documents or\n");
+        fprintf(stderr, "          records starting in the i-th of n equal parts\n");
+        fprintf(stderr, "          of the file, counting from 1\n");
+        fprintf(stderr, " merge  : write the outputs of every shard, in order,\n");
+        fprintf(stderr, "          as JSON lines (ndjson) or one JSON array\n");
+        fprintf(stderr, " index  : write where every record (or document, with\n");
+        fprintf(stderr, "          --split) of the file is to this index file\n");
+        fprintf(stderr, " index-key : also index the records by this attribute\n");
+        fprintf(stderr, " lookup : convert single records through the index,\n");
+        fprintf(stderr, "          by number from 1 or by key as @attr=value\n");
+        fprintf(stderr, " select : convert only the elements on this path, like\n");
+        fprintf(stderr, "          /mondial/country/name, `*` matches any element;\n");
+        fprintf(stderr, "          may be given more than once\n");
+        fprintf(stderr, " small-max : batch and daemon modes, documents up to\n");
+        fprintf(stderr, "          this size (default 256K) are converted ahead\n");
+        fprintf(stderr, "          of larger ones\n");
+        fprintf(stderr, " max-inflight : batch and daemon modes, bound the\n");
+        fprintf(stderr, "          input bytes held at once, e.g. 512M\n");
+        fprintf(stderr, " io     : batch mode I/O engine, uring or threads\n");
+        fprintf(stderr, "          (defaults to uring where available)\n");
+        fprintf(stderr, " stats  : print timing and counters to stderr,\n");
+        fprintf(stderr, "          --stats=json prints them as JSON\n");
+        fprintf(stderr, " perf-counters : implies --stats, also count cycles,\n");
+        fprintf(stderr, "          instructions, cache and branch misses per phase\n");
+        fprintf(stderr, " help|h : print this help and exit!\n");
+        fprintf(stderr, "\n");
 
-        return jobj;
+        exit(1);
 }
 
-static void *parse_xmlnode(xmlNodePtr node, enum xml_entry_type *type)
+/*
+ * libxml2 allocators that feed the allocation statistics, installed with
+ * xmlMemSetup() when --stats is given.
+ */
+static void xml_mem_free(void *ptr)
 {
-        struct xml_htable ht;
-        xmlNodePtr n;
-        JsonObject *jobj;
-
-        if (node == NULL) {
-                *type = ENTRY_TYPE_NULL;
-                return NULL;
+        if (ptr) {
+                stats_xml_allocs.frees++;
+                alloc_stat_track(&stats_xml_allocs, ptr, -1);
         }
-
-        /* Initialise a ordered hash table */
-        xml_htable_init(&ht);
-
-        for (n = node; n; n = n->next) {
-                void *val;
-                size_t slen = 0;
-
-                switch(n->type) {
-                case XML_ELEMENT_NODE:
-                        parse_xml_element_node(n, &ht, type);
-                        break;
-                case XML_TEXT_NODE:
-                        val = parse_xml_text_node(n, type, &slen);
-                        if (slen == 0) continue;
-                        xml_htable_free(&ht);
-                        return val;
-                default:
-                        break;
-                }
-        }
-
-        /* If we've got here, we are returning a json object */
-        *type = ENTRY_TYPE_OBJECT;
-        jobj = xml_htable_to_json_obj(&ht);
-
-        /* Free the ordered hash table */
-        xml_htable_free(&ht);
-        memset(&ht, 0, sizeof(struct xml_htable));
-
-        return jobj;
+        free(ptr);
 }
 
-static void parse_xml_tree(xmlDocPtr doc, xmlNodePtr xsdrootin)
+static void *xml_mem_malloc(size_t size)
 {
+        void *ptr = malloc(size);
 
-        enum xml_entry_type type;
-
-        if (doc == NULL)
-                return;
-
-        if ((doc->type == XML_DOCUMENT_NODE) && (doc->children != NULL)) {
-                void *data;
-                char *json_str = NULL;
-
-                data = parse_xmlnode(doc->children, &type);
+        stats_xml_allocs.mallocs++;
+        alloc_stat_track(&stats_xml_allocs, ptr, 1);
+        return ptr;
+}
 
-                /* Encode our json object into a string */
-                json_str = json_encode((JsonObject *)data);
-                printf("%s\n", json_str);
-                xfree(json_str);
+static void *xml_mem_realloc(void *ptr, size_t size)
+{
+        void *ret;
 
-                json_free(data);
-                data = NULL;
-        }
+        stats_xml_allocs.reallocs++;
+        alloc_stat_track(&stats_xml_allocs, ptr, -1);
+        ret = realloc(ptr, size);
+        alloc_stat_track(&stats_xml_allocs, ret ? ret : ptr, 1);
+        return ret;
 }
 
-static void usage_and_die(void)
+static char *xml_mem_strdup(const char *s)
 {
-        fprintf(stderr, "xml2json - A program to convert an XML file to JSON!\n");
-        fprintf(stderr, "USAGE: xml2json <xmlfile> -x=<xsdfile>\n");
-        fprintf(stderr, " xsd|x  : use the xsd file to validate!\n");
-        fprintf(stderr, "          (This is optional)\n");
-        fprintf(stderr, " help|h : print this help and exit!\n");
-        fprintf(stderr, "\n");
+        size_t len = strlen(s) + 1;
+        char *ptr = xml_mem_malloc(len);
 
-        exit(1);
+        if (ptr)
+                memcpy(ptr, s, len);
+        return ptr;
 }
 
 int main(int argc, char **argv)
 {
         int fd;
-        struct stat sbinfo;
+        struct input in;
+        unsigned int input_flags = 0;
+        size_t prefault_ahead = 0;
+        unsigned long long count;
+        struct output out;
         xmlDocPtr doc = NULL;
-        char *base;
         int xml_options = XML_PARSE_COMPACT;
 		xmlNodePtr xsdroot = NULL;
 
@@ -457,6 +386,27 @@ int main(int argc, char **argv)
 
         static struct option long_options[] = {
                 {"xsd", required_argument, NULL, 'x'},
+                {"output-dir", required_argument, NULL, 'o'},
+                {"jobs", required_argument, NULL, 'j'},
+                {"io", required_argument, NULL, 'I'},
+                {"input", required_argument, NULL, 'M'},
+                {"stats", optional_argument, NULL, 'S'},
+                {"perf-counters", no_argument, NULL, 'P'},
+                {"serve", required_argument, NULL, 'D'},
+                {"connect", required_argument, NULL, 'C'},
+                {"small-max", required_argument, NULL, 'Z'},
+                {"max-inflight", required_argument, NULL, 'F'},
+                {"split", required_argument, NULL, 'T'},
+                {"errors", required_argument, NULL, 'E'},
+                {"select", required_argument, NULL, 'L'},
+                {"limit", required_argument, NULL, 'N'},
+                {"shard", required_argument, NULL, 'H'},
+                {"merge", required_argument, NULL, 'G'},
+                {"index", required_argument, NULL, 'X'},
+                {"index-key", required_argument, NULL, 'K'},
+                {"lookup", required_argument, NULL, 'U'},
+                {"cache", required_argument, NULL, 'A'},
+                {"cache-size", required_argument, NULL, 'B'},
                 {"help", no_argument, NULL, 'h'},
                 {NULL, 0, NULL, 0}
         };
@@ -464,18 +414,137 @@ int main(int argc, char **argv)
         int option_index;
         char *xsdfile = NULL;
         char *xmlfile = NULL;
+        struct batch_opts bopts;
+        struct serve_opts sopts;
+        struct split_opts spopts;
+        struct convert_opts copts;
+        const char *client_path = NULL;
+        const char *split_mode = NULL;
+        const char *errors_path = NULL;
+        const char *failed_part;
+        const char *index_path = NULL, *index_key = NULL;
+        const char *lookup_path = NULL;
+        const char *cache_dir = NULL;
+        size_t cache_size = CACHE_MAX_SIZE;
+        struct cache cache;
+        cstring cache_opts;
+        int merge = 0, merge_array = 0;
+        struct select sel;
+        struct stats_timer t;
+        int stats_json = 0;
+
+        memset(&bopts, 0, sizeof(struct batch_opts));
+        memset(&sopts, 0, sizeof(struct serve_opts));
+        memset(&spopts, 0, sizeof(struct split_opts));
+        memset(&copts, 0, sizeof(struct convert_opts));
+        memset(&sel, 0, sizeof(struct select));
+        cstring_init(&cache_opts, 0);
 
 #ifdef LINUX
         xml_options |= XML_PARSE_BIG_LINES;
 #endif
 
-        while ((option = getopt_long(argc, argv, "hx:",
+        while ((option = getopt_long(argc, argv, "hx:o:j:",
                                     long_options,
                                     &option_index)) != -1) {
                 switch (option) {
                 case 'x':
                         xsdfile = optarg;
                         break;
+                case 'o':
+                        bopts.outdir = optarg;
+                        break;
+                case 'j':
+                        if (parse_count(optarg, UINT_MAX, &count) < 0)
+                                usage_and_die();
+                        bopts.jobs = count;
+                        break;
+                case 'I':
+                        bopts.engine = optarg;
+                        break;
+                case 'S':
+                        if (optarg && strcmp(optarg, "json"))
+                                usage_and_die();
+                        stats_json = optarg != NULL;
+                        stats_init();
+                        break;
+                case 'P':
+                        if (stats_init_perf() < 0)
+                                fprintf(stderr, "perf counters are not "
+                                        "available, check "
+                                        "/proc/sys/kernel/perf_event_paranoid\n");
+                        break;
+                case 'D':
+                        sopts.path = optarg;
+                        break;
+                case 'C':
+                        client_path = optarg;
+                        break;
+                case 'Z':
+                        if (parse_size(optarg, &bopts.small_max) < 0)
+                                usage_and_die();
+                        break;
+                case 'F':
+                        if (parse_size(optarg, &bopts.max_inflight) < 0)
+                                usage_and_die();
+                        break;
+                case 'T':
+                        if (split_parse_mode(optarg, &spopts.mode) < 0)
+                                usage_and_die();
+                        split_mode = optarg;
+                        break;
+                case 'E':
+                        errors_path = optarg;
+                        break;
+                case 'N':
+                        if (parse_count(optarg, SIZE_MAX, &count) < 0)
+                                usage_and_die();
+                        spopts.limit = count;
+                        break;
+                case 'H':
+                        if (split_parse_shard(optarg, &spopts.shard,
+                                              &spopts.shards) < 0)
+                                usage_and_die();
+                        break;
+                case 'G':
+                        if (!strcmp(optarg, "array"))
+                                merge_array = 1;
+                        else if (strcmp(optarg, "ndjson"))
+                                usage_and_die();
+                        merge = 1;
+                        break;
+                case 'X':
+                        index_path = optarg;
+                        break;
+                case 'K':
+                        index_key = optarg;
+                        break;
+                case 'U':
+                        lookup_path = optarg;
+                        break;
+                case 'A':
+                        cache_dir = optarg;
+                        break;
+                case 'B':
+                        if (parse_size(optarg, &cache_size) < 0)
+                                usage_and_die();
+                        break;
+                case 'L':
+                        if (select_add(&sel, optarg) < 0) {
+                                fprintf(stderr, "%s: not a path of element "
+                                        "names\n", optarg);
+                                usage_and_die();
+                        }
+                        copts.select = &sel;
+                        cstring_addstr(&cache_opts, "select=");
+                        cstring_addstr(&cache_opts, optarg);
+                        cstring_addch(&cache_opts, '\n');
+                        break;
+                case 'M':
+                        if (input_parse_flags(optarg, &input_flags,
+                                              &prefault_ahead) < 0)
+                                usage_and_die();
+                        break;
                 case 'h':
                 case '?':
                 default:
@@ -484,36 +553,235 @@ int main(int argc, char **argv)
                 }
         }
 
+        if (stats_enabled)
+                xmlMemSetup(xml_mem_free, xml_mem_malloc, xml_mem_realloc,
+                            xml_mem_strdup);
+
+        if (!bopts.jobs)
+                bopts.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        if (!bopts.jobs)
+                bopts.jobs = 1;
+
+        if (split_mode != NULL && (bopts.outdir || sopts.path || client_path))
+                usage_and_die();
+        if ((errors_path != NULL || spopts.limit || spopts.shards) &&
+            split_mode == NULL)
+                usage_and_die();
+        if (index_key != NULL && index_path == NULL)
+                usage_and_die();
+        if (cache_dir != NULL && bopts.outdir == NULL)
+                usage_and_die();
+        /* A partial tree would not validate */
+        if (sel.nr && xsdfile != NULL)
+                usage_and_die();
+
+        if (index_path != NULL) {
+                if (argc - optind != 1 || lookup_path || merge ||
+                    bopts.outdir || sopts.path || client_path || xsdfile ||
+                    sel.nr || errors_path || spopts.limit || spopts.shards)
+                        usage_and_die();
+                if (split_mode == NULL)
+                        spopts.mode = SPLIT_RECORDS;
+
+                ret = run_index(index_path, argv[optind], spopts.mode,
+                                index_key, input_flags);
+                exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (lookup_path != NULL) {
+                if (argc - optind < 2 || merge || split_mode || bopts.outdir ||
+                    sopts.path || client_path || xsdfile)
+                        usage_and_die();
+
+                xmlInitParser();
+                copts.xml_options = xml_options | XML_PARSE_NOERROR |
+                        XML_PARSE_NOWARNING;
+                ret = run_lookup(lookup_path, argv[optind], argv + optind + 1,
+                                 argc - optind - 1, &copts);
+                xmlCleanupParser();
+                select_free(&sel);
+                stats_report(stderr, stats_json);
+
+                exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (merge) {
+                if (argc - optind < 1 || split_mode || bopts.outdir ||
+                    sopts.path || client_path || xsdfile || sel.nr)
+                        usage_and_die();
+
+                output_init(&out, STDOUT_FILENO);
+                ret = split_merge(argv + optind, argc - optind, merge_array,
+                                  &out, &failed_part);
+                if (ret < 0)
+                        fprintf(stderr, "%s: %s\n", failed_part,
+                                strerror(errno));
+                output_release(&out);
+
+                exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (client_path != NULL) {
+                if (argc - optind < 1 || bopts.outdir || sopts.path || xsdfile ||
+                    sel.nr)
+                        usage_and_die();
+
+                ret = run_client(client_path, argv + optind, argc - optind,
+                                 input_flags);
+                exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (sopts.path != NULL) {
+                if (argc != optind || bopts.outdir != NULL)
+                        usage_and_die();
+
+                xmlInitParser();
+
+                /* The schema is compiled once, validation contexts are per
+                 * worker */
+                if (xsdfile != NULL) {
+                        ctxt = xmlSchemaNewParserCtxt(xsdfile);
+                        copts.schema = xmlSchemaParse(ctxt);
+                        xmlSchemaFreeParserCtxt(ctxt);
+                        if (copts.schema == NULL)
+                                exit(EXIT_FAILURE);
+                }
+
+                copts.xml_options = xml_options;
+                sopts.jobs = bopts.jobs;
+                sopts.small_max = bopts.small_max;
+                sopts.max_inflight = bopts.max_inflight;
+                sopts.convert = convert_buffer;
+                sopts.convert_data = &copts;
+                sopts.thread_done = convert_thread_done;
+
+                ret = serve_run(&sopts);
+                if (copts.schema != NULL)
+                        xmlSchemaFree(copts.schema);
+                xmlCleanupParser();
+                select_free(&sel);
+                stats_report(stderr, stats_json);
+
+                exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (bopts.outdir != NULL) {
+                if (argc - optind < 1 || xsdfile != NULL)
+                        usage_and_die();
+
+                copts.xml_options = xml_options;
+                bopts.convert = convert_buffer;
+                bopts.convert_data = &copts;
+                bopts.thread_done = convert_thread_done;
+
+                /* Anything that changes the output must change the key */
+                if (cache_dir != NULL) {
+                        char buf[32];
+
+                        snprintf(buf, sizeof(buf), "xml_options=%d\n",
+                                 xml_options);
+                        cstring_addstr(&cache_opts, buf);
+                        if (cache_open(&cache, cache_dir, cache_size,
+                                       cache_opts.buf, cache_opts.len) < 0) {
+                                fprintf(stderr, "%s: %s\n", cache_dir,
+                                        strerror(errno));
+                                exit(EXIT_FAILURE);
+                        }
+                        bopts.cache = &cache;
+                }
+
+                /* libxml2 must be initialised before threads use it */
+                xmlInitParser();
+                ret = batch_run(&bopts, argv + optind, argc - optind);
+                if (bopts.cache != NULL)
+                        cache_close(&cache);
+                cstring_release(&cache_opts);
+                xmlCleanupParser();
+                select_free(&sel);
+                stats_report(stderr, stats_json);
+
+                exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
         if (argc - optind != 1) {
                 usage_and_die();
         }
 
-        xmlfile = argv[optind++];
+        if (split_mode != NULL) {
+                xmlfile = argv[optind];
 
-        /* mmap the file() */
-        if (stat(xmlfile, &sbinfo) < 0) {
-                perror("stat: ");
-                exit(EXIT_FAILURE);
+                xmlInitParser();
+                if (xsdfile != NULL) {
+                        ctxt = xmlSchemaNewParserCtxt(xsdfile);
+                        copts.schema = xmlSchemaParse(ctxt);
+                        xmlSchemaFreeParserCtxt(ctxt);
+                        if (copts.schema == NULL)
+                                exit(EXIT_FAILURE);
+                }
+
+                stats_start(&t);
+                if (input_open(&in, xmlfile, input_flags, prefault_ahead) < 0) {
+                        perror("open: ");
+                        exit(EXIT_FAILURE);
+                }
+                stats_stop(&t, STATS_INPUT);
+
+                if (errors_path != NULL &&
+                    (spopts.errors = fopen(errors_path, "w")) == NULL) {
+                        perror(errors_path);
+                        exit(EXIT_FAILURE);
+                }
+
+                /* Failures are reported once, by split_run() */
+                copts.xml_options = xml_options | XML_PARSE_NOERROR |
+                        XML_PARSE_NOWARNING;
+                spopts.jobs = bopts.jobs;
+                spopts.small_max = bopts.small_max;
+                spopts.max_inflight = bopts.max_inflight;
+                spopts.convert = convert_buffer;
+                spopts.convert_data = &copts;
+                spopts.thread_done = convert_thread_done;
+                spopts.last_error = convert_last_error;
+
+                output_init(&out, STDOUT_FILENO);
+                ret = split_run(&spopts, &in, xmlfile, &out);
+                stats_start(&t);
+                output_release(&out);
+                stats_stop(&t, STATS_WRITE);
+                input_close(&in);
+                if (spopts.errors != NULL)
+                        fclose(spopts.errors);
+
+                if (copts.schema != NULL)
+                        xmlSchemaFree(copts.schema);
+                xmlCleanupParser();
+                select_free(&sel);
+                stats_report(stderr, stats_json);
+
+                exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
         }
 
-        if ((fd = open(xmlfile, O_RDONLY)) < 0) {
+        xmlfile = argv[optind++];
+
+        /* mmap the file() */
+        stats_start(&t);
+        if (input_open(&in, xmlfile, input_flags, prefault_ahead) < 0) {
                 perror("open: ");
                 exit(EXIT_FAILURE);
         }
-
-        base = mmap(NULL, sbinfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
-        if (base == (void *) MAP_FAILED){
-                close(fd);
-                perror("mmap: ");
+        if (!in.size) {
+                fprintf(stderr, "%s: empty file\n", xmlfile);
                 exit(EXIT_FAILURE);
         }
+        stats_stop(&t, STATS_INPUT);
+        STATS_ADD(bytes_in, in.size);
 
         /* Read into an xmlDocPtr */
-        doc = xmlReadMemory((char *) base, sbinfo.st_size, xmlfile,
-                            NULL, xml_options);
+        stats_start(&t);
+        doc = read_xml_input(&in, xmlfile, xml_options, copts.select);
+        stats_stop(&t, STATS_PARSE);
 
-        munmap((char *)base, sbinfo.st_size);
-        close(fd);
+        input_close(&in);
 
         /* Read the xsd and validate the xml before building XSD and XML/JSON
            structures */
@@ -541,7 +809,9 @@ int main(int argc, char **argv)
                 xmlSchemaSetValidErrors(vctxt, (xmlSchemaValidityErrorFunc)fprintf,
                                         (xmlSchemaValidityWarningFunc) fprintf,
                                         stderr);
+                stats_start(&t);
                 ret = xmlSchemaValidateDoc(vctxt, doc);
+                stats_stop(&t, STATS_VALIDATE);
                 if (ret == 0) {
                         printf("%s validates\n", xmlfile);
                 } else if (ret > 0) {
@@ -552,13 +822,25 @@ int main(int argc, char **argv)
         }
 
 		if(xsdroot != NULL)  {
+				stats_start(&t);
 				walkXsdSchema(xsdroot);
+				stats_stop(&t, STATS_XSD);
 				print_array_elements();
 				xsdschemafree();
 		}
-        parse_xml_tree(doc, xsdfile ? xsdroot : NULL);
+        /* Anything printed so far must reach stdout before our output */
+        fflush(stdout);
+        output_init(&out, STDOUT_FILENO);
+        parse_xml_tree(doc, xsdfile ? xsdroot : NULL, &out);
+        stats_start(&t);
+        output_release(&out);
+        stats_stop(&t, STATS_WRITE);
+        STATS_ADD(bytes_out, out.bytes);
 
         xmlFreeDoc(doc);
+        convert_thread_done(NULL);
+        select_free(&sel);
+        stats_report(stderr, stats_json);
 
         exit(EXIT_SUCCESS);
 }